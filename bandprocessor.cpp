@@ -0,0 +1,102 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include "bandprocessor.h"
+
+#include <QAtomicInt>
+#include <QFuture>
+#include <QList>
+#include <QThread>
+#include <QGlobalStatic>
+#include <QtConcurrent/QtConcurrentRun>
+
+#define BAND_PIXELS 262144
+
+Q_GLOBAL_STATIC(QThreadPool, bandPool)
+
+QThreadPool *BandProcessor::pool()
+{
+    return bandPool();
+}
+
+size_t BandProcessor::bandRows(size_t width)
+{
+    if (width == 0 || width >= BAND_PIXELS) { return 1; }
+    return BAND_PIXELS / width;
+}
+
+// threads a run of these bands starts, the caller included
+int BandProcessor::workers(size_t rows,
+                           size_t bandRows,
+                           int threads)
+{
+    if (bandRows == 0) { bandRows = 1; }
+    const int bands = static_cast<int>((rows + bandRows - 1) / bandRows);
+    if (threads < 1) { threads = QThread::idealThreadCount(); }
+    return qMax(1, qMin(threads, bands));
+}
+
+void BandProcessor::run(size_t rows,
+                        size_t bandRows,
+                        int threads,
+                        const Function &function,
+                        const QAtomicInt *cancel)
+{
+    runWorkers(rows, bandRows, threads, [&function](int, size_t first, size_t count) {
+        function(first, count);
+    }, cancel);
+}
+
+// the function is told which worker runs the band, 0 to workers() - 1,
+// so it can keep per thread state without locking
+void BandProcessor::runWorkers(size_t rows,
+                               size_t bandRows,
+                               int threads,
+                               const WorkerFunction &function,
+                               const QAtomicInt *cancel)
+{
+    if (rows == 0) { return; }
+    if (bandRows == 0) { bandRows = 1; }
+    const int bands = static_cast<int>((rows + bandRows - 1) / bandRows);
+    threads = workers(rows, bandRows, threads);
+
+    // every thread, the caller included, keeps taking the next free band
+    // until none are left, so a slow band never holds the others back,
+    // a cancelled run leaves the remaining bands untouched
+    QAtomicInt next(0);
+    auto worker = [&next, bands, bandRows, rows, &function, cancel](int index) {
+        for (;;) {
+            if (cancel && cancel->loadAcquire()) { break; }
+            int band = next.fetchAndAddRelaxed(1);
+            if (band >= bands) { break; }
+            size_t first = static_cast<size_t>(band) * bandRows;
+            size_t count = qMin(bandRows, rows - first);
+            function(index, first, count);
+        }
+    };
+
+    QList<QFuture<void> > helpers;
+    for (int i = 1; i < threads; ++i) {
+        helpers.append(QtConcurrent::run(pool(), worker, i));
+    }
+    worker(0);
+    for (int i = 0; i < helpers.size(); ++i) {
+        helpers[i].waitForFinished();
+    }
+}
@@ -0,0 +1,51 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef BANDPROCESSOR_H
+#define BANDPROCESSOR_H
+
+#include <QThreadPool>
+#include <QAtomicInt>
+
+#include <functional>
+
+class BandProcessor
+{
+public:
+    typedef std::function<void(size_t first, size_t count)> Function;
+    typedef std::function<void(int worker, size_t first, size_t count)> WorkerFunction;
+
+    static QThreadPool *pool();
+    static size_t bandRows(size_t width);
+    static int workers(size_t rows,
+                       size_t bandRows,
+                       int threads);
+    static void run(size_t rows,
+                    size_t bandRows,
+                    int threads,
+                    const Function &function,
+                    const QAtomicInt *cancel = nullptr);
+    static void runWorkers(size_t rows,
+                           size_t bandRows,
+                           int threads,
+                           const WorkerFunction &function,
+                           const QAtomicInt *cancel = nullptr);
+};
+
+#endif // BANDPROCESSOR_H
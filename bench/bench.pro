@@ -0,0 +1,37 @@
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+
+QT -= gui
+CONFIG += console
+CONFIG -= app_bundle
+TARGET = color-converter-bench
+
+DESTDIR = build
+OBJECTS_DIR = $${DESTDIR}/.obj
+MOC_DIR = $${DESTDIR}/.moc
+RCC_DIR = $${DESTDIR}/.qrc
+
+include(../engine.pri)
+
+SOURCES += \
+    main.cpp
+
+# make verify fails when a mode drifts from the ImageMagick path
+verify.commands = $(DESTDIR)$(TARGET) --verify --runs 3
+!isEmpty(VERIFY_THRESHOLDS): verify.commands += --thresholds $${VERIFY_THRESHOLDS}
+verify.depends = $(DESTDIR)$(TARGET)
+QMAKE_EXTRA_TARGETS += verify
@@ -0,0 +1,1016 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QSysInfo>
+#include <QTextStream>
+#include <QThread>
+#include <QUrl>
+
+#include <Magick++.h>
+#include <lcms2.h>
+#include <tiffio.h>
+
+#include <cstdio>
+#include <jpeglib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "converter.h"
+#include "jobreport.h"
+#include "lutkernel.h"
+#include "profileregistry.h"
+
+// larger outputs are compared on a grid of about this many pixels
+#define VERIFY_SAMPLES 4194304
+
+enum ExitCode {
+    ExitSuccess = 0,
+    ExitRegression = 1,
+    ExitUsage = 2,
+    ExitFailed = 3
+};
+
+static QString colorSpaceName(Converter::colorSpace cs)
+{
+    switch (cs) {
+    case Converter::colorSpaceCMYK:
+        return QString("cmyk");
+    case Converter::colorSpaceGRAY:
+        return QString("gray");
+    default:;
+    }
+    return QString("rgb");
+}
+
+static bool parseColorSpace(const QString &name, Converter::colorSpace *cs)
+{
+    if (name == QString("rgb")) {
+        *cs = Converter::colorSpaceRGB;
+    } else if (name == QString("cmyk")) {
+        *cs = Converter::colorSpaceCMYK;
+    } else if (name == QString("gray")) {
+        *cs = Converter::colorSpaceGRAY;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// the input of a case, a colour space with an a for alpha and +icc when
+// the bundled profile is embedded
+static QString sourceName(Converter::colorSpace cs, bool alpha, bool embedded)
+{
+    QString name = colorSpaceName(cs);
+    if (alpha) { name.append(QString("a")); }
+    if (embedded) { name.append(QString("+icc")); }
+    return name;
+}
+
+static bool parseSource(const QString &name, Converter::colorSpace *cs, bool *alpha, bool *embedded)
+{
+    QString value = name;
+    *embedded = value.endsWith(QString("+icc"));
+    if (*embedded) { value.chop(4); }
+    *alpha = value.endsWith(QString("a"));
+    if (*alpha) { value.chop(1); }
+    return parseColorSpace(value, cs);
+}
+
+static QString modeName(Converter::ConversionMode mode, bool lut)
+{
+    if (lut) { return QString("lut"); }
+    switch (mode) {
+    case Converter::MagickConversionMode:
+        return QString("magick");
+    case Converter::StreamConversionMode:
+        return QString("stream");
+    default:;
+    }
+    return QString("native");
+}
+
+// lut is the native path with the precomputed 3D LUT
+static bool parseMode(const QString &name, Converter::ConversionMode *mode, bool *lut)
+{
+    *lut = false;
+    if (name == QString("native")) {
+        *mode = Converter::NativeConversionMode;
+    } else if (name == QString("lut")) {
+        *mode = Converter::NativeConversionMode;
+        *lut = true;
+    } else if (name == QString("magick")) {
+        *mode = Converter::MagickConversionMode;
+    } else if (name == QString("stream")) {
+        *mode = Converter::StreamConversionMode;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static QString intentName(Converter::RenderingIntent intent)
+{
+    switch (intent) {
+    case Converter::SaturationRenderingIntent:
+        return QString("saturation");
+    case Converter::AbsoluteRenderingIntent:
+        return QString("absolute");
+    case Converter::RelativeRenderingIntent:
+        return QString("relative");
+    case Converter::UndefinedRenderingIntent:
+        return QString("undefined");
+    default:;
+    }
+    return QString("perceptual");
+}
+
+static bool parseIntent(const QString &name, Converter::RenderingIntent *intent)
+{
+    if (name == QString("perceptual")) {
+        *intent = Converter::PerceptualRenderingIntent;
+    } else if (name == QString("relative")) {
+        *intent = Converter::RelativeRenderingIntent;
+    } else if (name == QString("saturation")) {
+        *intent = Converter::SaturationRenderingIntent;
+    } else if (name == QString("absolute")) {
+        *intent = Converter::AbsoluteRenderingIntent;
+    } else if (name == QString("undefined")) {
+        *intent = Converter::UndefinedRenderingIntent;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+struct Case
+{
+    QString format = QString("tif");
+    int size = 1024;
+    int depth = 8;
+    Converter::colorSpace cs = Converter::colorSpaceRGB;
+    bool alpha = false;
+    bool embedded = false;
+    Converter::colorSpace target = Converter::colorSpaceCMYK;
+    Converter::ConversionMode mode = Converter::NativeConversionMode;
+    bool lut = false;
+    Converter::RenderingIntent intent = Converter::PerceptualRenderingIntent;
+
+    QString id() const
+    {
+        return QString("%1-%2-%3-%4-to-%5-%6-%7")
+                .arg(format).arg(size).arg(depth)
+                .arg(sourceName(cs, alpha, embedded)).arg(colorSpaceName(target))
+                .arg(modeName(mode, lut)).arg(intentName(intent));
+    }
+
+    // the bundled samples are used as they are, whatever the size
+    bool isSample() const
+    {
+        return format.startsWith(QString("sample."));
+    }
+
+    QString inputName() const
+    {
+        if (isSample()) { return format; }
+        return QString("synthetic-%1-%2-%3.%4").arg(size).arg(depth).arg(sourceName(cs, alpha, embedded)).arg(format);
+    }
+
+    static bool parse(const QString &id, Case *result)
+    {
+        QStringList parts = id.split('-');
+        if (parts.size() != 8 || parts.at(4) != QString("to")) { return false; }
+        Case item;
+        bool sizeOk = false;
+        bool depthOk = false;
+        item.format = parts.at(0);
+        item.size = parts.at(1).toInt(&sizeOk);
+        item.depth = parts.at(2).toInt(&depthOk);
+        if (!sizeOk || !depthOk ||
+            !parseSource(parts.at(3), &item.cs, &item.alpha, &item.embedded) ||
+            !parseColorSpace(parts.at(5), &item.target) ||
+            !parseMode(parts.at(6), &item.mode, &item.lut) ||
+            !parseIntent(parts.at(7), &item.intent)) { return false; }
+        *result = item;
+        return true;
+    }
+};
+
+static quint32 noise(quint32 x, quint32 y, quint32 c)
+{
+    quint32 hash = (x * 0x9E3779B1u) ^ (y * 0x85EBCA77u) ^ (c * 0xC2B2AE3Du);
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6Du;
+    hash ^= hash >> 12;
+    hash *= 0x297A2D39u;
+    hash ^= hash >> 15;
+    return hash;
+}
+
+// ramps in a different direction for each channel with some noise on
+// top, the same pixels on every run and no flat areas for the codecs
+static void syntheticRow(std::vector<unsigned char> &row,
+                         size_t y,
+                         size_t size,
+                         size_t channels,
+                         int depth)
+{
+    const size_t last = size > 1 ? size - 1 : 1;
+    for (size_t x = 0; x < size; ++x) {
+        for (size_t c = 0; c < channels; ++c) {
+            size_t ramp = 0;
+            switch (c % 3) {
+            case 0:
+                ramp = x * 65535 / last;
+                break;
+            case 1:
+                ramp = y * 65535 / last;
+                break;
+            default:
+                ramp = (x + y) * 65535 / (last * 2);
+            }
+            quint32 value = static_cast<quint32>(ramp) / 16 * 15 +
+                            (noise(static_cast<quint32>(x), static_cast<quint32>(y), static_cast<quint32>(c)) & 0x0FFF);
+            value = qMin<quint32>(value, 65535);
+            if (depth == 16) {
+                reinterpret_cast<quint16*>(row.data())[x * channels + c] = static_cast<quint16>(value);
+            } else {
+                row[x * channels + c] = static_cast<unsigned char>(value >> 8);
+            }
+        }
+    }
+}
+
+static bool writeTiff(const QString &filename, const Case &item)
+{
+    const size_t size = static_cast<size_t>(item.size);
+    const size_t channels = Converter::pixelChannels(item.cs, item.alpha);
+    const qint64 bytes = static_cast<qint64>(size) * static_cast<qint64>(size * channels * static_cast<size_t>(item.depth / 8));
+    TIFF *tiff = TIFFOpen(QFile::encodeName(filename).constData(), bytes > Q_INT64_C(0xF0000000) ? "w8" : "w");
+    if (!tiff) { return false; }
+    TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, static_cast<uint32_t>(size));
+    TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, static_cast<uint32_t>(size));
+    TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, static_cast<uint16_t>(item.depth));
+    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, static_cast<uint16_t>(channels));
+    TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tiff, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+    switch (item.cs) {
+    case Converter::colorSpaceCMYK:
+        TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_SEPARATED);
+        TIFFSetField(tiff, TIFFTAG_INKSET, INKSET_CMYK);
+        break;
+    case Converter::colorSpaceGRAY:
+        TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+        break;
+    default:
+        TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+    }
+    if (item.alpha) {
+        uint16_t extra = EXTRASAMPLE_UNASSALPHA;
+        TIFFSetField(tiff, TIFFTAG_EXTRASAMPLES, 1, &extra);
+    }
+    if (item.embedded) {
+        const QByteArray profile = ProfileRegistry::instance()->fallback(item.cs).data;
+        TIFFSetField(tiff, TIFFTAG_ICCPROFILE, static_cast<uint32_t>(profile.size()), profile.constData());
+    }
+    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tiff, 0));
+
+    bool ok = true;
+    std::vector<unsigned char> row(size * channels * static_cast<size_t>(item.depth / 8));
+    for (size_t y = 0; ok && y < size; ++y) {
+        syntheticRow(row, y, size, channels, item.depth);
+        ok = TIFFWriteScanline(tiff, row.data(), static_cast<uint32_t>(y), 0) >= 0;
+    }
+    TIFFClose(tiff);
+    return ok;
+}
+
+static bool writeJpeg(const QString &filename, const Case &item)
+{
+    FILE *file = fopen(QFile::encodeName(filename).constData(), "wb");
+    if (!file) { return false; }
+
+    const size_t size = static_cast<size_t>(item.size);
+    const size_t channels = Converter::pixelChannels(item.cs, false);
+    jpeg_compress_struct info;
+    jpeg_error_mgr error;
+    info.err = jpeg_std_error(&error);
+    jpeg_create_compress(&info);
+    jpeg_stdio_dest(&info, file);
+    info.image_width = static_cast<JDIMENSION>(size);
+    info.image_height = static_cast<JDIMENSION>(size);
+    info.input_components = static_cast<int>(channels);
+    switch (item.cs) {
+    case Converter::colorSpaceCMYK:
+        info.in_color_space = JCS_CMYK;
+        break;
+    case Converter::colorSpaceGRAY:
+        info.in_color_space = JCS_GRAYSCALE;
+        break;
+    default:
+        info.in_color_space = JCS_RGB;
+    }
+    jpeg_set_defaults(&info);
+    jpeg_set_quality(&info, 90, TRUE);
+    jpeg_start_compress(&info, TRUE);
+
+    // the profile is split over as many APP2 markers as it needs
+    if (item.embedded) {
+        const QByteArray profile = ProfileRegistry::instance()->fallback(item.cs).data;
+        const int chunk = 65519;
+        const int count = (profile.size() + chunk - 1) / chunk;
+        for (int i = 0; i < count; ++i) {
+            QByteArray marker("ICC_PROFILE", 12);
+            marker.append(static_cast<char>(i + 1));
+            marker.append(static_cast<char>(count));
+            marker.append(profile.mid(i * chunk, chunk));
+            jpeg_write_marker(&info, JPEG_APP0 + 2,
+                              reinterpret_cast<const JOCTET*>(marker.constData()),
+                              static_cast<unsigned int>(marker.size()));
+        }
+    }
+
+    std::vector<unsigned char> row(size * channels);
+    for (size_t y = 0; y < size; ++y) {
+        syntheticRow(row, y, size, channels, 8);
+        JSAMPROW data = row.data();
+        jpeg_write_scanlines(&info, &data, 1);
+    }
+    jpeg_finish_compress(&info);
+    jpeg_destroy_compress(&info);
+    return fclose(file) == 0;
+}
+
+static bool generateImage(const QString &filename, const Case &item)
+{
+    if (QFile::exists(filename)) { return true; }
+    QDir().mkpath(QFileInfo(filename).absolutePath());
+    if (item.isSample()) { return QFile::copy(QString(":/%1").arg(item.format), filename); }
+    QString partial = filename + QString(".partial");
+    bool ok = item.format == QString("jpg") ? writeJpeg(partial, item) : writeTiff(partial, item);
+    if (!ok || !QFile::rename(partial, filename)) {
+        QFile::remove(partial);
+        return false;
+    }
+    return true;
+}
+
+static double percentile(const std::vector<double> &sorted, double percent)
+{
+    if (sorted.empty()) { return 0; }
+    size_t rank = static_cast<size_t>(std::ceil(percent / 100.0 * static_cast<double>(sorted.size())));
+    if (rank > 0) { rank--; }
+    return sorted.at(qMin(rank, sorted.size() - 1));
+}
+
+static QJsonObject describeCase(const Case &item)
+{
+    QJsonObject object;
+    object.insert("id", item.id());
+    object.insert("format", item.format);
+    object.insert("width", item.size);
+    object.insert("height", item.size);
+    object.insert("depth", item.depth);
+    object.insert("colorspace", colorSpaceName(item.cs));
+    object.insert("target", colorSpaceName(item.target));
+    object.insert("mode", modeName(item.mode, item.lut));
+    object.insert("intent", intentName(item.intent));
+    return object;
+}
+
+// where --verify keeps the output of the last run of a case
+static QString verifyPath(const QString &workDir, const Case &item)
+{
+    return QDir(workDir).filePath(QString("verify/%1.%2").arg(item.id()).arg(QFileInfo(item.inputName()).suffix()));
+}
+
+static QJsonObject runCase(const Case &item,
+                           const QString &input,
+                           const QString &workDir,
+                           int runs,
+                           int warmup,
+                           int jobs,
+                           int threads,
+                           bool keep)
+{
+    Converter converter;
+    if (jobs > 0) { converter.setMaxJobs(jobs); }
+    Converter::Options options;
+    options.outputProfile = ProfileRegistry::instance()->load(QString(":/profile-%1.icc").arg(colorSpaceName(item.target))).data;
+    options.intent = item.intent;
+    options.mode = item.mode;
+    options.lut = item.lut;
+    options.threads = threads;
+    options.outputDirectory = QDir(workDir).filePath(QString("output"));
+
+    QList<QUrl> urls;
+    urls << QUrl::fromLocalFile(input);
+    std::vector<double> latencies;
+    double cold = 0;
+    double lutDeltaE = -1;
+    QString error;
+    for (int i = 0; i < warmup + runs; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        QList<Converter::Result> results = converter.convertUrls(urls, options);
+        const double ms = static_cast<double>(timer.nsecsElapsed()) / 1000000.0;
+        if (results.isEmpty() || !results.first().success) {
+            error = results.isEmpty() ? QString("No result") : results.first().error;
+            break;
+        }
+        if (keep && i == warmup + runs - 1) {
+            const QString kept = verifyPath(workDir, item);
+            QDir().mkpath(QFileInfo(kept).absolutePath());
+            QFile::remove(kept);
+            QFile::rename(results.first().output, kept);
+        }
+        QFile::remove(results.first().output);
+        lutDeltaE = results.first().stats.lutDeltaE;
+        if (i == 0) { cold = ms; }
+        if (i >= warmup) { latencies.push_back(ms); }
+    }
+
+    QJsonObject result = describeCase(item);
+    result.insert("peakMemory", static_cast<double>(JobReport::peakMemory()));
+    if (lutDeltaE >= 0) { result.insert("lutDeltaE", lutDeltaE); }
+    if (!error.isEmpty() || latencies.empty()) {
+        result.insert("error", error.isEmpty() ? QString("No runs") : error);
+        return result;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    double total = 0;
+    for (size_t i = 0; i < latencies.size(); ++i) { total += latencies.at(i); }
+    const double median = percentile(latencies, 50);
+    double megapixels = static_cast<double>(item.size) * item.size / 1000000.0;
+    if (item.isSample()) {
+        try {
+            Magick::Image image;
+            image.ping(input.toStdString());
+            megapixels = static_cast<double>(image.columns()) * static_cast<double>(image.rows()) / 1000000.0;
+        }
+        catch(Magick::Exception &) {}
+    }
+
+    QJsonObject latency;
+    latency.insert("cold", cold);
+    latency.insert("min", latencies.front());
+    latency.insert("mean", total / static_cast<double>(latencies.size()));
+    latency.insert("p50", median);
+    latency.insert("p90", percentile(latencies, 90));
+    latency.insert("p99", percentile(latencies, 99));
+    latency.insert("max", latencies.back());
+    result.insert("runs", static_cast<int>(latencies.size()));
+    result.insert("latencyMs", latency);
+    result.insert("mpixPerSecond", median > 0 ? megapixels / (median / 1000.0) : 0.0);
+    return result;
+}
+
+static QJsonObject runIsolated(const Case &item,
+                               const QStringList &childArgs)
+{
+    // a process per case, so peak memory belongs to that case alone
+    QProcess process;
+    process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    process.start(QCoreApplication::applicationFilePath(), childArgs);
+    process.waitForFinished(-1);
+
+    QList<QByteArray> lines = process.readAllStandardOutput().trimmed().split('\n');
+    QJsonDocument document = QJsonDocument::fromJson(lines.last());
+    if (process.exitStatus() != QProcess::NormalExit || !document.isObject()) {
+        QJsonObject result = describeCase(item);
+        result.insert("error", QString("Benchmark process failed"));
+        return result;
+    }
+    return document.object();
+}
+
+static QJsonObject hostInfo()
+{
+    QJsonObject host;
+    host.insert("cpus", QThread::idealThreadCount());
+    host.insert("os", QSysInfo::prettyProductName());
+    host.insert("arch", QSysInfo::currentCpuArchitecture());
+    host.insert("magick", QString(MagickLibVersionText));
+    host.insert("quantum", QString(MagickCore::GetMagickQuantumDepth(nullptr)));
+    host.insert("lcms", LCMS_VERSION);
+    host.insert("lutKernel", LutKernel::kernelName(LutKernel::bestKernel()));
+    return host;
+}
+
+static int compareBaseline(const QJsonArray &cases,
+                           const QString &filename,
+                           double tolerance,
+                           QTextStream &out)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        out << QString("Unable to read baseline: %1").arg(filename) << '\n';
+        return -1;
+    }
+    QHash<QString, double> baseline;
+    QJsonArray previous = QJsonDocument::fromJson(file.readAll()).object().value("cases").toArray();
+    for (int i = 0; i < previous.size(); ++i) {
+        QJsonObject item = previous.at(i).toObject();
+        if (item.contains("mpixPerSecond")) {
+            baseline.insert(item.value("id").toString(), item.value("mpixPerSecond").toDouble());
+        }
+    }
+
+    int regressions = 0;
+    for (int i = 0; i < cases.size(); ++i) {
+        QJsonObject item = cases.at(i).toObject();
+        QString id = item.value("id").toString();
+        if (!baseline.contains(id) || !item.contains("mpixPerSecond")) { continue; }
+        const double before = baseline.value(id);
+        const double now = item.value("mpixPerSecond").toDouble();
+        const double change = before > 0 ? (now / before - 1.0) * 100.0 : 0;
+        const bool regression = change < -tolerance;
+        if (regression) { regressions++; }
+        out << QString("%1\t%2\t%3\t%4%\t%5")
+               .arg(id)
+               .arg(before, 0, 'f', 1)
+               .arg(now, 0, 'f', 1)
+               .arg(change, 0, 'f', 1)
+               .arg(regression ? QString("REGRESSION") : QString()) << '\n';
+    }
+    return regressions;
+}
+
+// the largest difference --verify accepts against the ImageMagick path,
+// the defaults leave room for 8-bit rounding and the LUT interpolation
+struct Thresholds
+{
+    double meanDeltaE = 0.5;
+    double p99DeltaE = 2.0;
+    double maxDeltaE = 6.0;
+    double minSpeedup = 0;
+
+    void read(const QJsonObject &object)
+    {
+        if (object.contains("meanDeltaE")) { meanDeltaE = object.value("meanDeltaE").toDouble(); }
+        if (object.contains("p99DeltaE")) { p99DeltaE = object.value("p99DeltaE").toDouble(); }
+        if (object.contains("maxDeltaE")) { maxDeltaE = object.value("maxDeltaE").toDouble(); }
+        if (object.contains("minSpeedup")) { minSpeedup = object.value("minSpeedup").toDouble(); }
+    }
+};
+
+// the "default" entry of the thresholds file applies to every mode,
+// an entry named after a mode overrides it
+static Thresholds modeThresholds(const QJsonObject &config, const QString &mode)
+{
+    Thresholds thresholds;
+    thresholds.read(config.value("default").toObject());
+    thresholds.read(config.value(mode).toObject());
+    return thresholds;
+}
+
+static QJsonObject compareOutputs(const QString &reference,
+                                  const QString &output,
+                                  const Converter::Profile &profile,
+                                  QString *error)
+{
+    Magick::Image expected;
+    Magick::Image actual;
+    try {
+        expected.quiet(true);
+        actual.quiet(true);
+        expected.read(reference.toStdString());
+        actual.read(output.toStdString());
+    }
+    catch(Magick::Error &err) {
+        *error = QString::fromUtf8(err.what());
+        return QJsonObject();
+    }
+    catch(Magick::Warning &) {}
+    const size_t width = expected.columns();
+    const size_t height = expected.rows();
+    if (width == 0 || height == 0 || actual.columns() != width || actual.rows() != height) {
+        *error = QString("Size differs from the reference");
+        return QJsonObject();
+    }
+
+    std::string map;
+    cmsUInt32Number format = TYPE_RGB_16;
+    switch (profile.cs) {
+    case Converter::colorSpaceCMYK:
+        map = "CMYK";
+        format = TYPE_CMYK_16;
+        break;
+    case Converter::colorSpaceGRAY:
+        map = "I";
+        format = TYPE_GRAY_16;
+        break;
+    default:
+        map = "RGB";
+    }
+    const size_t channels = map.size();
+    size_t step = 1;
+    while ((width / step) * (height / step) > VERIFY_SAMPLES) { step++; }
+
+    // alpha is copied the same way on every path, only the colour is compared
+    std::vector<quint16> row(width * channels);
+    std::vector<quint16> before;
+    std::vector<quint16> after;
+    try {
+        for (size_t y = 0; y < height; y += step) {
+            expected.write(0, static_cast<ssize_t>(y), width, 1, map, Magick::ShortPixel, row.data());
+            for (size_t x = 0; x < width; x += step) {
+                before.insert(before.end(), row.begin() + static_cast<long>(x * channels), row.begin() + static_cast<long>((x + 1) * channels));
+            }
+            actual.write(0, static_cast<ssize_t>(y), width, 1, map, Magick::ShortPixel, row.data());
+            for (size_t x = 0; x < width; x += step) {
+                after.insert(after.end(), row.begin() + static_cast<long>(x * channels), row.begin() + static_cast<long>((x + 1) * channels));
+            }
+        }
+    }
+    catch(Magick::Error &err) {
+        *error = QString::fromUtf8(err.what());
+        return QJsonObject();
+    }
+    catch(Magick::Warning &) {}
+
+    // both outputs are read back through the output profile, so the
+    // differences are in Lab whatever the output colour space
+    cmsHPROFILE device = cmsOpenProfileFromMem(profile.data.constData(), static_cast<cmsUInt32Number>(profile.data.size()));
+    cmsHPROFILE lab = cmsCreateLab4Profile(nullptr);
+    cmsHTRANSFORM transform = nullptr;
+    if (device && lab) {
+        transform = cmsCreateTransform(device, format, lab, TYPE_Lab_DBL, INTENT_RELATIVE_COLORIMETRIC, 0);
+    }
+    if (device) { cmsCloseProfile(device); }
+    if (lab) { cmsCloseProfile(lab); }
+    if (!transform) {
+        *error = QString("Unable to read the output profile");
+        return QJsonObject();
+    }
+    const size_t pixels = before.size() / channels;
+    std::vector<cmsCIELab> expectedLab(pixels);
+    std::vector<cmsCIELab> actualLab(pixels);
+    cmsDoTransform(transform, before.data(), expectedLab.data(), static_cast<cmsUInt32Number>(pixels));
+    cmsDoTransform(transform, after.data(), actualLab.data(), static_cast<cmsUInt32Number>(pixels));
+    cmsDeleteTransform(transform);
+
+    std::vector<double> deltas(pixels);
+    double total = 0;
+    qint64 identical = 0;
+    for (size_t i = 0; i < pixels; ++i) {
+        deltas[i] = cmsCIE2000DeltaE(&expectedLab[i], &actualLab[i], 1.0, 1.0, 1.0);
+        total += deltas[i];
+        if (std::equal(before.begin() + static_cast<long>(i * channels),
+                       before.begin() + static_cast<long>((i + 1) * channels),
+                       after.begin() + static_cast<long>(i * channels))) { identical++; }
+    }
+    std::sort(deltas.begin(), deltas.end());
+
+    QJsonObject accuracy;
+    accuracy.insert("pixels", static_cast<double>(pixels));
+    accuracy.insert("step", static_cast<int>(step));
+    accuracy.insert("identicalPercent", pixels > 0 ? 100.0 * static_cast<double>(identical) / static_cast<double>(pixels) : 0.0);
+    accuracy.insert("meanDeltaE", pixels > 0 ? total / static_cast<double>(pixels) : 0.0);
+    accuracy.insert("p95DeltaE", percentile(deltas, 95));
+    accuracy.insert("p99DeltaE", percentile(deltas, 99));
+    accuracy.insert("maxDeltaE", deltas.empty() ? 0.0 : deltas.back());
+    return accuracy;
+}
+
+// every case is compared to the same case converted by ImageMagick,
+// returns the number of cases past their thresholds
+static int verifyCases(const QList<Case> &cases,
+                       QJsonArray &results,
+                       const QString &workDir,
+                       const QJsonObject &config,
+                       QTextStream &out)
+{
+    QHash<QString, int> index;
+    for (int i = 0; i < cases.size(); ++i) {
+        index.insert(cases.at(i).id(), i);
+    }
+
+    int failures = 0;
+    for (int i = 0; i < cases.size(); ++i) {
+        const Case &item = cases.at(i);
+        if (item.mode == Converter::MagickConversionMode) { continue; }
+        QJsonObject result = results.at(i).toObject();
+        if (result.contains("error")) { continue; }
+        Case reference = item;
+        reference.mode = Converter::MagickConversionMode;
+        reference.lut = false;
+        if (!index.contains(reference.id())) { continue; }
+        const QJsonObject baseline = results.at(index.value(reference.id())).toObject();
+
+        const QString mode = modeName(item.mode, item.lut);
+        const Thresholds thresholds = modeThresholds(config, mode);
+        QStringList problems;
+        QJsonObject accuracy;
+        if (baseline.contains("error")) {
+            problems << QString("reference failed");
+        } else {
+            QString error;
+            const Converter::Profile profile = ProfileRegistry::instance()->load(QString(":/profile-%1.icc").arg(colorSpaceName(item.target)));
+            accuracy = compareOutputs(verifyPath(workDir, reference), verifyPath(workDir, item), profile, &error);
+            if (!error.isEmpty()) { problems << error; }
+        }
+        const double mean = accuracy.value("meanDeltaE").toDouble();
+        const double p99 = accuracy.value("p99DeltaE").toDouble();
+        const double max = accuracy.value("maxDeltaE").toDouble();
+        if (mean > thresholds.meanDeltaE) { problems << QString("mean dE %1 > %2").arg(mean, 0, 'f', 3).arg(thresholds.meanDeltaE); }
+        if (p99 > thresholds.p99DeltaE) { problems << QString("p99 dE %1 > %2").arg(p99, 0, 'f', 3).arg(thresholds.p99DeltaE); }
+        if (max > thresholds.maxDeltaE) { problems << QString("max dE %1 > %2").arg(max, 0, 'f', 3).arg(thresholds.maxDeltaE); }
+
+        const double speed = baseline.value("mpixPerSecond").toDouble();
+        const double speedup = speed > 0 ? result.value("mpixPerSecond").toDouble() / speed : 0;
+        if (thresholds.minSpeedup > 0 && speedup < thresholds.minSpeedup) {
+            problems << QString("speedup %1 < %2").arg(speedup, 0, 'f', 2).arg(thresholds.minSpeedup);
+        }
+
+        accuracy.insert("reference", reference.id());
+        accuracy.insert("speedup", speedup);
+        accuracy.insert("passed", problems.isEmpty());
+        if (!problems.isEmpty()) { accuracy.insert("problems", QJsonArray::fromStringList(problems)); }
+        result.insert("accuracy", accuracy);
+        results[i] = result;
+
+        if (!problems.isEmpty()) { failures++; }
+        out << QString("%1	mean %2	p99 %3	max %4	%5x	%6")
+               .arg(item.id())
+               .arg(mean, 0, 'f', 3)
+               .arg(p99, 0, 'f', 3)
+               .arg(max, 0, 'f', 3)
+               .arg(speedup, 0, 'f', 2)
+               .arg(problems.isEmpty() ? QString("ok") : QString("FAIL %1").arg(problems.join(QString(", ")))) << '\n';
+    }
+    return failures;
+}
+
+int main(int argc, char *argv[])
+{
+    Magick::InitializeMagick(*argv);
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QString("color-converter-bench"));
+    QCoreApplication::setOrganizationName(QString("NettStudio AS"));
+    QCoreApplication::setOrganizationDomain(QString("nettstudio.no"));
+    QCoreApplication::setApplicationVersion(QString(VERSION_APP));
+    QTextStream err(stderr);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QString("Color Converter benchmark %1").arg(QCoreApplication::applicationVersion()));
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption sizesOption(QStringList() << "sizes",
+                                   QString("Image sizes in pixels (square), comma separated."), QString("list"), QString("1024,4096"));
+    QCommandLineOption depthsOption(QStringList() << "depths",
+                                    QString("Bit depths, 8 and/or 16."), QString("list"), QString("8,16"));
+    QCommandLineOption colorspacesOption(QStringList() << "colorspaces",
+                                         QString("Input colour spaces: rgb, cmyk, gray, with a for alpha (TIFF only) and +icc for an embedded profile."), QString("list"), QString("rgb,cmyk,gray"));
+    QCommandLineOption targetsOption(QStringList() << "targets",
+                                     QString("Bundled output profiles: rgb, cmyk, gray."), QString("list"), QString("cmyk,rgb"));
+    QCommandLineOption formatsOption(QStringList() << "formats",
+                                     QString("Input formats: tif, jpg (8-bit only), sample (the bundled samples)."), QString("list"), QString("tif,jpg"));
+    QCommandLineOption modesOption(QStringList() << "modes",
+                                   QString("Conversion modes: native, lut, magick, stream."), QString("list"), QString("native,magick,stream"));
+    QCommandLineOption intentsOption(QStringList() << "intents",
+                                     QString("Rendering intents."), QString("list"), QString("perceptual,relative,saturation,absolute,undefined"));
+    QCommandLineOption runsOption(QStringList() << "runs",
+                                  QString("Timed runs per case, default 5."), QString("n"), QString("5"));
+    QCommandLineOption warmupOption(QStringList() << "warmup",
+                                    QString("Untimed runs before the timed ones, default 1."), QString("n"), QString("1"));
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs",
+                                  QString("Files converted in parallel."), QString("n"), QString("0"));
+    QCommandLineOption threadsOption(QStringList() << "t" << "threads",
+                                     QString("Threads used inside one image."), QString("n"), QString("0"));
+    QCommandLineOption workOption(QStringList() << "work",
+                                  QString("Directory for generated images and output."), QString("dir"),
+                                  QDir::temp().filePath(QString("color-converter-bench")));
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+                                    QString("Write the results as JSON to file instead of stdout."), QString("file"));
+    QCommandLineOption baselineOption(QStringList() << "baseline",
+                                      QString("Compare against an earlier result file."), QString("file"));
+    QCommandLineOption toleranceOption(QStringList() << "tolerance",
+                                       QString("Allowed slowdown against the baseline in percent, default 5."), QString("percent"), QString("5"));
+    QCommandLineOption verifyOption(QStringList() << "verify",
+                                    QString("Compare every mode to the ImageMagick path in CIEDE2000, over a corpus of edge cases unless the lists are given."));
+    QCommandLineOption thresholdsOption(QStringList() << "thresholds",
+                                        QString("JSON file with the accuracy and speed thresholds of --verify."), QString("file"));
+    QCommandLineOption inProcessOption(QStringList() << "in-process",
+                                       QString("Run all cases in this process, peak memory is then cumulative."));
+    QCommandLineOption caseOption(QStringList() << "run-case",
+                                  QString("Run a single case and print its result."), QString("id"));
+    caseOption.setFlags(QCommandLineOption::HiddenFromHelp);
+    parser.addOption(sizesOption);
+    parser.addOption(depthsOption);
+    parser.addOption(colorspacesOption);
+    parser.addOption(targetsOption);
+    parser.addOption(formatsOption);
+    parser.addOption(modesOption);
+    parser.addOption(intentsOption);
+    parser.addOption(runsOption);
+    parser.addOption(warmupOption);
+    parser.addOption(jobsOption);
+    parser.addOption(threadsOption);
+    parser.addOption(workOption);
+    parser.addOption(outputOption);
+    parser.addOption(baselineOption);
+    parser.addOption(toleranceOption);
+    parser.addOption(verifyOption);
+    parser.addOption(thresholdsOption);
+    parser.addOption(inProcessOption);
+    parser.addOption(caseOption);
+    parser.process(app);
+
+    const int runs = qMax(1, parser.value(runsOption).toInt());
+    const int warmup = qMax(0, parser.value(warmupOption).toInt());
+    const int jobs = parser.value(jobsOption).toInt();
+    const int threads = parser.value(threadsOption).toInt();
+    const QString workDir = parser.value(workOption);
+    const QString inputDir = QDir(workDir).filePath(QString("input"));
+    const bool verify = parser.isSet(verifyOption);
+
+    if (parser.isSet(caseOption)) {
+        Case item;
+        if (!Case::parse(parser.value(caseOption), &item)) {
+            err << QString("Unknown case: %1").arg(parser.value(caseOption)) << '\n';
+            return ExitUsage;
+        }
+        QJsonObject result = runCase(item, QDir(inputDir).filePath(item.inputName()), workDir, runs, warmup, jobs, threads, verify);
+        QTextStream(stdout) << QJsonDocument(result).toJson(QJsonDocument::Compact) << '\n';
+        return result.contains("error") ? ExitFailed : ExitSuccess;
+    }
+
+    QJsonObject thresholds;
+    if (parser.isSet(thresholdsOption)) {
+        QFile file(parser.value(thresholdsOption));
+        QJsonDocument document;
+        if (file.open(QIODevice::ReadOnly)) { document = QJsonDocument::fromJson(file.readAll()); }
+        if (!document.isObject()) {
+            err << QString("Unable to read thresholds: %1").arg(parser.value(thresholdsOption)) << '\n';
+            return ExitUsage;
+        }
+        thresholds = document.object();
+    }
+
+    // --verify runs a corpus of edge cases by default, small enough to
+    // run on every build, with the ImageMagick path as the reference
+    auto list = [&](const QCommandLineOption &option, const QString &corpus) {
+        const QString value = verify && !parser.isSet(option) ? corpus : parser.value(option);
+        return value.split(',', QString::SkipEmptyParts);
+    };
+    QList<Case> cases;
+    QStringList formats = list(formatsOption, QString("tif,jpg,sample"));
+    QStringList sizes = list(sizesOption, QString("512"));
+    QStringList depths = list(depthsOption, QString("8,16"));
+    QStringList colorspaces = list(colorspacesOption, QString("rgb,rgba,gray,graya,cmyk,cmyk+icc"));
+    QStringList targets = list(targetsOption, QString("cmyk,rgb,gray"));
+    QStringList modes = list(modesOption, QString("native,lut,stream"));
+    QStringList intents = list(intentsOption, QString("perceptual,relative"));
+    if (verify && !modes.contains(QString("magick"))) { modes.append(QString("magick")); }
+    if (formats.removeAll(QString("sample")) > 0) {
+        formats << QString("sample.jpg") << QString("sample.tif") << QString("sample.png");
+    }
+    for (int f = 0; f < formats.size(); ++f) {
+        for (int s = 0; s < sizes.size(); ++s) {
+            for (int d = 0; d < depths.size(); ++d) {
+                for (int c = 0; c < colorspaces.size(); ++c) {
+                    for (int t = 0; t < targets.size(); ++t) {
+                        for (int m = 0; m < modes.size(); ++m) {
+                            for (int i = 0; i < intents.size(); ++i) {
+                                Case item;
+                                item.format = formats.at(f);
+                                item.size = sizes.at(s).toInt();
+                                item.depth = depths.at(d).toInt();
+                                if ((item.format != QString("tif") && item.format != QString("jpg") && !item.isSample()) ||
+                                    item.size < 1 ||
+                                    (item.depth != 8 && item.depth != 16) ||
+                                    !parseSource(colorspaces.at(c), &item.cs, &item.alpha, &item.embedded) ||
+                                    !parseColorSpace(targets.at(t), &item.target) ||
+                                    !parseMode(modes.at(m), &item.mode, &item.lut) ||
+                                    !parseIntent(intents.at(i), &item.intent)) {
+                                    err << QString("Invalid benchmark options, see --help.") << '\n';
+                                    return ExitUsage;
+                                }
+                                // JPEG is 8-bit only, and the same fallback profile
+                                // on both sides is not a conversion
+                                if (item.format == QString("jpg") && (item.depth != 8 || item.alpha)) { continue; }
+                                if (item.cs == item.target) { continue; }
+
+                                // the samples are RGB and come in one size
+                                if (item.isSample()) {
+                                    if (s > 0 || d > 0 || item.cs != Converter::colorSpaceRGB || item.alpha || item.embedded) { continue; }
+                                    item.size = 0;
+                                    item.depth = 8;
+                                }
+                                cases.append(item);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    QJsonArray results;
+    int failed = 0;
+    for (int i = 0; i < cases.size(); ++i) {
+        const Case &item = cases.at(i);
+        const QString input = QDir(inputDir).filePath(item.inputName());
+        if (!generateImage(input, item)) {
+            err << QString("Unable to generate %1").arg(input) << '\n';
+            return ExitFailed;
+        }
+
+        QJsonObject result;
+        if (parser.isSet(inProcessOption)) {
+            result = runCase(item, input, workDir, runs, warmup, jobs, threads, verify);
+        } else {
+            QStringList args;
+            args << "--run-case" << item.id()
+                 << "--runs" << QString::number(runs)
+                 << "--warmup" << QString::number(warmup)
+                 << "--jobs" << QString::number(jobs)
+                 << "--threads" << QString::number(threads)
+                 << "--work" << workDir;
+            if (verify) { args << "--verify"; }
+            result = runIsolated(item, args);
+        }
+        if (result.contains("error")) {
+            failed++;
+            err << QString("%1\tfailed\t%2").arg(item.id()).arg(result.value("error").toString()) << '\n';
+        } else {
+            QJsonObject latency = result.value("latencyMs").toObject();
+            err << QString("%1\t%2 MPix/s\tp50 %3 ms\tp99 %4 ms\t%5 MiB")
+                   .arg(item.id())
+                   .arg(result.value("mpixPerSecond").toDouble(), 0, 'f', 1)
+                   .arg(latency.value("p50").toDouble(), 0, 'f', 1)
+                   .arg(latency.value("p99").toDouble(), 0, 'f', 1)
+                   .arg(result.value("peakMemory").toDouble() / 1048576.0, 0, 'f', 0) << '\n';
+        }
+        err.flush();
+        results.append(result);
+    }
+
+    int inaccurate = 0;
+    if (verify) { inaccurate = verifyCases(cases, results, workDir, thresholds, err); }
+
+    QJsonObject report;
+    report.insert("version", QCoreApplication::applicationVersion());
+    report.insert("date", QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+    report.insert("host", hostInfo());
+    report.insert("runs", runs);
+    report.insert("warmup", warmup);
+    report.insert("cases", results);
+    QByteArray json = QJsonDocument(report).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+            err << QString("Unable to write %1").arg(parser.value(outputOption)) << '\n';
+            return ExitFailed;
+        }
+    } else {
+        QTextStream(stdout) << json;
+    }
+
+    if (parser.isSet(baselineOption)) {
+        int regressions = compareBaseline(results, parser.value(baselineOption),
+                                          parser.value(toleranceOption).toDouble(), err);
+        if (regressions < 0) { return ExitUsage; }
+        if (regressions > 0) {
+            err << QString("%1 case(s) slower than the baseline").arg(regressions) << '\n';
+            return ExitRegression;
+        }
+    }
+    if (inaccurate > 0) {
+        err << QString("%1 case(s) past the --verify thresholds").arg(inaccurate) << '\n';
+        return ExitRegression;
+    }
+    return failed > 0 ? ExitFailed : ExitSuccess;
+}
@@ -0,0 +1,83 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <QQueue>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(int capacity)
+        : _capacity(qMax(1, capacity))
+        , _closed(false)
+    {
+    }
+
+    void push(const T &value)
+    {
+        QMutexLocker lock(&_mutex);
+        while (_queue.size() >= _capacity && !_closed) {
+            _notFull.wait(&_mutex);
+        }
+        _queue.enqueue(value);
+        _notEmpty.wakeOne();
+    }
+
+    bool pop(T *value)
+    {
+        QMutexLocker lock(&_mutex);
+        while (_queue.isEmpty() && !_closed) {
+            _notEmpty.wait(&_mutex);
+        }
+        if (_queue.isEmpty()) { return false; }
+        *value = _queue.dequeue();
+        _notFull.wakeOne();
+        return true;
+    }
+
+    void close()
+    {
+        QMutexLocker lock(&_mutex);
+        _closed = true;
+        _notEmpty.wakeAll();
+        _notFull.wakeAll();
+    }
+
+    int size()
+    {
+        QMutexLocker lock(&_mutex);
+        return _queue.size();
+    }
+
+private:
+    QMutex _mutex;
+    QWaitCondition _notEmpty;
+    QWaitCondition _notFull;
+    QQueue<T> _queue;
+    int _capacity;
+    bool _closed;
+};
+
+#endif // BOUNDEDQUEUE_H
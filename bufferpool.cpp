@@ -0,0 +1,159 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#include "bufferpool.h"
+
+#include <QMutexLocker>
+#include <QGlobalStatic>
+
+#include <algorithm>
+
+#include "memorybudget.h"
+
+Q_GLOBAL_STATIC(BufferPool, bufferPool)
+
+static bool smaller(const BufferPool::Buffer &a, const BufferPool::Buffer &b)
+{
+    return a.capacity() < b.capacity();
+}
+
+// until a batch sets it from its memory budget the limit is an eighth
+// of the default budget
+BufferPool::BufferPool()
+    : _resident(0)
+    , _peak(0)
+    , _limit(MemoryBudget::physicalMemory() / 16)
+    , _batches(0)
+{
+}
+
+BufferPool *BufferPool::instance()
+{
+    return bufferPool();
+}
+
+void BufferPool::take(Buffer &buffer,
+                      size_t size)
+{
+    give(buffer);
+    {
+        // the buffers are kept by size, the smallest one that holds the
+        // image is taken, or else the largest, which then grows to the
+        // largest image seen so far
+        QMutexLocker lock(&_mutex);
+        if (!_buffers.empty()) {
+            std::vector<Buffer>::iterator it = std::lower_bound(_buffers.begin(), _buffers.end(), size,
+                                                                [](const Buffer &held, size_t bytes) {
+                return held.capacity() < bytes;
+            });
+            if (it == _buffers.end()) { --it; }
+            buffer.swap(*it);
+            _buffers.erase(it);
+            _resident -= static_cast<qint64>(buffer.capacity());
+        }
+    }
+    if (buffer.capacity() >= size) {
+        _hits.ref();
+    } else {
+        _misses.ref();
+        // the old content is not worth copying when the buffer grows
+        buffer.clear();
+    }
+    buffer.resize(size);
+}
+
+void BufferPool::give(Buffer &buffer)
+{
+    if (buffer.capacity() == 0) { return; }
+    QMutexLocker lock(&_mutex);
+    _resident += static_cast<qint64>(buffer.capacity());
+    std::vector<Buffer>::iterator it = std::upper_bound(_buffers.begin(), _buffers.end(), buffer, smaller);
+    it = _buffers.insert(it, Buffer());
+    it->swap(buffer);
+    _peak = qMax(_peak, _resident);
+    trim(_limit);
+}
+
+void BufferPool::open()
+{
+    QMutexLocker lock(&_mutex);
+    _batches++;
+}
+
+void BufferPool::close()
+{
+    // the buffers only outlive a batch while another one is running
+    QMutexLocker lock(&_mutex);
+    if (--_batches <= 0) {
+        _batches = 0;
+        trim(0);
+    }
+}
+
+int BufferPool::hits() const
+{
+    return _hits.load();
+}
+
+int BufferPool::misses() const
+{
+    return _misses.load();
+}
+
+qint64 BufferPool::resident() const
+{
+    QMutexLocker lock(&_mutex);
+    return _resident;
+}
+
+qint64 BufferPool::peak() const
+{
+    QMutexLocker lock(&_mutex);
+    return _peak;
+}
+
+qint64 BufferPool::limit() const
+{
+    QMutexLocker lock(&_mutex);
+    return _limit;
+}
+
+void BufferPool::setLimit(qint64 bytes)
+{
+    QMutexLocker lock(&_mutex);
+    _limit = qMax(Q_INT64_C(0), bytes);
+    trim(_limit);
+}
+
+void BufferPool::clear()
+{
+    QMutexLocker lock(&_mutex);
+    trim(0);
+}
+
+void BufferPool::trim(qint64 bytes)
+{
+    // the smallest buffers go first, the large ones are the expensive
+    // ones to fault in again
+    while (_resident > bytes && !_buffers.empty()) {
+        _resident -= static_cast<qint64>(_buffers.front().capacity());
+        _buffers.erase(_buffers.begin());
+    }
+}
@@ -0,0 +1,68 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QMutex>
+#include <QAtomicInt>
+
+#include <vector>
+
+// pixel buffers handed back after an image are kept for the next one,
+// so a batch allocates about as many buffers as it has images in flight
+class BufferPool
+{
+public:
+    typedef std::vector<unsigned char> Buffer;
+
+    BufferPool();
+
+    static BufferPool *instance();
+
+    void take(Buffer &buffer,
+              size_t size);
+    void give(Buffer &buffer);
+
+    void open();
+    void close();
+
+    int hits() const;
+    int misses() const;
+    qint64 resident() const;
+    qint64 peak() const;
+    qint64 limit() const;
+    void setLimit(qint64 bytes);
+    void clear();
+
+private:
+    void trim(qint64 bytes);
+
+    mutable QMutex _mutex;
+    std::vector<Buffer> _buffers;
+    QAtomicInt _hits;
+    QAtomicInt _misses;
+    qint64 _resident;
+    qint64 _peak;
+    qint64 _limit;
+    int _batches;
+};
+
+#endif // BUFFERPOOL_H
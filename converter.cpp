@@ -0,0 +1,1450 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include "converter.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QStandardPaths>
+#include <QFuture>
+#include <QMutexLocker>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QThread>
+#include <QAtomicInt>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <QRunnable>
+#include <QWaitCondition>
+
+#include <Magick++.h>
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstring>
+#include <functional>
+
+#include "transformcache.h"
+#include "bandprocessor.h"
+#include "boundedqueue.h"
+#include "streamconverter.h"
+#include "filescanner.h"
+#include "jobreport.h"
+#include "lutkernel.h"
+#include "inkcoverage.h"
+#include "manifest.h"
+#include "profileregistry.h"
+#include "bufferpool.h"
+
+#define GAMUT_STEP 4
+
+// the buffer pool may keep this part of the memory budget on top of it
+#define POOL_SHARE 8
+
+static bool imageHasAlpha(const Magick::Image &image)
+{
+#if MagickLibVersion >= 0x700
+    return image.alpha();
+#else
+    return image.matte();
+#endif
+}
+
+static Converter::colorSpace imageColorspace(const Magick::Image &image)
+{
+    switch(image.colorSpace()) {
+    case Magick::CMYKColorspace:
+        return Converter::colorSpaceCMYK;
+    case Magick::GRAYColorspace:
+        return Converter::colorSpaceGRAY;
+    default:;
+    }
+    return Converter::colorSpaceRGB;
+}
+
+static std::string pixelMap(Converter::colorSpace cs, bool alpha)
+{
+    std::string map;
+    switch (cs) {
+    case Converter::colorSpaceCMYK:
+        map = "CMYK";
+        break;
+    case Converter::colorSpaceGRAY:
+        map = "I";
+        break;
+    default:
+        map = "RGB";
+    }
+    if (alpha) { map.append("A"); }
+    return map;
+}
+
+static qint64 pixelCacheSize(Converter::colorSpace cs, bool alpha, qint64 pixels)
+{
+#if MagickLibVersion >= 0x700
+    qint64 channels = static_cast<qint64>(Converter::pixelChannels(cs, alpha));
+#else
+    // IM6 always keeps RGBA packets, plus an index channel for CMYK
+    qint64 channels = cs == Converter::colorSpaceCMYK ? 5 : 4;
+#endif
+    return pixels * channels * static_cast<qint64>(sizeof(Magick::Quantum));
+}
+
+struct ImageAttributes
+{
+    size_t depth;
+    Magick::Point density;
+    Magick::ResolutionType units;
+    size_t quality;
+    Magick::CompressionType compress;
+    Magick::InterlaceType interlace;
+    Magick::OrientationType orientation;
+    Magick::RenderingIntent intent;
+    std::vector<std::pair<std::string, Magick::Blob> > profiles;
+};
+
+static ImageAttributes imageAttributes(const Magick::Image &image)
+{
+    ImageAttributes attributes;
+    attributes.depth = image.depth();
+    attributes.density = image.density();
+    attributes.units = image.resolutionUnits();
+    attributes.quality = image.quality();
+    attributes.compress = image.compressType();
+    attributes.interlace = image.interlaceType();
+    attributes.orientation = image.orientation();
+    attributes.intent = image.renderingIntent();
+    const char *profiles[] = { "exif", "xmp", "iptc", "8bim" };
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); ++i) {
+        Magick::Blob blob = image.profile(profiles[i]);
+        if (blob.length() > 0) {
+            attributes.profiles.push_back(std::make_pair(std::string(profiles[i]), blob));
+        }
+    }
+    return attributes;
+}
+
+static void applyAttributes(const ImageAttributes &attributes, Magick::Image &image)
+{
+    image.depth(attributes.depth);
+    image.density(attributes.density);
+    image.resolutionUnits(attributes.units);
+    image.quality(attributes.quality);
+    image.compressType(attributes.compress);
+    image.interlaceType(attributes.interlace);
+    image.orientation(attributes.orientation);
+    image.renderingIntent(attributes.intent);
+    for (size_t i = 0; i < attributes.profiles.size(); ++i) {
+        image.profile(attributes.profiles.at(i).first, attributes.profiles.at(i).second);
+    }
+}
+
+static bool isCancelled(const Converter::Options &options)
+{
+    return options.cancel && options.cancel->loadAcquire();
+}
+
+static Converter::Result skippedResult(const QString &filename,
+                                       const QString &output,
+                                       int target)
+{
+    Converter::Result result;
+    result.filename = filename;
+    result.output = output;
+    result.target = target;
+    result.success = true;
+    result.skipped = true;
+    return result;
+}
+
+static void cancelResult(Converter::Result &result)
+{
+    result.cancelled = true;
+    result.error = QString("Cancelled");
+}
+
+// converts the rows of one band, with the LUT when there is one
+static void transformRows(cmsHTRANSFORM handle,
+                          const LutKernel *lut,
+                          const unsigned char *input,
+                          unsigned char *output,
+                          size_t width,
+                          size_t first,
+                          size_t count,
+                          size_t inputPixel,
+                          size_t outputPixel,
+                          int alphaBytes)
+{
+    if (lut) {
+        lut->apply(input + first * width * inputPixel,
+                   output + first * width * outputPixel,
+                   count * width);
+        return;
+    }
+    for (size_t y = first; y < first + count; ++y) {
+        cmsDoTransform(handle,
+                       input + y * width * inputPixel,
+                       output + y * width * outputPixel,
+                       static_cast<cmsUInt32Number>(width));
+    }
+#ifndef cmsFLAGS_COPY_ALPHA
+    if (alphaBytes > 0) {
+        for (size_t i = first * width; i < (first + count) * width; ++i) {
+            std::memcpy(output + (i + 1) * outputPixel - alphaBytes,
+                        input + (i + 1) * inputPixel - alphaBytes,
+                        static_cast<size_t>(alphaBytes));
+        }
+    }
+#endif
+    Q_UNUSED(alphaBytes)
+}
+
+// what one band worker measured for one target, added up once the image
+// is done
+struct BandAnalysis
+{
+    InkCoverage ink;
+    qint64 checked = 0;
+    qint64 outside = 0;
+};
+
+// ink coverage of a converted band, and a gamut check of its source on a
+// grid of every GAMUT_STEP-th pixel, which keeps the extra lcms work to a
+// small part of the transform
+static void analyzeRows(cmsHTRANSFORM gamut,
+                        const unsigned char *input,
+                        const unsigned char *output,
+                        size_t width,
+                        size_t first,
+                        size_t count,
+                        size_t inputPixel,
+                        int outputChannels,
+                        int bytes,
+                        bool ink,
+                        BandAnalysis *analysis)
+{
+    if (ink) {
+        analysis->ink.add(output + first * width * static_cast<size_t>(outputChannels * bytes),
+                 count * width,
+                 outputChannels,
+                 bytes);
+    }
+    if (gamut) {
+        std::vector<unsigned char> samples;
+        std::vector<unsigned char> lab;
+        for (size_t y = first; y < first + count; ++y) {
+            if (y % GAMUT_STEP != 0) { continue; }
+            samples.clear();
+            for (size_t x = 0; x < width; x += GAMUT_STEP) {
+                const unsigned char *pixel = input + (y * width + x) * inputPixel;
+                samples.insert(samples.end(), pixel, pixel + inputPixel);
+            }
+            const size_t pixels = samples.size() / inputPixel;
+            lab.resize(pixels * 3);
+            cmsDoTransform(gamut, samples.data(), lab.data(), static_cast<cmsUInt32Number>(pixels));
+            for (size_t i = 0; i < pixels; ++i) {
+                if (lab[i * 3] == 0 && lab[i * 3 + 1] == 0 && lab[i * 3 + 2] == 0) { analysis->outside++; }
+            }
+            analysis->checked += static_cast<qint64>(pixels);
+        }
+    }
+}
+
+// runs one file of a batch on the converter pool, where it is queued by
+// the batch priority
+class FileTask : public QRunnable
+{
+public:
+    explicit FileTask(const std::function<void()> &function)
+        : _function(function)
+    {
+    }
+    void run() override
+    {
+        _function();
+    }
+
+private:
+    std::function<void()> _function;
+};
+
+// one target of a frame, with its own transform, pixels and encoder
+struct Converter::Rendition
+{
+    int target = 0;
+    bool ok = true;
+    Result result;
+    bool native = false;
+    bool streamed = false;
+    TransformCache::Transform transform;
+    LutKernel::Lut lut;
+    Magick::Image image;
+    std::vector<unsigned char> pixels;
+    TransformCache::Transform gamut;
+    std::shared_ptr<InkCoverage> ink;
+    qint64 gamutChecked = 0;
+    qint64 gamutOut = 0;
+};
+
+// the decoded source is shared by the renditions of every target
+struct Converter::Frame
+{
+    int index = 0;
+    qint64 footprint = 0;
+    qint64 reserved = 0;
+    int threads = 1;
+    bool streamed = false;
+    QElapsedTimer timer;
+    bool ok = true;
+    Result result;
+    Magick::Blob source;
+    const Pixels *raw = nullptr;
+    std::string format;
+    Magick::Image image;
+    Profile input;
+    bool embedded = false;
+    ImageAttributes attributes;
+    colorSpace cs = colorSpaceUnknown;
+    bool alpha = false;
+    int bytes = 1;
+    size_t width = 0;
+    size_t height = 0;
+    std::vector<unsigned char> pixels;
+    std::vector<Rendition> renditions;
+    std::vector<Rendition> finished;
+};
+
+Converter::Converter(QObject *parent)
+    : QObject(parent)
+{
+    _pool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+int Converter::maxJobs() const
+{
+    return _pool.maxThreadCount();
+}
+
+void Converter::setMaxJobs(int jobs)
+{
+    if (jobs < 1) { jobs = QThread::idealThreadCount(); }
+    _pool.setMaxThreadCount(jobs);
+    _execution.setWorkers(jobs);
+}
+
+QList<Converter::Result> Converter::convertUrls(const QList<QUrl> &urls,
+                                                const Options &options)
+{
+    qDebug() << "convertUrls" << urls << maxJobs();
+    _budget.setLimit(options.memoryLimit);
+    BufferPool::instance()->setLimit(_budget.limit() / POOL_SHARE);
+
+    Batch batch;
+    QList<Result> results;
+    if (!prepareBatch(options, batch)) {
+        for (int i = 0; i < urls.size(); ++i) {
+            for (int j = 0; j < batch.targets.size(); ++j) {
+                Result result;
+                result.filename = urls.at(i).toLocalFile();
+                result.target = j;
+                result.error = tr("Invalid output profile");
+                if (options.progress) { options.progress(result); }
+                results.append(result);
+            }
+        }
+        return results;
+    }
+    if (!batch.options.outputDirectory.isEmpty()) {
+        QDir().mkpath(batch.options.outputDirectory);
+    }
+
+    // files whose content and settings match an earlier conversion that
+    // still has its output are not converted again, the checks run in
+    // parallel since changed files are hashed, every target is checked
+    // on its own
+    QStringList filenames;
+    for (int i = 0; i < urls.size(); ++i) {
+        filenames.append(urls.at(i).toLocalFile());
+    }
+    const int targets = batch.targets.size();
+    const size_t count = static_cast<size_t>(filenames.size()) * static_cast<size_t>(targets);
+    Manifest manifest(batch.options.manifest);
+    std::vector<Manifest::Lookup> lookups(count);
+    std::vector<char> skipped(count, 0);
+    std::vector<Manifest::Settings> settings(static_cast<size_t>(targets));
+    for (int j = 0; j < targets; ++j) {
+        Manifest::Settings &target = settings[static_cast<size_t>(j)];
+        target.profile = batch.outputs.at(j).digest;
+        target.intent = static_cast<quint32>(batch.targets.at(j).intent);
+        target.blackPoint = batch.targets.at(j).blackPoint;
+        target.suffix = batch.targets.at(j).suffix;
+        target.mode = static_cast<quint32>(batch.options.mode);
+        target.lut = batch.options.lut;
+    }
+    if (batch.options.incremental) {
+        manifest.load();
+        QList<QFuture<void> > checks;
+        for (size_t i = 0; i < count; ++i) {
+            checks.append(QtConcurrent::run(&_pool, [&, i]() {
+                const QString &filename = filenames.at(static_cast<int>(i) / targets);
+                const int target = static_cast<int>(i) % targets;
+                skipped[i] = manifest.lookup(filename,
+                                             settings.at(target),
+                                             outputDirectory(filename, batch.options.outputDirectory),
+                                             &lookups[i]);
+            }));
+        }
+        for (int i = 0; i < checks.size(); ++i) {
+            checks[i].waitForFinished();
+        }
+    }
+
+    // output names are reserved here, in queue order, so the result
+    // does not depend on which worker finishes first
+    QList<Job> jobs;
+    for (int i = 0; i < filenames.size(); ++i) {
+        Job job;
+        job.filename = filenames.at(i);
+        for (int j = 0; j < targets; ++j) {
+            const size_t index = static_cast<size_t>(i * targets + j);
+            if (skipped.at(index)) {
+                if (batch.options.progress) { batch.options.progress(skippedResult(job.filename, lookups.at(index).output, j)); }
+                continue;
+            }
+            job.targets.append(j);
+            job.outputs.append(reserveFilename(job.filename,
+                                               batch.targets.at(j).suffix,
+                                               batch.options.outputDirectory));
+        }
+        if (!job.targets.isEmpty()) { jobs.append(job); }
+    }
+
+    _execution.schedule(jobs.size(), _budget.limit());
+    BufferPool::instance()->open();
+    QList<Result> converted;
+    if (batch.options.pipeline) {
+        converted = convertPipeline(jobs, batch);
+    } else {
+        converted = convertJobs(jobs, batch);
+    }
+    BufferPool::instance()->close();
+
+    int next = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const Manifest::Lookup &lookup = lookups.at(i);
+        const int target = static_cast<int>(i) % targets;
+        if (skipped.at(i)) {
+            results.append(skippedResult(filenames.at(static_cast<int>(i) / targets), lookup.output, target));
+            continue;
+        }
+        Result result = converted.at(next++);
+        if (batch.options.incremental && result.success && !lookup.hash.isEmpty()) {
+            manifest.insert(result.filename,
+                            settings.at(target),
+                            lookup,
+                            result.output);
+        }
+        results.append(result);
+    }
+    if (batch.options.incremental && !manifest.save()) {
+        qWarning() << "unable to save manifest" << manifest.filename();
+    }
+    return results;
+}
+
+QList<Converter::Result> Converter::convertData(const QByteArray &data,
+                                                const Options &options)
+{
+    Job job;
+    job.data = data;
+    return convertBuffer(job, options);
+}
+
+QList<Converter::Result> Converter::convertPixels(const Pixels &pixels,
+                                                  const Options &options)
+{
+    Job job;
+    job.pixels = &pixels;
+    return convertBuffer(job, options);
+}
+
+bool Converter::prepareBatch(const Options &options,
+                             Batch &batch)
+{
+    batch.options = options;
+    batch.targets = outputTargets(options);
+    batch.budget = &_budget;
+
+    bool valid = true;
+    for (int i = 0; i < batch.targets.size(); ++i) {
+        Profile output = loadProfile(batch.targets.at(i).outputProfile);
+        if (output.cs == colorSpaceUnknown) { valid = false; }
+        if (batch.targets.at(i).suffix.isEmpty()) {
+            batch.targets[i].suffix = colorSpaceSuffix(output.cs);
+        }
+        batch.outputs.append(output);
+    }
+    return valid;
+}
+
+QList<Converter::Result> Converter::convertBuffer(Job &job,
+                                                  const Options &options)
+{
+    // in memory conversions run on the calling thread and only share the
+    // memory budget and the caches, so any number of them can run at once
+    if (options.memoryLimit > 0) {
+        _budget.setLimit(options.memoryLimit);
+        BufferPool::instance()->setLimit(_budget.limit() / POOL_SHARE);
+    }
+
+    Batch batch;
+    QList<Result> results;
+    if (!prepareBatch(options, batch)) {
+        for (int i = 0; i < batch.targets.size(); ++i) {
+            Result result;
+            result.target = i;
+            result.error = tr("Invalid output profile");
+            if (options.progress) { options.progress(result); }
+            results.append(result);
+        }
+        return results;
+    }
+    for (int i = 0; i < batch.targets.size(); ++i) {
+        job.targets.append(i);
+        job.outputs.append(QString());
+    }
+    _execution.schedule(1, _budget.limit());
+    results = convertFile(job, batch);
+    for (int i = 0; i < results.size(); ++i) {
+        if (options.progress) { options.progress(results.at(i)); }
+    }
+    return results;
+}
+
+QList<Converter::Result> Converter::convertJobs(const QList<Job> &jobs,
+                                                const Batch &batch)
+{
+    std::vector<QList<Result> > results(static_cast<size_t>(jobs.size()));
+    QMutex mutex;
+    QWaitCondition done;
+    int remaining = jobs.size();
+    for (int i = 0; i < jobs.size(); ++i) {
+        _pool.start(new FileTask([&, i]() {
+            QList<Result> converted = convertFile(jobs.at(i), batch);
+            for (int j = 0; j < converted.size(); ++j) {
+                releaseFilename(converted.at(j).output);
+                if (batch.options.progress) { batch.options.progress(converted.at(j)); }
+            }
+            QMutexLocker lock(&mutex);
+            results[static_cast<size_t>(i)] = converted;
+            if (--remaining == 0) { done.wakeAll(); }
+        }), batch.options.priority);
+    }
+
+    QMutexLocker lock(&mutex);
+    while (remaining > 0) { done.wait(&mutex); }
+    QList<Result> output;
+    for (size_t i = 0; i < results.size(); ++i) {
+        output.append(results.at(i));
+    }
+    return output;
+}
+
+QList<Converter::Result> Converter::convertPipeline(const QList<Job> &jobs,
+                                                    const Batch &batch)
+{
+    const Options &options = batch.options;
+    int decodeJobs = options.decodeJobs > 0 ? options.decodeJobs : qMax(1, maxJobs() / 4);
+    int encodeJobs = options.encodeJobs > 0 ? options.encodeJobs : qMax(1, maxJobs() / 4);
+    int transformJobs = options.transformJobs > 0 ? options.transformJobs : qMax(1, maxJobs() - decodeJobs - encodeJobs);
+    qDebug() << "convertPipeline" << decodeJobs << transformJobs << encodeJobs << options.queueDepth;
+
+    // at most one frame per stage thread plus the queued ones are alive
+    // at any time, however long the batch is
+    BoundedQueue<Frame*> decoded(options.queueDepth);
+    BoundedQueue<Frame*> transformed(options.queueDepth);
+    QAtomicInt next(0);
+    QAtomicInt decoders(decodeJobs);
+    QAtomicInt transformers(transformJobs);
+    std::vector<QList<Result> > results(static_cast<size_t>(jobs.size()));
+    auto report = [&](int index, const QList<Result> &finished) {
+        for (int i = 0; i < finished.size(); ++i) {
+            releaseFilename(finished.at(i).output);
+            if (options.progress) { options.progress(finished.at(i)); }
+        }
+        results[static_cast<size_t>(index)] = finished;
+    };
+
+    // the decoders run on the converter pool one frame at a time, in
+    // between the pool hands its threads to the waiting task with the
+    // highest priority, so a more urgent batch gets its frames in first
+    QMutex mutex;
+    QWaitCondition done;
+    std::function<void()> decode;
+    decode = [&]() {
+        int index = next.fetchAndAddRelaxed(1);
+        if (index >= jobs.size()) {
+            QMutexLocker lock(&mutex);
+            if (!decoders.deref()) {
+                decoded.close();
+                done.wakeAll();
+            }
+            return;
+        }
+        Frame *frame = new Frame;
+        frame->index = index;
+        startFrame(*frame, jobs.at(index));
+        if (isCancelled(options)) {
+            frame->ok = false;
+            cancelResult(frame->result);
+            report(index, finishFrame(*frame, batch));
+            delete frame;
+            _execution.cancel();
+        } else {
+            admitFrame(*frame, batch);
+            frame->ok = decodeFrame(*frame, batch);
+            decoded.push(frame);
+        }
+        _pool.start(new FileTask(decode), options.priority);
+    };
+    for (int i = 0; i < decodeJobs; ++i) {
+        _pool.start(new FileTask(decode), options.priority);
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(transformJobs + encodeJobs);
+    QList<QFuture<void> > stages;
+    for (int i = 0; i < transformJobs; ++i) {
+        stages.append(QtConcurrent::run(&pool, [&]() {
+            Frame *frame = nullptr;
+            while (decoded.pop(&frame)) {
+                if (frame->ok) { frame->ok = transformFrame(*frame, batch); }
+                transformed.push(frame);
+            }
+            if (!transformers.deref()) { transformed.close(); }
+        }));
+    }
+    for (int i = 0; i < encodeJobs; ++i) {
+        stages.append(QtConcurrent::run(&pool, [&]() {
+            Frame *frame = nullptr;
+            while (transformed.pop(&frame)) {
+                if (frame->ok) { encodeFrame(*frame, batch); }
+                report(frame->index, finishFrame(*frame, batch));
+                qint64 reserved = frame->reserved;
+                delete frame;
+                _budget.release(reserved);
+                _execution.release();
+            }
+        }));
+    }
+    for (int i = 0; i < stages.size(); ++i) {
+        stages[i].waitForFinished();
+    }
+    {
+        QMutexLocker lock(&mutex);
+        while (decoders.loadAcquire() > 0) { done.wait(&mutex); }
+    }
+
+    QList<Result> output;
+    for (size_t i = 0; i < results.size(); ++i) {
+        output.append(results.at(i));
+    }
+    return output;
+}
+
+QString Converter::outputDirectory(const QString &filename,
+                                   const QString &directory)
+{
+    QFileInfo fileInfo(filename);
+    if (!directory.isEmpty()) { return QDir(directory).absolutePath(); }
+    if (fileInfo.isWritable()) { return fileInfo.absolutePath(); }
+    QString filePath = QStandardPaths::writableLocation(QStandardPaths::DesktopLocation);
+    if (filePath.isEmpty()) {
+        filePath = QDir::homePath();
+    }
+    return filePath;
+}
+
+QString Converter::reserveFilename(const QString &filename,
+                                   const QString &suffix,
+                                   const QString &directory)
+{
+    QFileInfo fileInfo(filename);
+    QString ext = fileInfo.suffix().toLower();
+    QString filePath = outputDirectory(filename, directory);
+
+    QMutexLocker lock(&_reservedMutex);
+    int counter = 1;
+    QString oFilename = QString("%4/%1_%2.%3").arg(fileInfo.baseName()).arg(suffix).arg(ext).arg(filePath);
+    while (QFile::exists(oFilename) || _reserved.contains(oFilename)) {
+        oFilename = QString("%5/%1_%2_copy%4.%3").arg(fileInfo.baseName()).arg(suffix).arg(ext).arg(counter).arg(filePath);
+        counter++;
+    }
+    _reserved.insert(oFilename);
+    return oFilename;
+}
+
+QList<Converter::Target> Converter::outputTargets(const Options &options)
+{
+    if (!options.targets.isEmpty()) { return options.targets; }
+    Target target;
+    target.outputProfile = options.outputProfile;
+    target.intent = options.intent;
+    target.blackPoint = options.blackPoint;
+    target.suffix = options.suffix;
+    return QList<Target>() << target;
+}
+
+Converter::colorSpace Converter::profileColorspace(const QByteArray &profile)
+{
+    // data colour space signature in the ICC header
+    if (profile.size() < 128) { return colorSpaceUnknown; }
+    QByteArray signature = profile.mid(16, 4);
+    if (signature == "RGB ") {
+        return colorSpaceRGB;
+    } else if (signature == "CMYK") {
+        return colorSpaceCMYK;
+    } else if (signature == "GRAY") {
+        return colorSpaceGRAY;
+    }
+    return colorSpaceUnknown;
+}
+
+QString Converter::colorSpaceSuffix(colorSpace cs)
+{
+    switch (cs) {
+    case colorSpaceCMYK:
+        return QString("CMYK");
+    case colorSpaceGRAY:
+        return QString("GRAY");
+    default:;
+    }
+    return QString("RGB");
+}
+
+QByteArray Converter::fileToByteArray(const QString &filename)
+{
+    if (QFile::exists(filename)) {
+        QFile file(filename);
+        if (file.open(QIODevice::ReadOnly)) {
+            QByteArray profile =  file.readAll();
+            file.close();
+            if (profile.size() > 0) {
+                return profile;
+            }
+        }
+    }
+    return QByteArray();
+}
+
+bool Converter::isValidImage(const QString &filename)
+{
+    return FileScanner::sniff(filename) != FileScanner::UnknownFormat;
+}
+
+Converter::Profile Converter::loadProfile(const QByteArray &data)
+{
+    return ProfileRegistry::instance()->profile(data);
+}
+
+size_t Converter::pixelChannels(colorSpace cs, bool alpha)
+{
+    size_t channels = 3;
+    switch (cs) {
+    case colorSpaceCMYK:
+        channels = 4;
+        break;
+    case colorSpaceGRAY:
+        channels = 1;
+        break;
+    default:;
+    }
+    return alpha ? channels + 1 : channels;
+}
+
+quint32 Converter::pixelFormat(colorSpace cs, bool alpha, int bytes)
+{
+    cmsUInt32Number type = PT_RGB;
+    cmsUInt32Number channels = 3;
+    switch (cs) {
+    case colorSpaceCMYK:
+        type = PT_CMYK;
+        channels = 4;
+        break;
+    case colorSpaceGRAY:
+        type = PT_GRAY;
+        channels = 1;
+        break;
+    default:;
+    }
+    return COLORSPACE_SH(type) | CHANNELS_SH(channels) | EXTRA_SH(alpha ? 1 : 0) | BYTES_SH(bytes);
+}
+
+quint32 Converter::lcmsIntent(RenderingIntent intent)
+{
+    switch (intent) {
+    case SaturationRenderingIntent:
+        return INTENT_SATURATION;
+    case AbsoluteRenderingIntent:
+        return INTENT_ABSOLUTE_COLORIMETRIC;
+    case RelativeRenderingIntent:
+        return INTENT_RELATIVE_COLORIMETRIC;
+    default:;
+    }
+    return INTENT_PERCEPTUAL;
+}
+
+void Converter::transformPixels(const std::shared_ptr<void> &transform,
+                                const unsigned char *input,
+                                unsigned char *output,
+                                size_t width,
+                                size_t rows,
+                                size_t inputPixel,
+                                size_t outputPixel,
+                                int alphaBytes,
+                                int threads,
+                                const LutKernel *lut,
+                                const QAtomicInt *cancel)
+{
+    cmsHTRANSFORM handle = transform.get();
+    BandProcessor::run(rows, BandProcessor::bandRows(width), threads,
+                       [=](size_t first, size_t count) {
+        transformRows(handle, lut, input, output, width, first, count,
+                      inputPixel, outputPixel, alphaBytes);
+    }, cancel);
+}
+
+void Converter::releaseFilename(const QString &filename)
+{
+    QMutexLocker lock(&_reservedMutex);
+    _reserved.remove(filename);
+}
+
+void Converter::admitFrame(Frame &frame,
+                           const Batch &batch)
+{
+    if (batch.options.stats) { frame.timer.start(); }
+    JobReport::Timer timer(batch.options.stats, &frame.result.stats.stages[AdmitStage]);
+    frame.footprint = estimateFootprint(frame, batch, &frame.result.stats.pixels);
+
+    // the threads of one image follow its size, with every target counted,
+    // and the files in flight
+    const qint64 work = frame.result.stats.pixels * static_cast<qint64>(frame.renditions.size());
+    frame.threads = _execution.admit(work, batch.options.threads);
+    frame.result.stats.workers = _execution.workers();
+    frame.result.stats.threads = frame.threads;
+    frame.result.stats.magickThreads = _execution.magickThreads();
+
+    // images that would not fit in the budget at once are streamed band
+    // by band instead, which only needs a few rows in memory
+    const ConversionMode mode = batch.options.mode;
+    const bool memory = frame.raw || frame.source.length() > 0;
+    if (!memory &&
+        StreamConverter::isSupported(frame.result.filename) &&
+        (mode == StreamConversionMode ||
+         (mode == NativeConversionMode && frame.footprint > _budget.limit()))) {
+        frame.streamed = true;
+        frame.result.stats.streamed = true;
+        return;
+    }
+
+    // workers wait here while the images in flight would not fit,
+    // so a batch of huge files runs with fewer of them at a time
+    frame.reserved = _budget.acquire(frame.footprint);
+}
+
+qint64 Converter::estimateFootprint(const Frame &frame,
+                                    const Batch &batch,
+                                    qint64 *pixelCount)
+{
+    qint64 pixels = 0;
+    colorSpace cs = colorSpaceUnknown;
+    bool alpha = false;
+    qint64 bytes = 1;
+    if (frame.raw) {
+        pixels = static_cast<qint64>(frame.raw->width) * static_cast<qint64>(frame.raw->height);
+        cs = frame.raw->cs;
+        alpha = frame.raw->alpha;
+        bytes = frame.raw->bytes;
+    } else {
+        // only the header is read, errors are left for the decoder to report
+        Magick::Image image;
+        try {
+            image.quiet(true);
+            if (frame.source.length() > 0) {
+                image.ping(frame.source);
+            } else {
+                image.ping(frame.result.filename.toStdString());
+            }
+        }
+        catch(Magick::Error &) { return 0; }
+        catch(Magick::Warning &warn ) { qWarning() << warn.what(); }
+
+        pixels = static_cast<qint64>(image.columns()) * static_cast<qint64>(image.rows());
+        cs = imageColorspace(image);
+        alpha = imageHasAlpha(image);
+        bytes = image.depth() > 8 ? 2 : 1;
+    }
+    if (pixelCount) { *pixelCount = pixels; }
+    const qint64 inputCache = pixelCacheSize(cs, alpha, pixels);
+    const qint64 inputBuffer = pixels * static_cast<qint64>(pixelChannels(cs, alpha)) * bytes;
+
+    // every target holds its own output at the same time
+    qint64 outputCache = 0;
+    qint64 outputBuffer = 0;
+    for (int i = 0; i < batch.outputs.size(); ++i) {
+        outputCache += pixelCacheSize(batch.outputs.at(i).cs, alpha, pixels);
+        outputBuffer += pixels * static_cast<qint64>(pixelChannels(batch.outputs.at(i).cs, alpha)) * bytes;
+    }
+    if (batch.options.mode == MagickConversionMode) {
+        return inputCache + outputCache;
+    }
+
+    // decoded image and export buffer, then the input and the output
+    // buffers, then the output buffers and the images constituted from them
+    return qMax(inputCache + inputBuffer,
+                qMax(inputBuffer + outputBuffer, outputBuffer + outputCache));
+}
+
+
+QList<Converter::Result> Converter::convertFile(const Job &job,
+                                                const Batch &batch)
+{
+    Frame frame;
+    startFrame(frame, job);
+    if (isCancelled(batch.options)) {
+        frame.ok = false;
+        cancelResult(frame.result);
+        _execution.cancel();
+        return finishFrame(frame, batch);
+    }
+    admitFrame(frame, batch);
+    frame.ok = decodeFrame(frame, batch) && transformFrame(frame, batch);
+    if (frame.ok) { encodeFrame(frame, batch); }
+    QList<Result> results = finishFrame(frame, batch);
+    _budget.release(frame.reserved);
+    _execution.release();
+    return results;
+}
+
+void Converter::startFrame(Frame &frame,
+                           const Job &job)
+{
+    frame.result.filename = job.filename;
+    if (!job.data.isEmpty()) { frame.source = Magick::Blob(job.data.constData(), static_cast<size_t>(job.data.size())); }
+    frame.raw = job.pixels;
+    frame.renditions.resize(static_cast<size_t>(job.targets.size()));
+    for (int i = 0; i < job.targets.size(); ++i) {
+        Rendition &rendition = frame.renditions[static_cast<size_t>(i)];
+        rendition.target = job.targets.at(i);
+        rendition.result.filename = job.filename;
+        rendition.result.output = job.outputs.at(i);
+        rendition.result.target = job.targets.at(i);
+    }
+}
+
+bool Converter::streamFrame(Frame &frame,
+                            const Batch &batch)
+{
+    // the stream readers write straight to the output band by band, so
+    // here every target reads the source again, the targets a reader does
+    // not handle are left for the full decode
+    bool streamed = true;
+    for (size_t i = 0; i < frame.renditions.size(); ++i) {
+        Rendition &rendition = frame.renditions[i];
+        const Target &target = batch.targets.at(rendition.target);
+        StreamConverter::Settings settings;
+        settings.output = batch.outputs.at(rendition.target);
+        settings.intent = lcmsIntent(target.intent);
+        settings.blackPoint = target.blackPoint;
+        settings.threads = frame.threads;
+        settings.lut = batch.options.lut;
+        settings.cancel = batch.options.cancel.get();
+        QString error;
+        StreamConverter::Status status;
+        {
+            JobReport::Timer timer(batch.options.stats, &rendition.result.stats.stages[StreamStage]);
+            status = StreamConverter::convert(frame.result.filename, rendition.result.output, settings, &error);
+        }
+        switch (status) {
+        case StreamConverter::StreamConverted:
+            rendition.result.success = true;
+            rendition.streamed = true;
+            break;
+        case StreamConverter::StreamFailed:
+            rendition.result.error = error;
+            rendition.result.cancelled = isCancelled(batch.options);
+            rendition.streamed = true;
+            break;
+        default:
+            streamed = false;
+        }
+    }
+    if (streamed) { return true; }
+
+    // the streamed targets are done and wait for finishFrame() apart from
+    // the others, so the full decode does not write them again
+    std::vector<Rendition> remaining;
+    for (size_t i = 0; i < frame.renditions.size(); ++i) {
+        if (frame.renditions[i].streamed) {
+            frame.finished.push_back(std::move(frame.renditions[i]));
+        } else {
+            remaining.push_back(std::move(frame.renditions[i]));
+        }
+    }
+    frame.renditions.swap(remaining);
+    return false;
+}
+
+bool Converter::decodeFrame(Frame &frame,
+                            const Batch &batch)
+{
+    qDebug() << "CONVERT" << frame.result.filename << frame.renditions.size() << frame.streamed;
+
+    if (frame.streamed) {
+        if (streamFrame(frame, batch)) { return true; }
+
+        // layouts or targets the stream readers do not handle are decoded
+        // whole
+        frame.streamed = false;
+        frame.result.stats.streamed = false;
+        JobReport::Timer timer(batch.options.stats, &frame.result.stats.stages[AdmitStage]);
+        frame.reserved = batch.budget->acquire(frame.footprint);
+    }
+
+    const bool stats = batch.options.stats;
+    try {
+        JobReport::Timer timer(stats, &frame.result.stats.stages[DecodeStage]);
+        if (frame.raw) {
+            const Pixels &raw = *frame.raw;
+            if (!raw.data || raw.cs == colorSpaceUnknown || raw.width == 0 || raw.height == 0) {
+                frame.result.error = tr("Invalid pixel buffer");
+                return false;
+            }
+            frame.image.read(raw.width, raw.height,
+                             pixelMap(raw.cs, raw.alpha),
+                             raw.bytes == 2 ? Magick::ShortPixel : Magick::CharPixel,
+                             raw.data);
+            frame.image.depth(raw.bytes == 2 ? 16 : 8);
+            if (!raw.profile.isEmpty()) {
+                frame.image.iccColorProfile(Magick::Blob(raw.profile.constData(), static_cast<size_t>(raw.profile.size())));
+            }
+            frame.format = "TIFF";
+        } else if (frame.source.length() > 0) {
+            frame.image.read(frame.source);
+            frame.format = frame.image.magick();
+        } else {
+            frame.image.read(frame.result.filename.toStdString());
+        }
+    }
+    catch(Magick::Error &error ) {
+        frame.result.error = QString::fromUtf8(error.what());
+        return false;
+    }
+    catch(Magick::Warning &warn ) { qWarning() << warn.what(); }
+    try {
+        {
+            JobReport::Timer timer(stats, &frame.result.stats.stages[ProfileStage]);
+            Magick::Blob embedded = frame.image.iccColorProfile();
+            frame.embedded = embedded.length() > 0;
+            if (frame.embedded) {
+                frame.input = loadProfile(QByteArray(static_cast<const char*>(embedded.data()),
+                                                     static_cast<int>(embedded.length())));
+            } else {
+                frame.input = ProfileRegistry::instance()->fallback(imageColorspace(frame.image));
+            }
+        }
+        frame.image.quiet(true);
+        if (frame.image.colorSpace() == Magick::YCbCrColorspace) {
+            frame.image.colorSpace(Magick::sRGBColorspace);
+        }
+
+        // 8-bit sources stay 8-bit all the way through lcms
+        frame.cs = imageColorspace(frame.image);
+        frame.alpha = imageHasAlpha(frame.image);
+        frame.bytes = frame.image.depth() > 8 ? 2 : 1;
+        bool native = false;
+        bool magick = false;
+        for (size_t i = 0; i < frame.renditions.size(); ++i) {
+            prepareRendition(frame, frame.renditions[i], batch);
+            if (frame.renditions[i].native) {
+                native = true;
+            } else {
+                magick = true;
+            }
+        }
+        if (!native) { return true; }
+
+        // the pixels are exported once whatever the number of targets
+        JobReport::Timer timer(stats, &frame.result.stats.stages[DecodeStage]);
+        frame.width = frame.image.columns();
+        frame.height = frame.image.rows();
+        BufferPool::instance()->take(frame.pixels, frame.width * frame.height * pixelChannels(frame.cs, frame.alpha) * frame.bytes);
+        frame.image.write(0, 0, frame.width, frame.height,
+                          pixelMap(frame.cs, frame.alpha),
+                          frame.bytes == 2 ? Magick::ShortPixel : Magick::CharPixel,
+                          frame.pixels.data());
+
+        // only the raw pixels are needed from here, drop the decoded image
+        // unless a target is left to ImageMagick
+        frame.attributes = imageAttributes(frame.image);
+        if (!magick) { frame.image = Magick::Image(); }
+    }
+    catch(Magick::Error &error ) {
+        frame.result.error = QString::fromUtf8(error.what());
+        return false;
+    }
+    catch(Magick::Warning &warn ) { qWarning() << warn.what(); }
+    return true;
+}
+
+void Converter::prepareRendition(const Frame &frame,
+                                 Rendition &rendition,
+                                 const Batch &batch)
+{
+    const Profile &output = batch.outputs.at(rendition.target);
+    const Target &target = batch.targets.at(rendition.target);
+
+    // a profile that does not describe the pixels, or that already is
+    // the output profile, is left to ImageMagick
+    if (batch.options.mode == MagickConversionMode ||
+        frame.input.cs != frame.cs ||
+        frame.input.digest == output.digest) {
+        return;
+    }
+
+    JobReport::Timer timer(batch.options.stats, &rendition.result.stats.stages[LookupStage]);
+    if (batch.options.lut &&
+        frame.cs == colorSpaceRGB &&
+        !frame.alpha &&
+        frame.bytes == 1) {
+        rendition.lut = LutKernel::get(frame.input,
+                                       output,
+                                       pixelFormat(output.cs, false, 1),
+                                       lcmsIntent(target.intent),
+                                       target.blackPoint);
+        if (rendition.lut) { rendition.result.stats.lutDeltaE = rendition.lut->maxDeltaE(); }
+    }
+    if (!rendition.lut) {
+        rendition.transform = TransformCache::instance()->transform(frame.input.data,
+                                                                    frame.input.digest,
+                                                                    output.data,
+                                                                    output.digest,
+                                                                    pixelFormat(frame.cs, frame.alpha, frame.bytes),
+                                                                    pixelFormat(output.cs, frame.alpha, frame.bytes),
+                                                                    lcmsIntent(target.intent),
+                                                                    target.blackPoint,
+                                                                    &rendition.result.stats.cached);
+    }
+    rendition.native = rendition.transform || rendition.lut;
+    if (!rendition.native || !batch.options.analyze) { return; }
+    rendition.gamut = TransformCache::instance()->gamutCheck(frame.input.data,
+                                                             frame.input.digest,
+                                                             output.data,
+                                                             output.digest,
+                                                             pixelFormat(frame.cs, frame.alpha, frame.bytes),
+                                                             lcmsIntent(target.intent),
+                                                             target.blackPoint);
+    if (output.cs == colorSpaceCMYK) { rendition.ink = std::make_shared<InkCoverage>(); }
+}
+
+bool Converter::transformFrame(Frame &frame,
+                               const Batch &batch)
+{
+    if (frame.streamed) { return true; }
+    if (isCancelled(batch.options)) {
+        cancelResult(frame.result);
+        return false;
+    }
+
+    // every band of the decoded pixels goes through the transforms of all
+    // native targets in turn, while it is still in cache
+    std::vector<Rendition*> native;
+    for (size_t i = 0; i < frame.renditions.size(); ++i) {
+        Rendition &rendition = frame.renditions[i];
+        if (!rendition.native) { continue; }
+        BufferPool::instance()->take(rendition.pixels, frame.width * frame.height * pixelChannels(batch.outputs.at(rendition.target).cs, frame.alpha) * frame.bytes);
+        native.push_back(&rendition);
+    }
+    if (!native.empty()) {
+        // every band worker measures into its own tables, they are added
+        // up once the image is done
+        const bool analyze = batch.options.analyze;
+        const size_t bandRows = BandProcessor::bandRows(frame.width);
+        const size_t workers = static_cast<size_t>(BandProcessor::workers(frame.height, bandRows, frame.threads));
+        std::vector<BandAnalysis> analysis(analyze ? workers * native.size() : 0);
+        qint64 elapsed = 0;
+        {
+            JobReport::Timer timer(batch.options.stats, &elapsed);
+            const size_t inputPixel = pixelChannels(frame.cs, frame.alpha) * frame.bytes;
+            BandProcessor::runWorkers(frame.height, bandRows, frame.threads,
+                                      [&](int worker, size_t first, size_t count) {
+                for (size_t i = 0; i < native.size(); ++i) {
+                    Rendition &rendition = *native.at(i);
+                    transformRows(rendition.transform.get(),
+                                  rendition.lut.get(),
+                                  frame.pixels.data(),
+                                  rendition.pixels.data(),
+                                  frame.width,
+                                  first,
+                                  count,
+                                  inputPixel,
+                                  pixelChannels(batch.outputs.at(rendition.target).cs, frame.alpha) * frame.bytes,
+                                  frame.alpha ? frame.bytes : 0);
+                    if (!analyze) { continue; }
+
+                    // measured while the band is still in cache
+                    analyzeRows(rendition.gamut.get(),
+                                frame.pixels.data(),
+                                rendition.pixels.data(),
+                                frame.width,
+                                first,
+                                count,
+                                inputPixel,
+                                static_cast<int>(pixelChannels(batch.outputs.at(rendition.target).cs, frame.alpha)),
+                                frame.bytes,
+                                rendition.ink != nullptr,
+                                &analysis[static_cast<size_t>(worker) * native.size() + i]);
+                }
+            }, batch.options.cancel.get());
+        }
+        BufferPool::instance()->give(frame.pixels);
+        for (size_t i = 0; i < native.size(); ++i) {
+            Rendition &rendition = *native.at(i);
+            for (size_t worker = 0; analyze && worker < workers; ++worker) {
+                const BandAnalysis &measured = analysis.at(worker * native.size() + i);
+                if (rendition.ink) { rendition.ink->merge(measured.ink); }
+                rendition.gamutChecked += measured.checked;
+                rendition.gamutOut += measured.outside;
+            }
+            Stats &stats = rendition.result.stats;
+            stats.stages[TransformStage] += elapsed;
+            if (rendition.ink) {
+                stats.inkMax = rendition.ink->maximum();
+                stats.inkLimit = batch.options.inkLimit;
+                stats.inkOver = rendition.ink->over(batch.options.inkLimit);
+                rendition.ink->histogram(stats.inkHistogram, InkBins);
+            }
+            stats.gamutChecked = rendition.gamutChecked;
+            stats.gamutOut = rendition.gamutOut;
+        }
+        if (isCancelled(batch.options)) {
+            cancelResult(frame.result);
+            return false;
+        }
+    }
+
+    // the other targets convert their own copy of the decoded image,
+    // side by side
+    if (native.size() == frame.renditions.size()) { return true; }
+    for (size_t i = 0; i < frame.renditions.size(); ++i) {
+        if (!frame.renditions[i].native) { frame.renditions[i].image = frame.image; }
+    }
+    frame.image = Magick::Image();
+    BandProcessor::run(frame.renditions.size(), 1, frame.threads,
+                       [&](size_t first, size_t count) {
+        for (size_t i = first; i < first + count; ++i) {
+            Rendition &rendition = frame.renditions[i];
+            if (!rendition.native) { rendition.ok = transformImage(frame, rendition, batch); }
+        }
+    });
+    return true;
+}
+
+bool Converter::transformImage(const Frame &frame,
+                               Rendition &rendition,
+                               const Batch &batch)
+{
+    const Profile &output = batch.outputs.at(rendition.target);
+    const Target &target = batch.targets.at(rendition.target);
+    JobReport::Timer timer(batch.options.stats, &rendition.result.stats.stages[TransformStage]);
+    try {
+        switch (target.intent) {
+        case SaturationRenderingIntent:
+            rendition.image.renderingIntent(Magick::SaturationIntent);
+            break;
+        case PerceptualRenderingIntent:
+            rendition.image.renderingIntent(Magick::PerceptualIntent);
+            break;
+        case AbsoluteRenderingIntent:
+            rendition.image.renderingIntent(Magick::AbsoluteIntent);
+            break;
+        case RelativeRenderingIntent:
+            rendition.image.renderingIntent(Magick::RelativeIntent);
+            break;
+        default:;
+        }
+
+        rendition.image.blackPointCompensation(target.blackPoint);
+
+        if (!frame.embedded) {
+            rendition.image.profile("ICC", ProfileRegistry::instance()->blob(frame.input));
+        }
+        rendition.image.profile("ICC", ProfileRegistry::instance()->blob(output));
+    }
+    catch(Magick::Error &error ) {
+        rendition.result.error = QString::fromUtf8(error.what());
+        return false;
+    }
+    catch(Magick::Warning &warn ) { qWarning() << warn.what(); }
+    return true;
+}
+
+bool Converter::encodeFrame(Frame &frame,
+                            const Batch &batch)
+{
+    if (frame.streamed) { return true; }
+
+    // the encoders mostly run on one core, so the targets are encoded
+    // side by side
+    BandProcessor::run(frame.renditions.size(), 1, frame.threads,
+                       [&](size_t first, size_t count) {
+        for (size_t i = first; i < first + count; ++i) {
+            Rendition &rendition = frame.renditions[i];
+            if (rendition.ok) { rendition.ok = encodeImage(frame, rendition, batch); }
+        }
+    });
+    return true;
+}
+
+bool Converter::encodeImage(const Frame &frame,
+                            Rendition &rendition,
+                            const Batch &batch)
+{
+    const Profile &output = batch.outputs.at(rendition.target);
+    const bool stats = batch.options.stats;
+    Result &result = rendition.result;
+    try {
+        JobReport::Timer timer(stats, &result.stats.stages[EncodeStage]);
+        if (rendition.native) {
+            rendition.image.read(frame.width, frame.height,
+                                 pixelMap(output.cs, frame.alpha),
+                                 frame.bytes == 2 ? Magick::ShortPixel : Magick::CharPixel,
+                                 rendition.pixels.data());
+            BufferPool::instance()->give(rendition.pixels);
+            applyAttributes(frame.attributes, rendition.image);
+            rendition.image.iccColorProfile(ProfileRegistry::instance()->blob(output));
+        }
+        if (result.output.isEmpty()) {
+            // in memory conversions are encoded to the asked format, or
+            // to the format they came in
+            Magick::Blob blob;
+            rendition.image.magick(batch.options.format.isEmpty() ? frame.format : batch.options.format.toUpper().toStdString());
+            rendition.image.write(&blob);
+            rendition.image = Magick::Image();
+            result.data = QByteArray(static_cast<const char*>(blob.data()), static_cast<int>(blob.length()));
+            result.stats.bytesOut = result.data.size();
+        } else if (!stats) {
+            rendition.image.write(result.output.toStdString());
+        } else {
+            // encoded to memory first so encoding and disk I/O are timed apart
+            Magick::Blob blob;
+            rendition.image.magick(QFileInfo(result.output).suffix().toUpper().toStdString());
+            rendition.image.write(&blob);
+            rendition.image = Magick::Image();
+
+            JobReport::Timer write(stats, &result.stats.stages[WriteStage]);
+            QFile file(result.output);
+            if (!file.open(QIODevice::WriteOnly) ||
+                file.write(static_cast<const char*>(blob.data()), static_cast<qint64>(blob.length())) != static_cast<qint64>(blob.length())) {
+                result.error = file.errorString();
+                file.close();
+                QFile::remove(result.output);
+                return false;
+            }
+            result.stats.bytesOut = static_cast<qint64>(blob.length());
+        }
+    }
+    catch(Magick::Error &error ) {
+        result.error = QString::fromUtf8(error.what());
+        if (!result.output.isEmpty()) { QFile::remove(result.output); }
+        return false;
+    }
+    catch(Magick::Warning &warn ) { qWarning() << warn.what(); }
+
+    rendition.image = Magick::Image();
+    result.success = true;
+    return true;
+}
+
+QList<Converter::Result> Converter::finishFrame(Frame &frame,
+                                                const Batch &batch)
+{
+    // the stages before the fan out are shared, every target reports them
+    const Stats &shared = frame.result.stats;
+    const qint64 total = frame.timer.isValid() ? frame.timer.nsecsElapsed() : 0;
+    qint64 bytesIn = 0;
+    if (batch.options.stats) {
+        if (frame.raw) {
+            bytesIn = static_cast<qint64>(frame.raw->width * frame.raw->height * pixelChannels(frame.raw->cs, frame.raw->alpha)) * frame.raw->bytes;
+        } else if (frame.source.length() > 0) {
+            bytesIn = static_cast<qint64>(frame.source.length());
+        } else {
+            bytesIn = QFileInfo(frame.result.filename).size();
+        }
+    }
+    const qint64 peakMemory = batch.options.stats ? JobReport::peakMemory() : 0;
+
+    // buffers left over by a failed or cancelled image go back as well
+    BufferPool::instance()->give(frame.pixels);
+
+    // targets streamed before the rest fell back to a full decode rejoin
+    // the others in target order
+    if (!frame.finished.empty()) {
+        for (size_t i = 0; i < frame.finished.size(); ++i) {
+            frame.renditions.push_back(std::move(frame.finished[i]));
+        }
+        frame.finished.clear();
+        std::stable_sort(frame.renditions.begin(), frame.renditions.end(),
+                         [](const Rendition &a, const Rendition &b) {
+            return a.target < b.target;
+        });
+    }
+    QList<Result> results;
+    for (size_t i = 0; i < frame.renditions.size(); ++i) {
+        BufferPool::instance()->give(frame.renditions[i].pixels);
+        Result &result = frame.renditions[i].result;
+        if (!frame.ok && !result.success && result.error.isEmpty()) {
+            result.error = frame.result.error;
+            result.cancelled = frame.result.cancelled;
+        }
+        if (batch.options.stats) {
+            Stats &stats = result.stats;
+            stats.stages[AdmitStage] += shared.stages[AdmitStage];
+            stats.stages[DecodeStage] += shared.stages[DecodeStage];
+            stats.stages[ProfileStage] += shared.stages[ProfileStage];
+            stats.pixels = shared.pixels;
+            stats.streamed = shared.streamed || frame.renditions[i].streamed;
+            stats.workers = shared.workers;
+            stats.threads = shared.threads;
+            stats.magickThreads = shared.magickThreads;
+            stats.total = total;
+            stats.bytesIn = bytesIn;
+            if (result.success && stats.bytesOut == 0) {
+                stats.bytesOut = QFileInfo(result.output).size();
+            }
+            stats.peakMemory = peakMemory;
+        }
+        results.append(result);
+    }
+    return results;
+}
@@ -0,0 +1,283 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef CONVERTER_H
+#define CONVERTER_H
+
+#include <QObject>
+#include <QUrl>
+#include <QList>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QSet>
+#include <QMutex>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QMetaType>
+
+#include <functional>
+#include <memory>
+
+#include "memorybudget.h"
+#include "executionbudget.h"
+
+class LutKernel;
+
+class Converter : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    enum colorSpace {
+        colorSpaceUnknown,
+        colorSpaceRGB,
+        colorSpaceCMYK,
+        colorSpaceGRAY
+    };
+    enum RenderingIntent {
+        UndefinedRenderingIntent,
+        SaturationRenderingIntent,
+        PerceptualRenderingIntent,
+        AbsoluteRenderingIntent,
+        RelativeRenderingIntent
+    };
+
+    enum ConversionMode {
+        NativeConversionMode,
+        MagickConversionMode,
+        StreamConversionMode
+    };
+
+    struct Result;
+
+    // one output of a conversion, a batch with several targets decodes
+    // every image once and writes one file per target
+    struct Target
+    {
+        QByteArray outputProfile;
+        RenderingIntent intent = PerceptualRenderingIntent;
+        bool blackPoint = true;
+        QString suffix;
+    };
+
+    struct Options
+    {
+        QByteArray outputProfile;
+        QString suffix;
+        QString outputDirectory;
+        RenderingIntent intent = PerceptualRenderingIntent;
+        bool blackPoint = true;
+        ConversionMode mode = NativeConversionMode;
+        int threads = 0;
+        bool pipeline = false;
+        int decodeJobs = 0;
+        int transformJobs = 0;
+        int encodeJobs = 0;
+        int queueDepth = 2;
+        qint64 memoryLimit = 0;
+        bool stats = false;
+        bool lut = false;
+        bool analyze = false;
+        int inkLimit = 300;
+        bool incremental = false;
+        QString manifest;
+        QList<Target> targets;
+        QString format;
+        int priority = 0;
+        std::shared_ptr<QAtomicInt> cancel;
+        std::function<void(const Result &)> progress;
+    };
+
+    enum Stage {
+        AdmitStage,
+        DecodeStage,
+        ProfileStage,
+        LookupStage,
+        TransformStage,
+        EncodeStage,
+        WriteStage,
+        StreamStage,
+        StageCount
+    };
+
+    // coverage bins of 10%, from 0 to 400%
+    static const int InkBins = 41;
+
+    struct Stats
+    {
+        qint64 stages[StageCount] = {};
+        qint64 total = 0;
+        qint64 pixels = 0;
+        qint64 bytesIn = 0;
+        qint64 bytesOut = 0;
+        qint64 peakMemory = 0;
+        bool cached = false;
+        bool streamed = false;
+        double lutDeltaE = -1;
+        int inkMax = -1;
+        int inkLimit = 0;
+        qint64 inkOver = 0;
+        qint64 inkHistogram[InkBins] = {};
+        qint64 gamutChecked = 0;
+        qint64 gamutOut = 0;
+        int workers = 0;
+        int threads = 0;
+        int magickThreads = 0;
+    };
+
+    struct Result
+    {
+        QString filename;
+        QString output;
+        int target = 0;
+        bool success = false;
+        bool skipped = false;
+        bool cancelled = false;
+        QString error;
+        QByteArray data;
+        Stats stats;
+    };
+
+    // raw pixels for convertPixels, packed rows in the channel order of
+    // the color space, with the profile that describes them if any
+    struct Pixels
+    {
+        const unsigned char *data = nullptr;
+        size_t width = 0;
+        size_t height = 0;
+        colorSpace cs = colorSpaceUnknown;
+        bool alpha = false;
+        int bytes = 1;
+        QByteArray profile;
+    };
+
+    struct Profile
+    {
+        QByteArray data;
+        QByteArray digest;
+        colorSpace cs = colorSpaceUnknown;
+    };
+
+    explicit Converter(QObject *parent = nullptr);
+
+    int maxJobs() const;
+    void setMaxJobs(int jobs);
+
+    QList<Result> convertUrls(const QList<QUrl> &urls,
+                              const Options &options);
+    QList<Result> convertData(const QByteArray &data,
+                              const Options &options);
+    QList<Result> convertPixels(const Pixels &pixels,
+                                const Options &options);
+
+    static QList<Target> outputTargets(const Options &options);
+    static colorSpace profileColorspace(const QByteArray &profile);
+    static QString colorSpaceSuffix(colorSpace cs);
+    static QByteArray fileToByteArray(const QString &filename);
+    static bool isValidImage(const QString &filename);
+    static Profile loadProfile(const QByteArray &data);
+    static size_t pixelChannels(colorSpace cs, bool alpha);
+    static quint32 pixelFormat(colorSpace cs, bool alpha, int bytes);
+    static quint32 lcmsIntent(RenderingIntent intent);
+    static void transformPixels(const std::shared_ptr<void> &transform,
+                                const unsigned char *input,
+                                unsigned char *output,
+                                size_t width,
+                                size_t rows,
+                                size_t inputPixel,
+                                size_t outputPixel,
+                                int alphaBytes,
+                                int threads,
+                                const LutKernel *lut = nullptr,
+                                const QAtomicInt *cancel = nullptr);
+
+private:
+    struct Frame;
+    struct Rendition;
+    struct Job
+    {
+        QString filename;
+        QList<int> targets;
+        QStringList outputs;
+        QByteArray data;
+        const Pixels *pixels = nullptr;
+    };
+    struct Batch
+    {
+        Options options;
+        QList<Target> targets;
+        QList<Profile> outputs;
+        MemoryBudget *budget = nullptr;
+    };
+
+    bool prepareBatch(const Options &options,
+                      Batch &batch);
+    QList<Result> convertBuffer(Job &job,
+                                const Options &options);
+    static QString outputDirectory(const QString &filename,
+                                   const QString &directory);
+    QString reserveFilename(const QString &filename,
+                            const QString &suffix,
+                            const QString &directory);
+    void releaseFilename(const QString &filename);
+    void admitFrame(Frame &frame,
+                    const Batch &batch);
+    static qint64 estimateFootprint(const Frame &frame,
+                                    const Batch &batch,
+                                    qint64 *pixels = nullptr);
+    QList<Result> convertJobs(const QList<Job> &jobs,
+                              const Batch &batch);
+    QList<Result> convertPipeline(const QList<Job> &jobs,
+                                  const Batch &batch);
+    QList<Result> convertFile(const Job &job,
+                              const Batch &batch);
+    static void startFrame(Frame &frame,
+                           const Job &job);
+    static bool streamFrame(Frame &frame,
+                            const Batch &batch);
+    static bool decodeFrame(Frame &frame,
+                            const Batch &batch);
+    static void prepareRendition(const Frame &frame,
+                                 Rendition &rendition,
+                                 const Batch &batch);
+    static bool transformFrame(Frame &frame,
+                               const Batch &batch);
+    static bool transformImage(const Frame &frame,
+                               Rendition &rendition,
+                               const Batch &batch);
+    static bool encodeFrame(Frame &frame,
+                            const Batch &batch);
+    static bool encodeImage(const Frame &frame,
+                            Rendition &rendition,
+                            const Batch &batch);
+    static QList<Result> finishFrame(Frame &frame,
+                                     const Batch &batch);
+
+    QThreadPool _pool;
+    MemoryBudget _budget;
+    ExecutionBudget _execution;
+    QMutex _reservedMutex;
+    QSet<QString> _reserved;
+};
+
+Q_DECLARE_METATYPE(Converter::Result)
+
+#endif // CONVERTER_H
@@ -0,0 +1,75 @@
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+
+# conversion engine, shared by the application and the benchmark
+
+VERSION = 2.0.0
+QT += core concurrent
+CONFIG += c++11
+DEFINES += VERSION_APP=\\\"$${VERSION}\\\"
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/bandprocessor.cpp \
+    $$PWD/bufferpool.cpp \
+    $$PWD/converter.cpp \
+    $$PWD/executionbudget.cpp \
+    $$PWD/filescanner.cpp \
+    $$PWD/folderwatcher.cpp \
+    $$PWD/inkcoverage.cpp \
+    $$PWD/jobreport.cpp \
+    $$PWD/jobscheduler.cpp \
+    $$PWD/lutkernel.cpp \
+    $$PWD/manifest.cpp \
+    $$PWD/memorybudget.cpp \
+    $$PWD/profileregistry.cpp \
+    $$PWD/streamconverter.cpp \
+    $$PWD/transformcache.cpp
+
+HEADERS += \
+    $$PWD/bandprocessor.h \
+    $$PWD/boundedqueue.h \
+    $$PWD/bufferpool.h \
+    $$PWD/converter.h \
+    $$PWD/executionbudget.h \
+    $$PWD/filescanner.h \
+    $$PWD/folderwatcher.h \
+    $$PWD/inkcoverage.h \
+    $$PWD/jobreport.h \
+    $$PWD/jobscheduler.h \
+    $$PWD/lutkernel.h \
+    $$PWD/manifest.h \
+    $$PWD/memorybudget.h \
+    $$PWD/profileregistry.h \
+    $$PWD/streamconverter.h \
+    $$PWD/transformcache.h
+
+RESOURCES += \
+    $$PWD/assets.qrc
+
+QT_CONFIG -= no-pkg-config
+CONFIG += link_pkgconfig
+MAGICK_CONFIG = Magick++
+!isEmpty(MAGICK): MAGICK_CONFIG = $${MAGICK}
+
+PKG_CONFIG_BIN = pkg-config
+!isEmpty(CUSTOM_PKG_CONFIG): PKG_CONFIG_BIN = $${CUSTOM_PKG_CONFIG}
+
+PKGCONFIG += $${MAGICK_CONFIG} lcms2 libtiff-4 libjpeg libpng
+win32: LIBS += `$${PKG_CONFIG_BIN} --libs --static $${MAGICK_CONFIG}` -lpsapi
@@ -0,0 +1,140 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#include "executionbudget.h"
+
+#include <QMutexLocker>
+#include <QThread>
+
+#include <Magick++.h>
+
+// below two bands per thread the threads cost more than they save
+#define PIXELS_PER_THREAD 524288
+
+// unlimited resources are reported as -1
+static qint64 resourceLimit(MagickCore::MagickSizeType limit)
+{
+    if (limit > static_cast<MagickCore::MagickSizeType>(Q_INT64_C(9223372036854775807))) { return -1; }
+    return static_cast<qint64>(limit);
+}
+
+ExecutionBudget::ExecutionBudget()
+    : _cores(cores())
+    , _workers(_cores)
+    , _queued(0)
+    , _active(0)
+    , _magickThreads(0)
+    , _magickMemory(0)
+{
+}
+
+int ExecutionBudget::workers() const
+{
+    QMutexLocker lock(&_mutex);
+    return _workers;
+}
+
+void ExecutionBudget::setWorkers(int workers)
+{
+    QMutexLocker lock(&_mutex);
+    _workers = qMax(1, workers);
+}
+
+int ExecutionBudget::magickThreads() const
+{
+    QMutexLocker lock(&_mutex);
+    return _magickThreads;
+}
+
+void ExecutionBudget::schedule(int files,
+                               qint64 memory)
+{
+    QMutexLocker lock(&_mutex);
+    _queued += files;
+    applyLimits(memory);
+}
+
+int ExecutionBudget::admit(qint64 pixels,
+                           int threads)
+{
+    QMutexLocker lock(&_mutex);
+    if (_queued > 0) { _queued--; }
+    _active++;
+    if (threads > 0) { return threads; }
+
+    // the images in flight and the ones about to get a worker share the
+    // cores, so the last files of a batch get more threads each
+    const int sharing = qMax(_active, qMin(_workers, _active + _queued));
+    const qint64 useful = qMax(Q_INT64_C(1), pixels / PIXELS_PER_THREAD);
+    return static_cast<int>(qMin(static_cast<qint64>(qMax(1, _cores / sharing)), useful));
+}
+
+void ExecutionBudget::cancel()
+{
+    QMutexLocker lock(&_mutex);
+    if (_queued > 0) { _queued--; }
+    applyLimits(_magickMemory);
+}
+
+void ExecutionBudget::release()
+{
+    QMutexLocker lock(&_mutex);
+    if (_active > 0) { _active--; }
+
+    // the files still to come get the cores of the finished ones, the
+    // ImageMagick teams as well as the band threads in admit()
+    applyLimits(_magickMemory);
+}
+
+int ExecutionBudget::cores()
+{
+    return qMax(1, QThread::idealThreadCount());
+}
+
+ExecutionBudget::Limits ExecutionBudget::magickLimits()
+{
+    Limits limits;
+    limits.threads = resourceLimit(Magick::ResourceLimits::thread());
+    limits.memory = resourceLimit(Magick::ResourceLimits::memory());
+    limits.map = resourceLimit(Magick::ResourceLimits::map());
+    limits.disk = resourceLimit(Magick::ResourceLimits::disk());
+    return limits;
+}
+
+void ExecutionBudget::applyLimits(qint64 memory)
+{
+    // the OpenMP teams of ImageMagick are process wide, so they get the
+    // cores left to each of the files that will run at once, a lone file
+    // gets them all
+    const int concurrent = qMax(1, qMin(_workers, _active + _queued));
+    const int threads = qMax(1, _cores / concurrent);
+    if (threads != _magickThreads) {
+        Magick::ResourceLimits::thread(static_cast<MagickCore::MagickSizeType>(threads));
+        _magickThreads = threads;
+    }
+
+    // pixel caches beyond the memory budget are memory mapped, then go
+    // to disk, instead of pushing the machine into swap
+    if (memory > 0 && memory != _magickMemory) {
+        Magick::ResourceLimits::memory(static_cast<MagickCore::MagickSizeType>(memory));
+        Magick::ResourceLimits::map(static_cast<MagickCore::MagickSizeType>(memory) * 2);
+        _magickMemory = memory;
+    }
+}
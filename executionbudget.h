@@ -0,0 +1,69 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#ifndef EXECUTIONBUDGET_H
+#define EXECUTIONBUDGET_H
+
+#include <QMutex>
+
+// shares the cores between the files converted side by side and the
+// threads working on each of them, and keeps the ImageMagick limits
+// in line with that split
+class ExecutionBudget
+{
+public:
+    // current ImageMagick limits, -1 when unlimited
+    struct Limits
+    {
+        qint64 threads = 0;
+        qint64 memory = 0;
+        qint64 map = 0;
+        qint64 disk = 0;
+    };
+
+    ExecutionBudget();
+
+    int workers() const;
+    void setWorkers(int workers);
+    int magickThreads() const;
+
+    void schedule(int files,
+                  qint64 memory);
+    int admit(qint64 pixels,
+              int threads);
+    void cancel();
+    void release();
+
+    static int cores();
+    static Limits magickLimits();
+
+private:
+    void applyLimits(qint64 memory);
+
+    mutable QMutex _mutex;
+    int _cores;
+    int _workers;
+    int _queued;
+    int _active;
+    int _magickThreads;
+    qint64 _magickMemory;
+};
+
+#endif // EXECUTIONBUDGET_H
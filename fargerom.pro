@@ -15,8 +15,7 @@
 # along with this program.  If not, see <http://www.gnu.org/licenses/>
 #
 
-VERSION = 2.0.0
-QT += core gui concurrent widgets
+QT += core gui concurrent widgets network
 CONFIG += c++11
 DEFINES += QT_DEPRECATED_WARNINGS
 
@@ -33,28 +32,24 @@ QMAKE_TARGET_COPYRIGHT = "Copyright NettStudio AS"
 CONFIG(release, debug|release):DEFINES += QT_NO_DEBUG_OUTPUT
 win32: RC_ICONS += fargerom.ico
 
+include(engine.pri)
+
 SOURCES += \
+    headless.cpp \
+    httpserver.cpp \
     main.cpp \
-    mainwindow.cpp
+    mainwindow.cpp \
+    previewer.cpp \
+    profilecatalog.cpp \
+    singleinstance.cpp
 
 HEADERS += \
-    mainwindow.h
+    headless.h \
+    httpserver.h \
+    mainwindow.h \
+    previewer.h \
+    profilecatalog.h \
+    singleinstance.h
 
 FORMS += \
     mainwindow.ui
-
-RESOURCES += \
-    assets.qrc
-
-QT_CONFIG -= no-pkg-config
-CONFIG += link_pkgconfig
-MAGICK_CONFIG = Magick++
-!isEmpty(MAGICK): MAGICK_CONFIG = $${MAGICK}
-
-PKG_CONFIG_BIN = pkg-config
-!isEmpty(CUSTOM_PKG_CONFIG): PKG_CONFIG_BIN = $${CUSTOM_PKG_CONFIG}
-
-PKGCONFIG += $${MAGICK_CONFIG} lcms2
-win32: LIBS += `$${PKG_CONFIG_BIN} --libs --static $${MAGICK_CONFIG}`
-
-DEFINES += VERSION_APP=\\\"$${VERSION}\\\"
@@ -0,0 +1,238 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include "filescanner.h"
+
+#include <QDebug>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <algorithm>
+#include <functional>
+
+#define SCAN_CHUNK 256
+
+struct FileScanner::Scan
+{
+    QThreadPool *pool = nullptr;
+    std::shared_ptr<QAtomicInt> abort;
+    QMutex mutex;
+    QSet<QString> seen;
+    QAtomicInt pending;
+    QAtomicInt files;
+    std::function<void(const QStringList&)> found;
+    std::function<void(const QString&)> rejected;
+    std::function<void(int)> finished;
+};
+
+FileScanner::FileScanner(QObject *parent)
+    : QObject(parent)
+    , _scans(0)
+{
+    _pool.setMaxThreadCount(qMax(2, QThread::idealThreadCount()));
+}
+
+FileScanner::~FileScanner()
+{
+    cancel();
+    _pool.waitForDone();
+}
+
+FileScanner::Format FileScanner::sniff(const QString &filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) { return UnknownFormat; }
+    return sniff(file.read(8));
+}
+
+FileScanner::Format FileScanner::sniff(const QByteArray &magic)
+{
+    if (magic.startsWith("\xFF\xD8\xFF")) {
+        return JpegFormat;
+    } else if (magic.startsWith("\x89PNG\r\n\x1A\n")) {
+        return PngFormat;
+    } else if (magic.startsWith(QByteArray("II*\0", 4)) || magic.startsWith(QByteArray("MM\0*", 4)) ||
+               magic.startsWith(QByteArray("II+\0", 4)) || magic.startsWith(QByteArray("MM\0+", 4))) {
+        return TiffFormat;
+    }
+    return UnknownFormat;
+}
+
+QStringList FileScanner::collect(const QStringList &paths,
+                                 QStringList *rejected)
+{
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(2, QThread::idealThreadCount()));
+    QMutex mutex;
+    QStringList files;
+
+    std::shared_ptr<Scan> scan(new Scan);
+    scan->pool = &pool;
+    scan->abort = std::make_shared<QAtomicInt>(0);
+    scan->found = [&](const QStringList &chunk) {
+        QMutexLocker lock(&mutex);
+        files.append(chunk);
+    };
+    scan->rejected = [&](const QString &filename) {
+        QMutexLocker lock(&mutex);
+        if (rejected) { rejected->append(filename); }
+    };
+    scan->finished = [](int) {};
+    start(scan, paths);
+    pool.waitForDone();
+
+    // workers finish in any order, sorted output keeps reports stable
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+void FileScanner::scan(const QStringList &paths,
+                       int tag,
+                       const std::shared_ptr<QAtomicInt> &cancel)
+{
+    // every scan stops on its own flag, usually the one of the job its
+    // files are meant for, so a new scan does not revive a cancelled one
+    std::shared_ptr<QAtomicInt> abort = cancel ? cancel : std::make_shared<QAtomicInt>(0);
+    {
+        QMutexLocker lock(&_mutex);
+        QMutableListIterator<std::weak_ptr<QAtomicInt> > it(_aborts);
+        while (it.hasNext()) {
+            if (it.next().expired()) { it.remove(); }
+        }
+        _aborts.append(abort);
+    }
+    _scans.ref();
+    std::shared_ptr<Scan> scan(new Scan);
+    scan->pool = &_pool;
+    scan->abort = abort;
+    scan->found = [this, tag, abort](const QStringList &files) {
+        if (abort->loadAcquire()) { return; }
+        Q_EMIT found(files, tag);
+    };
+    scan->rejected = [](const QString &filename) {
+        qDebug() << "not a supported image" << filename;
+    };
+    scan->finished = [this, tag](int files) {
+        _scans.deref();
+        Q_EMIT finished(files, tag);
+    };
+    start(scan, paths);
+}
+
+void FileScanner::cancel()
+{
+    QMutexLocker lock(&_mutex);
+    for (int i = 0; i < _aborts.size(); ++i) {
+        std::shared_ptr<QAtomicInt> abort = _aborts.at(i).lock();
+        if (abort) { abort->storeRelease(1); }
+    }
+    _aborts.clear();
+}
+
+bool FileScanner::isScanning() const
+{
+    return _scans.load() > 0;
+}
+
+void FileScanner::start(const std::shared_ptr<Scan> &scan,
+                        const QStringList &paths)
+{
+    // the extra count keeps the scan from finishing before all the
+    // top level paths are submitted
+    scan->pending.ref();
+    for (int i = 0; i < paths.size(); ++i) {
+        submit(scan, paths.at(i), true);
+    }
+    if (!scan->pending.deref()) { scan->finished(scan->files.load()); }
+}
+
+void FileScanner::submit(const std::shared_ptr<Scan> &scan,
+                         const QString &path,
+                         bool explicitPath)
+{
+    scan->pending.ref();
+    QtConcurrent::run(scan->pool, [scan, path, explicitPath]() {
+        visit(scan, path, explicitPath);
+        if (!scan->pending.deref()) { scan->finished(scan->files.load()); }
+    });
+}
+
+void FileScanner::visit(const std::shared_ptr<Scan> &scan,
+                        const QString &path,
+                        bool explicitPath)
+{
+    if (scan->abort->loadAcquire()) { return; }
+    QFileInfo info(path);
+    const QString canonical = info.canonicalFilePath();
+    if (canonical.isEmpty()) { return; }
+
+    // canonical paths catch the same file given twice, through a
+    // symlink, and directory links that loop back
+    {
+        QMutexLocker lock(&scan->mutex);
+        if (scan->seen.contains(canonical)) { return; }
+        scan->seen.insert(canonical);
+    }
+
+    if (info.isFile()) {
+        if (sniff(canonical) != UnknownFormat) {
+            scan->files.ref();
+            scan->found(QStringList() << canonical);
+        } else if (explicitPath) {
+            scan->rejected(path);
+        }
+        return;
+    }
+    if (!info.isDir()) { return; }
+
+    // subdirectories are scanned by other workers, the files of this one
+    // are handed over in chunks as they are found
+    QStringList files;
+    QDirIterator it(canonical, QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+    while (it.hasNext()) {
+        if (scan->abort->loadAcquire()) { return; }
+        it.next();
+        QFileInfo entry = it.fileInfo();
+        if (entry.isDir()) {
+            submit(scan, entry.filePath(), false);
+            continue;
+        }
+        QString filename = entry.canonicalFilePath();
+        if (filename.isEmpty()) { continue; }
+        {
+            QMutexLocker lock(&scan->mutex);
+            if (scan->seen.contains(filename)) { continue; }
+            scan->seen.insert(filename);
+        }
+        if (sniff(filename) == UnknownFormat) { continue; }
+        files.append(filename);
+        scan->files.ref();
+        if (files.size() >= SCAN_CHUNK) {
+            scan->found(files);
+            files.clear();
+        }
+    }
+    if (!files.isEmpty()) { scan->found(files); }
+}
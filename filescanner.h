@@ -0,0 +1,83 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef FILESCANNER_H
+#define FILESCANNER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QList>
+
+#include <memory>
+
+class FileScanner : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    enum Format {
+        UnknownFormat,
+        JpegFormat,
+        PngFormat,
+        TiffFormat
+    };
+
+    explicit FileScanner(QObject *parent = nullptr);
+    ~FileScanner();
+
+    static Format sniff(const QString &filename);
+    static Format sniff(const QByteArray &magic);
+    static QStringList collect(const QStringList &paths,
+                               QStringList *rejected = nullptr);
+
+    void scan(const QStringList &paths,
+              int tag = 0,
+              const std::shared_ptr<QAtomicInt> &cancel = std::shared_ptr<QAtomicInt>());
+    void cancel();
+    bool isScanning() const;
+
+Q_SIGNALS:
+    void found(const QStringList &files, int tag);
+    void finished(int files, int tag);
+
+private:
+    struct Scan;
+
+    static void start(const std::shared_ptr<Scan> &scan,
+                      const QStringList &paths);
+    static void submit(const std::shared_ptr<Scan> &scan,
+                       const QString &path,
+                       bool explicitPath);
+    static void visit(const std::shared_ptr<Scan> &scan,
+                      const QString &path,
+                      bool explicitPath);
+
+    QThreadPool _pool;
+    QMutex _mutex;
+    QList<std::weak_ptr<QAtomicInt> > _aborts;
+    QAtomicInt _scans;
+};
+
+#endif // FILESCANNER_H
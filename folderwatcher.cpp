@@ -0,0 +1,232 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include "folderwatcher.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QUrl>
+#include <QtConcurrent/QtConcurrentRun>
+
+FolderWatcher::FolderWatcher(Converter *converter,
+                             const Converter::Options &options,
+                             QObject *parent)
+    : QObject(parent)
+    , _converter(converter)
+    , _options(options)
+    , _batchSize(64)
+{
+    _timer.setSingleShot(true);
+    _timer.setInterval(1000);
+    connect(&_watcher, SIGNAL(directoryChanged(QString)), this, SLOT(folderChanged()));
+    connect(&_timer, SIGNAL(timeout()), this, SLOT(scan()));
+    connect(&_batch, SIGNAL(finished()), this, SLOT(batchDone()));
+}
+
+FolderWatcher::~FolderWatcher()
+{
+    _batch.waitForFinished();
+}
+
+bool FolderWatcher::addFolder(const QString &folder)
+{
+    QFileInfo info(folder);
+    if (!info.isDir()) { return false; }
+    if (!_watcher.addPath(info.absoluteFilePath())) { return false; }
+
+    // files already in the folder are picked up like new ones
+    _timer.start();
+    return true;
+}
+
+QStringList FolderWatcher::folders() const
+{
+    return _watcher.directories();
+}
+
+void FolderWatcher::setDoneFolder(const QString &folder)
+{
+    _done = folder;
+}
+
+void FolderWatcher::setFailedFolder(const QString &folder)
+{
+    _failed = folder;
+}
+
+void FolderWatcher::setSettleTime(int msec)
+{
+    _timer.setInterval(msec);
+}
+
+void FolderWatcher::setBatchSize(int files)
+{
+    _batchSize = qMax(1, files);
+}
+
+void FolderWatcher::folderChanged()
+{
+    // writers touch the folder many times for one file, wait for a quiet
+    // period before looking
+    _timer.start();
+}
+
+void FolderWatcher::scan()
+{
+    QSet<QString> seen;
+    QStringList folderList = folders();
+    for (int i = 0; i < folderList.size(); ++i) {
+        QFileInfoList files = QDir(folderList.at(i)).entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+        for (int j = 0; j < files.size(); ++j) {
+            const QFileInfo &info = files.at(j);
+            QString filename = info.absoluteFilePath();
+            seen.insert(filename);
+            if (_queued.contains(filename)) { continue; }
+            Pending current;
+            current.size = info.size();
+            current.modified = info.lastModified().toMSecsSinceEpoch();
+            if (_ignored.contains(filename) && _ignored.value(filename) == current.modified) { continue; }
+
+            // a file is only taken once its size and time stayed the same
+            // for a whole settle period
+            QHash<QString, Pending>::iterator it = _pending.find(filename);
+            if (it == _pending.end() ||
+                it.value().size != current.size ||
+                it.value().modified != current.modified) {
+                _pending.insert(filename, current);
+                continue;
+            }
+            _pending.erase(it);
+            _ignored.remove(filename);
+            _queued.insert(filename);
+            _queue.append(filename);
+        }
+    }
+
+    // forget files that went away, so nothing grows while running
+    QMutableHashIterator<QString, Pending> pending(_pending);
+    while (pending.hasNext()) {
+        pending.next();
+        if (!seen.contains(pending.key())) { pending.remove(); }
+    }
+    QMutableHashIterator<QString, qint64> ignored(_ignored);
+    while (ignored.hasNext()) {
+        ignored.next();
+        if (!seen.contains(ignored.key())) { ignored.remove(); }
+    }
+
+    if (!_pending.isEmpty()) { _timer.start(); }
+    startBatch();
+}
+
+void FolderWatcher::startBatch()
+{
+    if (_batch.isRunning() || _queue.isEmpty()) { return; }
+
+    // one batch holds files from one folder, so the default output
+    // folder next to them is the same for all of them
+    QString folder = QFileInfo(_queue.first()).absolutePath();
+    QStringList files;
+    for (int i = 0; i < _queue.size() && files.size() < _batchSize;) {
+        if (QFileInfo(_queue.at(i)).absolutePath() == folder) {
+            files.append(_queue.takeAt(i));
+        } else {
+            ++i;
+        }
+    }
+    Converter::Options options = _options;
+    if (options.outputDirectory.isEmpty()) { options.outputDirectory = QDir(folder).filePath(QString("output")); }
+    qDebug() << "watch batch" << folder << files.size();
+
+    Converter *converter = _converter;
+    _batch.setFuture(QtConcurrent::run([converter, files, options]() -> QList<Converter::Result> {
+        QList<QUrl> urls;
+        QList<Converter::Result> results;
+        for (int i = 0; i < files.size(); ++i) {
+            if (!Converter::isValidImage(files.at(i))) {
+                Converter::Result result;
+                result.filename = files.at(i);
+                result.error = QString("Not a supported image");
+                results.append(result);
+                continue;
+            }
+            urls.append(QUrl::fromLocalFile(files.at(i)));
+        }
+        results.append(converter->convertUrls(urls, options));
+        return results;
+    }));
+}
+
+void FolderWatcher::batchDone()
+{
+    // an input with several targets is done once all of them are
+    QList<Converter::Result> results = _batch.result();
+    QStringList inputs;
+    QHash<QString, bool> success;
+    for (int i = 0; i < results.size(); ++i) {
+        const Converter::Result &result = results.at(i);
+        if (!success.contains(result.filename)) {
+            inputs.append(result.filename);
+            success.insert(result.filename, true);
+        }
+        if (!result.success) { success[result.filename] = false; }
+    }
+    for (int i = 0; i < inputs.size(); ++i) {
+        const QString &filename = inputs.at(i);
+        _queued.remove(filename);
+        QString moved = moveFile(filename, routeFolder(filename, success.value(filename)));
+        if (moved.isEmpty()) {
+            qWarning() << "unable to move" << filename;
+            _ignored.insert(filename, QFileInfo(filename).lastModified().toMSecsSinceEpoch());
+        }
+    }
+    Q_EMIT batchFinished(results);
+    startBatch();
+}
+
+QString FolderWatcher::routeFolder(const QString &filename, bool success) const
+{
+    const QString &folder = success ? _done : _failed;
+    if (!folder.isEmpty()) { return folder; }
+    return QDir(QFileInfo(filename).absolutePath()).filePath(QString(success ? "done" : "failed"));
+}
+
+QString FolderWatcher::moveFile(const QString &filename, const QString &folder)
+{
+    QDir().mkpath(folder);
+    QFileInfo info(filename);
+    QString target = QDir(folder).filePath(info.fileName());
+    int counter = 1;
+    while (QFile::exists(target)) {
+        target = QDir(folder).filePath(QString("%1_%2.%3").arg(info.completeBaseName()).arg(counter).arg(info.suffix()));
+        counter++;
+    }
+    if (QFile::rename(filename, target)) { return target; }
+
+    // rename does not cross file systems
+    if (!QFile::copy(filename, target)) { return QString(); }
+    if (!QFile::remove(filename)) {
+        QFile::remove(target);
+        return QString();
+    }
+    return target;
+}
@@ -0,0 +1,85 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef FOLDERWATCHER_H
+#define FOLDERWATCHER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
+#include <QList>
+#include <QTimer>
+#include <QFileSystemWatcher>
+#include <QFutureWatcher>
+
+#include "converter.h"
+
+class FolderWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FolderWatcher(Converter *converter,
+                           const Converter::Options &options,
+                           QObject *parent = nullptr);
+    ~FolderWatcher();
+
+    bool addFolder(const QString &folder);
+    QStringList folders() const;
+    void setDoneFolder(const QString &folder);
+    void setFailedFolder(const QString &folder);
+    void setSettleTime(int msec);
+    void setBatchSize(int files);
+
+Q_SIGNALS:
+    void batchFinished(const QList<Converter::Result> &results);
+
+private Q_SLOTS:
+    void folderChanged();
+    void scan();
+    void batchDone();
+
+private:
+    struct Pending
+    {
+        qint64 size = 0;
+        qint64 modified = 0;
+    };
+
+    void startBatch();
+    QString routeFolder(const QString &filename, bool success) const;
+    static QString moveFile(const QString &filename, const QString &folder);
+
+    Converter *_converter;
+    Converter::Options _options;
+    QFileSystemWatcher _watcher;
+    QTimer _timer;
+    int _batchSize;
+    QString _done;
+    QString _failed;
+    QHash<QString, Pending> _pending;
+    QHash<QString, qint64> _ignored;
+    QStringList _queue;
+    QSet<QString> _queued;
+    QFutureWatcher<QList<Converter::Result> > _batch;
+};
+
+#endif // FOLDERWATCHER_H
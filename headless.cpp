@@ -0,0 +1,420 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include "headless.h"
+
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QCoreApplication>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QUrl>
+
+#include <cstring>
+
+#include "filescanner.h"
+#include "folderwatcher.h"
+#include "httpserver.h"
+#include "jobreport.h"
+#include "profileregistry.h"
+
+bool Headless::isRequested(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--headless") == 0 ||
+            std::strcmp(argv[i], "-x") == 0) { return true; }
+    }
+    return false;
+}
+
+bool Headless::parseIntent(const QString &name, Converter::RenderingIntent *intent)
+{
+    QString value = name.toLower();
+    if (value == QString("undefined")) {
+        *intent = Converter::UndefinedRenderingIntent;
+    } else if (value == QString("saturation")) {
+        *intent = Converter::SaturationRenderingIntent;
+    } else if (value == QString("perceptual")) {
+        *intent = Converter::PerceptualRenderingIntent;
+    } else if (value == QString("absolute")) {
+        *intent = Converter::AbsoluteRenderingIntent;
+    } else if (value == QString("relative")) {
+        *intent = Converter::RelativeRenderingIntent;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool Headless::parseTarget(const QString &value, Converter::Target *target)
+{
+    QStringList fields = value.split(QChar(','));
+    target->outputProfile = ProfileRegistry::instance()->load(fields.takeFirst()).data;
+    for (int i = 0; i < fields.size(); ++i) {
+        const QString &field = fields.at(i);
+        if (field == QString("no-bpc")) {
+            target->blackPoint = false;
+        } else if (field == QString("bpc")) {
+            target->blackPoint = true;
+        } else if (field.startsWith(QString("suffix="))) {
+            target->suffix = field.mid(7);
+        } else if (!parseIntent(field, &target->intent)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int Headless::exec(const QStringList &args)
+{
+    QTextStream err(stderr);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QString("Color Converter %1").arg(QCoreApplication::applicationVersion()));
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption headlessOption(QStringList() << "x" << "headless",
+                                      QString("Convert from the command line, without a window."));
+    QCommandLineOption profileOption(QStringList() << "p" << "profile",
+                                     QString("Output ICC profile."), QString("file"));
+    QCommandLineOption intentOption(QStringList() << "i" << "intent",
+                                    QString("Rendering intent: perceptual (default), relative, saturation, absolute or undefined."),
+                                    QString("intent"), QString("perceptual"));
+    QCommandLineOption noBlackPointOption(QStringList() << "no-bpc",
+                                          QString("Disable black point compensation."));
+    QCommandLineOption targetOption(QStringList() << "target",
+                                    QString("Another output written from the same decode, as profile[,intent][,no-bpc][,suffix=name], can be given more than once."),
+                                    QString("target"));
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs",
+                                  QString("Files converted in parallel, default one per core."), QString("n"));
+    QCommandLineOption threadsOption(QStringList() << "t" << "threads",
+                                     QString("Threads used inside one image, by default the cores left to it by the files in flight."), QString("n"));
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+                                    QString("Output directory, default next to each input."), QString("dir"));
+    QCommandLineOption modeOption(QStringList() << "mode",
+                                  QString("Conversion mode: native (default), magick or stream."), QString("mode"), QString("native"));
+    QCommandLineOption lutOption(QStringList() << "lut",
+                                 QString("Use a precomputed 3D LUT for 8-bit RGB input in native and stream mode."));
+    QCommandLineOption analyzeOption(QStringList() << "analyze",
+                                     QString("Measure ink coverage and gamut of every output during the transform, written to the json and csv reports."));
+    QCommandLineOption inkLimitOption(QStringList() << "ink-limit",
+                                      QString("Total ink coverage limit in percent for --analyze, default 300."), QString("percent"));
+    QCommandLineOption pipelineOption(QStringList() << "pipeline",
+                                      QString("Overlap decode, transform and encode of different files."));
+    QCommandLineOption decodeJobsOption(QStringList() << "decode-jobs",
+                                        QString("Decode threads in pipeline mode."), QString("n"));
+    QCommandLineOption transformJobsOption(QStringList() << "transform-jobs",
+                                           QString("Transform threads in pipeline mode."), QString("n"));
+    QCommandLineOption encodeJobsOption(QStringList() << "encode-jobs",
+                                        QString("Encode threads in pipeline mode."), QString("n"));
+    QCommandLineOption queueDepthOption(QStringList() << "queue-depth",
+                                        QString("Images waiting between two pipeline stages, default 2."), QString("n"));
+    QCommandLineOption memoryOption(QStringList() << "memory",
+                                    QString("Memory for images in flight in MiB, default half of the physical memory."), QString("mib"));
+    QCommandLineOption incrementalOption(QStringList() << "incremental",
+                                         QString("Skip files converted before with the same content and settings."));
+    QCommandLineOption manifestOption(QStringList() << "manifest",
+                                      QString("Manifest of earlier conversions used with --incremental."), QString("file"));
+    QCommandLineOption watchOption(QStringList() << "w" << "watch",
+                                   QString("Watch a folder and convert files as they arrive, can be given more than once."), QString("dir"));
+    QCommandLineOption doneOption(QStringList() << "done",
+                                  QString("Folder for converted watch folder inputs, default done/ in the watched folder."), QString("dir"));
+    QCommandLineOption failedOption(QStringList() << "failed",
+                                    QString("Folder for failed watch folder inputs, default failed/ in the watched folder."), QString("dir"));
+    QCommandLineOption settleOption(QStringList() << "settle",
+                                    QString("Milliseconds a watched file must stay unchanged before it is converted, default 1000."), QString("ms"));
+    QCommandLineOption httpOption(QStringList() << "http",
+                                  QString("Convert images posted to http://localhost:port/convert instead of files."), QString("port"));
+    QCommandLineOption profileDirOption(QStringList() << "profile-dir",
+                                        QString("Folder with the profiles http requests can name, can be given more than once, default the system profile folders."),
+                                        QString("dir"));
+    QCommandLineOption reportOption(QStringList() << "r" << "report",
+                                    QString("Write the per-file summary to file instead of stdout."), QString("file"));
+    QCommandLineOption reportFormatOption(QStringList() << "report-format",
+                                          QString("Summary format: text (default), or json and csv with per-stage timings."),
+                                          QString("format"), QString("text"));
+    parser.addOption(headlessOption);
+    parser.addOption(profileOption);
+    parser.addOption(intentOption);
+    parser.addOption(noBlackPointOption);
+    parser.addOption(targetOption);
+    parser.addOption(jobsOption);
+    parser.addOption(threadsOption);
+    parser.addOption(outputOption);
+    parser.addOption(modeOption);
+    parser.addOption(lutOption);
+    parser.addOption(analyzeOption);
+    parser.addOption(inkLimitOption);
+    parser.addOption(pipelineOption);
+    parser.addOption(decodeJobsOption);
+    parser.addOption(transformJobsOption);
+    parser.addOption(encodeJobsOption);
+    parser.addOption(queueDepthOption);
+    parser.addOption(memoryOption);
+    parser.addOption(incrementalOption);
+    parser.addOption(manifestOption);
+    parser.addOption(watchOption);
+    parser.addOption(doneOption);
+    parser.addOption(failedOption);
+    parser.addOption(settleOption);
+    parser.addOption(httpOption);
+    parser.addOption(profileDirOption);
+    parser.addOption(reportOption);
+    parser.addOption(reportFormatOption);
+    parser.addPositionalArgument(QString("files"), QString("Images, or folders to convert all images in."), QString("[files...]"));
+
+    if (!parser.parse(args)) {
+        err << parser.errorText() << '\n';
+        return ExitUsage;
+    }
+    if (parser.isSet(QString("help"))) { parser.showHelp(ExitSuccess); }
+    if (parser.isSet(QString("version"))) { parser.showVersion(); }
+
+    Converter::Options options;
+    if (!parseIntent(parser.value(intentOption), &options.intent)) {
+        err << QString("Unknown rendering intent: %1").arg(parser.value(intentOption)) << '\n';
+        return ExitUsage;
+    }
+    options.blackPoint = !parser.isSet(noBlackPointOption);
+    options.outputDirectory = parser.value(outputOption);
+    if (parser.value(modeOption) == QString("magick")) {
+        options.mode = Converter::MagickConversionMode;
+    } else if (parser.value(modeOption) == QString("stream")) {
+        options.mode = Converter::StreamConversionMode;
+    } else if (parser.value(modeOption) != QString("native")) {
+        err << QString("Unknown conversion mode: %1").arg(parser.value(modeOption)) << '\n';
+        return ExitUsage;
+    }
+    options.lut = parser.isSet(lutOption);
+    options.analyze = parser.isSet(analyzeOption);
+    if (parser.isSet(inkLimitOption)) { options.inkLimit = parser.value(inkLimitOption).toInt(); }
+    if (parser.isSet(threadsOption)) { options.threads = parser.value(threadsOption).toInt(); }
+    options.pipeline = parser.isSet(pipelineOption);
+    if (parser.isSet(decodeJobsOption)) { options.decodeJobs = parser.value(decodeJobsOption).toInt(); }
+    if (parser.isSet(transformJobsOption)) { options.transformJobs = parser.value(transformJobsOption).toInt(); }
+    if (parser.isSet(encodeJobsOption)) { options.encodeJobs = parser.value(encodeJobsOption).toInt(); }
+    if (parser.isSet(queueDepthOption)) { options.queueDepth = parser.value(queueDepthOption).toInt(); }
+    JobReport::Format reportFormat = JobReport::TextFormat;
+    if (!JobReport::parseFormat(parser.value(reportFormatOption), &reportFormat)) {
+        err << QString("Unknown report format: %1").arg(parser.value(reportFormatOption)) << '\n';
+        return ExitUsage;
+    }
+    options.stats = reportFormat != JobReport::TextFormat;
+    options.incremental = parser.isSet(incrementalOption);
+    options.manifest = parser.value(manifestOption);
+    if (parser.isSet(memoryOption)) { options.memoryLimit = parser.value(memoryOption).toLongLong() * 1024 * 1024; }
+
+    // requests to the http service may give their own profile
+    if (!parser.isSet(profileOption) && !parser.isSet(targetOption) && !parser.isSet(httpOption)) {
+        err << QString("No output profile given, see --help.") << '\n';
+        return ExitUsage;
+    }
+    if (parser.isSet(profileOption)) {
+        options.outputProfile = ProfileRegistry::instance()->load(parser.value(profileOption)).data;
+        if (Converter::profileColorspace(options.outputProfile) == Converter::colorSpaceUnknown) {
+            err << QString("Invalid output profile: %1").arg(parser.value(profileOption)) << '\n';
+            return ExitProfile;
+        }
+    }
+
+    // the targets take the intent and black point compensation given for
+    // the profile unless they set their own
+    QStringList targets = parser.values(targetOption);
+    for (int i = 0; i < targets.size(); ++i) {
+        if (i == 0 && parser.isSet(profileOption)) { options.targets = Converter::outputTargets(options); }
+        Converter::Target target;
+        target.intent = options.intent;
+        target.blackPoint = options.blackPoint;
+        if (!parseTarget(targets.at(i), &target)) {
+            err << QString("Invalid target: %1").arg(targets.at(i)) << '\n';
+            return ExitUsage;
+        }
+        if (Converter::profileColorspace(target.outputProfile) == Converter::colorSpaceUnknown) {
+            err << QString("Invalid output profile: %1").arg(targets.at(i).section(QChar(','), 0, 0)) << '\n';
+            return ExitProfile;
+        }
+        options.targets.append(target);
+    }
+
+    if (parser.isSet(httpOption)) {
+        bool ok = false;
+        const int port = parser.value(httpOption).toInt(&ok);
+        if (!ok || port < 0 || port > 65535) {
+            err << QString("Invalid port: %1").arg(parser.value(httpOption)) << '\n';
+            return ExitUsage;
+        }
+        return serve(static_cast<quint16>(port),
+                     parser.isSet(jobsOption) ? parser.value(jobsOption).toInt() : 0,
+                     parser.values(profileDirOption),
+                     options,
+                     parser.value(reportOption),
+                     reportFormat);
+    }
+    if (parser.isSet(watchOption)) {
+        return watch(parser.values(watchOption),
+                     parser.value(doneOption),
+                     parser.value(failedOption),
+                     parser.isSet(settleOption) ? parser.value(settleOption).toInt() : 1000,
+                     parser.isSet(jobsOption) ? parser.value(jobsOption).toInt() : 0,
+                     options,
+                     parser.value(reportOption),
+                     reportFormat);
+    }
+
+    QList<QUrl> urls;
+    QList<Converter::Result> results;
+    QStringList rejected;
+    QStringList paths = parser.positionalArguments();
+    for (int i = 0; i < paths.size(); ++i) {
+        if (QFileInfo::exists(paths.at(i))) { continue; }
+        Converter::Result result;
+        result.filename = paths.at(i);
+        result.error = QString("No such file or directory");
+        results.append(result);
+    }
+    QStringList files = FileScanner::collect(paths, &rejected);
+    for (int i = 0; i < rejected.size(); ++i) {
+        Converter::Result result;
+        result.filename = rejected.at(i);
+        result.error = QString("Not a supported image");
+        results.append(result);
+    }
+    for (int i = 0; i < files.size(); ++i) {
+        urls.append(QUrl::fromLocalFile(files.at(i)));
+    }
+    if (urls.isEmpty() && results.isEmpty()) {
+        err << QString("No input files given, see --help.") << '\n';
+        return ExitNoInput;
+    }
+
+    Converter converter;
+    if (parser.isSet(jobsOption)) { converter.setMaxJobs(parser.value(jobsOption).toInt()); }
+    JobReport jobReport;
+    jobReport.start();
+    results.append(converter.convertUrls(urls, options));
+    jobReport.finish(results);
+
+    QFile reportFile;
+    if (!openReport(&reportFile, parser.value(reportOption), QIODevice::Truncate)) {
+        err << QString("Unable to write report: %1").arg(parser.value(reportOption)) << '\n';
+        return ExitUsage;
+    }
+    reportFile.write(jobReport.format(reportFormat));
+    reportFile.flush();
+
+    int failed = 0;
+    for (int i = 0; i < results.size(); ++i) {
+        if (!results.at(i).success) { failed++; }
+    }
+
+    return failed > 0 ? ExitFailed : ExitSuccess;
+}
+
+bool Headless::openReport(QFile *file,
+                          const QString &filename,
+                          QIODevice::OpenMode mode)
+{
+    if (filename.isEmpty()) { return file->open(stdout, QIODevice::WriteOnly | QIODevice::Text); }
+    file->setFileName(filename);
+    return file->open(QIODevice::WriteOnly | QIODevice::Text | mode);
+}
+
+int Headless::watch(const QStringList &folders,
+                    const QString &done,
+                    const QString &failed,
+                    int settle,
+                    int jobs,
+                    const Converter::Options &options,
+                    const QString &report,
+                    JobReport::Format reportFormat)
+{
+    QTextStream err(stderr);
+
+    // the report gets one entry per batch and is never truncated, the
+    // service may be restarted against the same file
+    QFile reportFile;
+    if (!openReport(&reportFile, report, QIODevice::Append)) {
+        err << QString("Unable to write report: %1").arg(report) << '\n';
+        return ExitUsage;
+    }
+
+    Converter converter;
+    if (jobs > 0) { converter.setMaxJobs(jobs); }
+    FolderWatcher watcher(&converter, options);
+    watcher.setDoneFolder(done);
+    watcher.setFailedFolder(failed);
+    watcher.setSettleTime(settle);
+    for (int i = 0; i < folders.size(); ++i) {
+        if (!watcher.addFolder(folders.at(i))) {
+            err << QString("Unable to watch folder: %1").arg(folders.at(i)) << '\n';
+            return ExitUsage;
+        }
+    }
+
+    JobReport jobReport;
+    jobReport.start();
+    QObject::connect(&watcher, &FolderWatcher::batchFinished,
+                     [&](const QList<Converter::Result> &results) {
+        jobReport.finish(results);
+        reportFile.write(jobReport.format(reportFormat));
+        reportFile.flush();
+        jobReport.start();
+    });
+    return QCoreApplication::exec();
+}
+
+int Headless::serve(quint16 port,
+                    int jobs,
+                    const QStringList &profileFolders,
+                    const Converter::Options &options,
+                    const QString &report,
+                    JobReport::Format reportFormat)
+{
+    QTextStream err(stderr);
+
+    QFile reportFile;
+    if (!openReport(&reportFile, report, QIODevice::Append)) {
+        err << QString("Unable to write report: %1").arg(report) << '\n';
+        return ExitUsage;
+    }
+
+    // only reachable from this machine
+    Converter converter;
+    HttpServer server(&converter, options);
+    server.setMaxJobs(jobs);
+    if (!profileFolders.isEmpty()) { server.setProfileFolders(profileFolders); }
+    if (!server.listen(port)) {
+        err << QString("Unable to listen on port %1: %2").arg(port).arg(server.errorString()) << '\n';
+        return ExitUsage;
+    }
+    err << QString("Listening on http://localhost:%1/convert").arg(server.port()) << '\n';
+    err.flush();
+
+    JobReport jobReport;
+    jobReport.start();
+    QObject::connect(&server, &HttpServer::requestFinished,
+                     [&](const Converter::Result &result) {
+        jobReport.finish(QList<Converter::Result>() << result);
+        reportFile.write(jobReport.format(reportFormat));
+        reportFile.flush();
+        jobReport.start();
+    });
+    return QCoreApplication::exec();
+}
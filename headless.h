@@ -0,0 +1,66 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <QStringList>
+#include <QFile>
+
+#include "converter.h"
+#include "jobreport.h"
+
+class Headless
+{
+public:
+
+    enum ExitCode {
+        ExitSuccess = 0,
+        ExitFailed = 1,
+        ExitUsage = 2,
+        ExitProfile = 3,
+        ExitNoInput = 4
+    };
+
+    static bool isRequested(int argc, char *argv[]);
+    static int exec(const QStringList &args);
+    static bool parseIntent(const QString &name, Converter::RenderingIntent *intent);
+    static bool parseTarget(const QString &value, Converter::Target *target);
+
+private:
+    static bool openReport(QFile *file,
+                           const QString &filename,
+                           QIODevice::OpenMode mode);
+    static int watch(const QStringList &folders,
+                     const QString &done,
+                     const QString &failed,
+                     int settle,
+                     int jobs,
+                     const Converter::Options &options,
+                     const QString &report,
+                     JobReport::Format reportFormat);
+    static int serve(quint16 port,
+                     int jobs,
+                     const QStringList &profileFolders,
+                     const Converter::Options &options,
+                     const QString &report,
+                     JobReport::Format reportFormat);
+};
+
+#endif // HEADLESS_H
@@ -0,0 +1,520 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#include "httpserver.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QPointer>
+#include <QThread>
+#include <QTimer>
+#include <QUrl>
+#include <QFutureWatcher>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include "filescanner.h"
+#include "headless.h"
+#include "jobreport.h"
+#include "profileregistry.h"
+#include "profilecatalog.h"
+
+#define HTTP_MAX_HEADER 65536
+#define HTTP_MAX_BODY 128
+#define HTTP_KEEP_ALIVE 30000
+
+static bool parseSwitch(const QString &value, bool *enabled)
+{
+    const QString name = value.toLower();
+    if (name == QString("1") || name == QString("true") || name == QString("on")) {
+        *enabled = true;
+    } else if (name == QString("0") || name == QString("false") || name == QString("off")) {
+        *enabled = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+HttpServer::HttpServer(Converter *converter,
+                       const Converter::Options &options,
+                       QObject *parent)
+    : QObject(parent)
+    , _converter(converter)
+    , _options(options)
+    , _pending(0)
+    , _maxBody(static_cast<qint64>(HTTP_MAX_BODY) * 1024 * 1024)
+    , _keepAlive(HTTP_KEEP_ALIVE)
+    , _profileFolders(ProfileCatalog::folders())
+{
+    setMaxJobs(0);
+    connect(&_server, SIGNAL(newConnection()), this, SLOT(handleConnection()));
+}
+
+HttpServer::~HttpServer()
+{
+    _server.close();
+    QHashIterator<QTcpSocket*, Connection> connection(_connections);
+    while (connection.hasNext()) {
+        connection.next();
+        if (connection.value().cancel) { connection.value().cancel->storeRelease(1); }
+    }
+    _pool.waitForDone();
+}
+
+bool HttpServer::listen(quint16 port,
+                        const QHostAddress &address)
+{
+    return _server.listen(address, port);
+}
+
+quint16 HttpServer::port() const
+{
+    return _server.serverPort();
+}
+
+QString HttpServer::errorString() const
+{
+    return _server.errorString();
+}
+
+void HttpServer::setMaxJobs(int jobs)
+{
+    // requests beyond the workers wait in a short queue, the rest are
+    // turned away instead of piling up uploads in memory
+    if (jobs < 1) { jobs = QThread::idealThreadCount(); }
+    _pool.setMaxThreadCount(jobs);
+    _maxPending = jobs * 4;
+}
+
+void HttpServer::setMaxPending(int requests)
+{
+    _maxPending = qMax(1, requests);
+}
+
+void HttpServer::setMaxBody(qint64 bytes)
+{
+    _maxBody = bytes;
+}
+
+void HttpServer::setKeepAlive(int msec)
+{
+    _keepAlive = msec;
+}
+
+void HttpServer::setProfileFolders(const QStringList &folders)
+{
+    _profileFolders = folders;
+}
+
+void HttpServer::handleConnection()
+{
+    while (_server.hasPendingConnections()) {
+        QTcpSocket *socket = _server.nextPendingConnection();
+        Connection &connection = _connections[socket];
+        connection.idle = new QTimer(socket);
+        connection.idle->setSingleShot(true);
+        connection.idle->setInterval(_keepAlive);
+        connect(connection.idle, SIGNAL(timeout()), socket, SLOT(close()));
+        connect(socket, SIGNAL(readyRead()), this, SLOT(handleRead()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(handleDisconnect()));
+        connection.idle->start();
+    }
+}
+
+void HttpServer::handleRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket || !_connections.contains(socket)) { return; }
+
+    // the rest of an upload that was turned away is dropped
+    if (socket->state() != QAbstractSocket::ConnectedState) {
+        socket->readAll();
+        return;
+    }
+    _connections[socket].buffer.append(socket->readAll());
+    processRequest(socket);
+}
+
+void HttpServer::handleDisconnect()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket) { return; }
+
+    // a conversion still running for the client stops between bands
+    Connection connection = _connections.take(socket);
+    if (connection.cancel) { connection.cancel->storeRelease(1); }
+    if (connection.admitted) { _pending--; }
+    socket->deleteLater();
+}
+
+void HttpServer::processRequest(QTcpSocket *socket)
+{
+    // requests on one connection are answered in order, one at a time
+    while (_connections.contains(socket) && !_connections[socket].busy) {
+        Request request;
+        Connection &connection = _connections[socket];
+        const int status = readRequest(connection, socket, &request);
+
+        // a slow upload is given the keep alive time between reads, not
+        // for the whole body
+        if (status == 0) {
+            connection.idle->start();
+            return;
+        }
+        connection.idle->stop();
+        if (status != 200) {
+            // only requests turned away by route or load keep the connection,
+            // malformed ones close it
+            const bool keepAlive = !request.error.isEmpty() && request.keepAlive;
+            sendError(socket, status, request.error, keepAlive);
+            if (!keepAlive) { return; }
+            continue;
+        }
+
+        // the slot taken when the headers came in now belongs to the request
+        connection.admitted = false;
+        if (FileScanner::sniff(request.body.left(8)) == FileScanner::UnknownFormat) {
+            _pending--;
+            sendError(socket, 415, QString("Not a supported image"), request.keepAlive);
+        } else {
+            startConversion(socket, request);
+        }
+        if (!request.keepAlive) { return; }
+    }
+}
+
+int HttpServer::readRequest(Connection &connection,
+                            QTcpSocket *socket,
+                            Request *request)
+{
+    const int end = connection.buffer.indexOf("\r\n\r\n");
+    if (end < 0) { return connection.buffer.size() > HTTP_MAX_HEADER ? 431 : 0; }
+
+    QList<QByteArray> lines = connection.buffer.left(end).split('\n');
+    QList<QByteArray> line = lines.at(0).trimmed().split(' ');
+    if (line.size() != 3 || !line.at(2).startsWith("HTTP/1.")) { return 400; }
+    QUrl url(QString::fromLatin1(line.at(1)));
+    request->method = line.at(0);
+    request->path = url.path().toUtf8();
+    request->query = QUrlQuery(url);
+    for (int i = 1; i < lines.size(); ++i) {
+        const int colon = lines.at(i).indexOf(':');
+        if (colon <= 0) { return 400; }
+        request->headers.insert(lines.at(i).left(colon).trimmed().toLower(), lines.at(i).mid(colon + 1).trimmed());
+    }
+    const QByteArray keepAlive = request->headers.value("connection").toLower();
+    if (line.at(2) == QByteArray("HTTP/1.0")) {
+        request->keepAlive = keepAlive == QByteArray("keep-alive");
+    } else {
+        request->keepAlive = keepAlive != QByteArray("close");
+    }
+
+    // bodies need a length, chunked uploads are not supported
+    if (request->headers.contains("transfer-encoding")) { return 501; }
+    qint64 length = 0;
+    if (request->headers.contains("content-length")) {
+        bool ok = false;
+        length = request->headers.value("content-length").toLongLong(&ok);
+        if (!ok || length < 0) { return 400; }
+    }
+    if (length > _maxBody) { return 413; }
+    const qint64 size = end + 4 + length;
+    const bool complete = connection.buffer.size() >= size;
+
+    // requests are routed and admitted as soon as their headers are in,
+    // so an upload that is turned away is never buffered
+    if (!connection.admitted) {
+        int status = 0;
+        if (request->path != QByteArray("/convert")) {
+            status = 404;
+            request->error = QString("Unknown path, images are converted with POST /convert");
+        } else if (request->method != QByteArray("POST")) {
+            status = 405;
+            request->error = QString("Images are converted with POST /convert");
+        } else if (_pending >= _maxPending) {
+            status = 503;
+            request->error = QString("Too many requests");
+        }
+        if (status != 0) {
+            // the rest of a body that has not arrived is not waited for,
+            // the connection is closed after the answer instead
+            if (complete) {
+                connection.buffer.remove(0, static_cast<int>(size));
+            } else {
+                connection.buffer.clear();
+                request->keepAlive = false;
+            }
+            return status;
+        }
+        _pending++;
+        connection.admitted = true;
+    }
+    if (!complete) {
+        connection.buffer.reserve(static_cast<int>(size));
+
+        // curl holds back large bodies until it is told to go on
+        if (!connection.continued && request->headers.value("expect").toLower() == QByteArray("100-continue")) {
+            socket->write("HTTP/1.1 100 Continue\r\n\r\n");
+            connection.continued = true;
+        }
+        return 0;
+    }
+    request->body = connection.buffer.mid(end + 4, static_cast<int>(length));
+    connection.buffer.remove(0, static_cast<int>(size));
+    connection.continued = false;
+    return 200;
+}
+
+void HttpServer::startConversion(QTcpSocket *socket,
+                                 const Request &request)
+{
+    Converter::Options options;
+    QString error;
+    if (!conversionOptions(request, &options, &error)) {
+        _pending--;
+        sendError(socket, 400, error, request.keepAlive);
+        return;
+    }
+    Connection &connection = _connections[socket];
+    connection.busy = true;
+    connection.cancel = std::make_shared<QAtomicInt>(0);
+    options.cancel = connection.cancel;
+
+    QPointer<QTcpSocket> client(socket);
+    const bool keepAlive = request.keepAlive;
+    QFutureWatcher<Reply> *watcher = new QFutureWatcher<Reply>(this);
+    connect(watcher, &QFutureWatcher<Reply>::finished, this, [this, watcher, client, keepAlive]() {
+        const Reply reply = watcher->result();
+        watcher->deleteLater();
+        _pending--;
+        if (reply.converted) { Q_EMIT requestFinished(reply.result); }
+        if (!client || !_connections.contains(client)) { return; }
+        _connections[client].busy = false;
+        _connections[client].cancel.reset();
+        sendReply(client, reply, keepAlive);
+        if (keepAlive) { processRequest(client); }
+    });
+
+    // the upload is handed to the worker as is, it is never written to disk
+    QElapsedTimer queued;
+    queued.start();
+    Converter *converter = _converter;
+    const QByteArray body = request.body;
+    watcher->setFuture(QtConcurrent::run(&_pool, [converter, options, body, queued]() {
+        return convert(converter, options, body, queued.nsecsElapsed());
+    }));
+}
+
+QString HttpServer::profilePath(const QString &name) const
+{
+    // clients name a profile in the profile folders, they never give a
+    // path, so nothing else on the disk can be read or mapped through
+    // the registry
+    if (name.isEmpty() ||
+        name.contains(QChar('/')) ||
+        name.contains(QChar('\\')) ||
+        name.contains(QChar(':')) ||
+        name.startsWith(QChar('.'))) { return QString(); }
+    for (int i = 0; i < _profileFolders.size(); ++i) {
+        QFileInfo info(QDir(_profileFolders.at(i)).filePath(name));
+        if (info.isFile()) { return info.absoluteFilePath(); }
+    }
+    return QString();
+}
+
+bool HttpServer::conversionOptions(const Request &request,
+                                   Converter::Options *options,
+                                   QString *error) const
+{
+    // the command line gives the defaults, every request may pick its own
+    // profile, intent, black point compensation and format
+    *options = _options;
+    options->stats = true;
+    options->progress = nullptr;
+    Converter::Target target = Converter::outputTargets(_options).first();
+    const QUrlQuery &query = request.query;
+    if (query.hasQueryItem(QString("profile"))) {
+        const QString name = query.queryItemValue(QString("profile"), QUrl::FullyDecoded);
+        const QString filename = profilePath(name);
+        if (!filename.isEmpty()) { target.outputProfile = ProfileRegistry::instance()->load(filename).data; }
+        target.suffix.clear();
+        if (filename.isEmpty() || Converter::profileColorspace(target.outputProfile) == Converter::colorSpaceUnknown) {
+            *error = QString("Unknown output profile: %1").arg(name);
+            return false;
+        }
+    }
+    if (target.outputProfile.isEmpty()) {
+        *error = QString("No output profile given");
+        return false;
+    }
+    if (query.hasQueryItem(QString("intent"))) {
+        const QString intent = query.queryItemValue(QString("intent"));
+        if (!Headless::parseIntent(intent, &target.intent)) {
+            *error = QString("Unknown rendering intent: %1").arg(intent);
+            return false;
+        }
+    }
+    if (query.hasQueryItem(QString("bpc")) &&
+        !parseSwitch(query.queryItemValue(QString("bpc")), &target.blackPoint)) {
+        *error = QString("Invalid black point compensation: %1").arg(query.queryItemValue(QString("bpc")));
+        return false;
+    }
+    if (query.hasQueryItem(QString("analyze")) &&
+        !parseSwitch(query.queryItemValue(QString("analyze")), &options->analyze)) {
+        *error = QString("Invalid analyze: %1").arg(query.queryItemValue(QString("analyze")));
+        return false;
+    }
+    if (query.hasQueryItem(QString("format"))) {
+        const QString format = query.queryItemValue(QString("format")).toLower();
+        if (format == QString("jpeg") || format == QString("jpg")) {
+            options->format = QString("JPEG");
+        } else if (format == QString("png")) {
+            options->format = QString("PNG");
+        } else if (format == QString("tiff") || format == QString("tif")) {
+            options->format = QString("TIFF");
+        } else {
+            *error = QString("Unknown format: %1").arg(format);
+            return false;
+        }
+    }
+    options->targets = QList<Converter::Target>() << target;
+    return true;
+}
+
+HttpServer::Reply HttpServer::convert(Converter *converter,
+                                      const Converter::Options &options,
+                                      const QByteArray &body,
+                                      qint64 queued)
+{
+    Reply reply;
+    reply.result = converter->convertData(body, options).first();
+    reply.converted = true;
+    const Converter::Result &result = reply.result;
+    if (!result.success) {
+        reply.status = 422;
+        reply.headers.append(qMakePair(QByteArray("Content-Type"), QByteArray("text/plain; charset=utf-8")));
+        reply.body = result.error.toUtf8() + '\n';
+    } else {
+        reply.headers.append(qMakePair(QByteArray("Content-Type"), contentType(result.data)));
+        reply.body = result.data;
+    }
+
+    // the time waiting for a worker, then every stage in milliseconds
+    QStringList timing;
+    timing << QString("queue;dur=%1").arg(queued / 1000000.0, 0, 'f', 2);
+    for (int stage = 0; stage < Converter::StageCount; ++stage) {
+        if (result.stats.stages[stage] == 0) { continue; }
+        timing << QString("%1;dur=%2").arg(JobReport::stageName(stage)).arg(result.stats.stages[stage] / 1000000.0, 0, 'f', 2);
+    }
+    timing << QString("total;dur=%1").arg(result.stats.total / 1000000.0, 0, 'f', 2);
+    reply.headers.append(qMakePair(QByteArray("Server-Timing"), timing.join(QString(", ")).toLatin1()));
+    reply.headers.append(qMakePair(QByteArray("X-Transform-Cached"), QByteArray(result.stats.cached ? "1" : "0")));
+    if (result.stats.inkMax >= 0) {
+        reply.headers.append(qMakePair(QByteArray("X-Ink-Max"), QByteArray::number(result.stats.inkMax)));
+        reply.headers.append(qMakePair(QByteArray("X-Ink-Over"), QByteArray::number(result.stats.inkOver)));
+    }
+    if (result.stats.gamutChecked > 0) {
+        reply.headers.append(qMakePair(QByteArray("X-Gamut-Out"),
+                                       QByteArray::number(100.0 * result.stats.gamutOut / result.stats.gamutChecked, 'f', 2)));
+    }
+    return reply;
+}
+
+void HttpServer::sendReply(QTcpSocket *socket,
+                           const Reply &reply,
+                           bool keepAlive)
+{
+    QByteArray header = "HTTP/1.1 " + QByteArray::number(reply.status) + ' ' + statusText(reply.status) + "\r\n";
+    for (int i = 0; i < reply.headers.size(); ++i) {
+        header += reply.headers.at(i).first + ": " + reply.headers.at(i).second + "\r\n";
+    }
+    header += "Content-Length: " + QByteArray::number(reply.body.size()) + "\r\n";
+    if (keepAlive) {
+        header += "Connection: keep-alive\r\n";
+        header += "Keep-Alive: timeout=" + QByteArray::number(_keepAlive / 1000) + "\r\n";
+    } else {
+        header += "Connection: close\r\n";
+    }
+    header += "\r\n";
+    socket->write(header);
+    socket->write(reply.body);
+    if (!keepAlive) {
+        socket->disconnectFromHost();
+        return;
+    }
+    if (_connections.contains(socket)) { _connections[socket].idle->start(); }
+}
+
+void HttpServer::sendError(QTcpSocket *socket,
+                           int status,
+                           const QString &message,
+                           bool keepAlive)
+{
+    Reply reply;
+    reply.status = status;
+    reply.headers.append(qMakePair(QByteArray("Content-Type"), QByteArray("text/plain; charset=utf-8")));
+    if (status == 405) { reply.headers.append(qMakePair(QByteArray("Allow"), QByteArray("POST"))); }
+    if (status == 503) { reply.headers.append(qMakePair(QByteArray("Retry-After"), QByteArray("1"))); }
+    reply.body = (message.isEmpty() ? QString::fromLatin1(statusText(status)) : message).toUtf8() + '\n';
+    sendReply(socket, reply, keepAlive);
+}
+
+QByteArray HttpServer::statusText(int status)
+{
+    switch (status) {
+    case 200:
+        return QByteArray("OK");
+    case 400:
+        return QByteArray("Bad Request");
+    case 404:
+        return QByteArray("Not Found");
+    case 405:
+        return QByteArray("Method Not Allowed");
+    case 413:
+        return QByteArray("Payload Too Large");
+    case 415:
+        return QByteArray("Unsupported Media Type");
+    case 422:
+        return QByteArray("Unprocessable Entity");
+    case 431:
+        return QByteArray("Request Header Fields Too Large");
+    case 501:
+        return QByteArray("Not Implemented");
+    case 503:
+        return QByteArray("Service Unavailable");
+    default:;
+    }
+    return QByteArray("Error");
+}
+
+QByteArray HttpServer::contentType(const QByteArray &data)
+{
+    switch (FileScanner::sniff(data.left(8))) {
+    case FileScanner::JpegFormat:
+        return QByteArray("image/jpeg");
+    case FileScanner::PngFormat:
+        return QByteArray("image/png");
+    case FileScanner::TiffFormat:
+        return QByteArray("image/tiff");
+    default:;
+    }
+    return QByteArray("application/octet-stream");
+}
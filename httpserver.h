@@ -0,0 +1,137 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#ifndef HTTPSERVER_H
+#define HTTPSERVER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QUrlQuery>
+#include <QElapsedTimer>
+
+#include <memory>
+
+#include "converter.h"
+
+class QTimer;
+
+class HttpServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit HttpServer(Converter *converter,
+                        const Converter::Options &options,
+                        QObject *parent = nullptr);
+    ~HttpServer();
+
+    bool listen(quint16 port,
+                const QHostAddress &address = QHostAddress::LocalHost);
+    quint16 port() const;
+    QString errorString() const;
+    void setMaxJobs(int jobs);
+    void setMaxPending(int requests);
+    void setMaxBody(qint64 bytes);
+    void setKeepAlive(int msec);
+    void setProfileFolders(const QStringList &folders);
+
+Q_SIGNALS:
+    void requestFinished(const Converter::Result &result);
+
+private Q_SLOTS:
+    void handleConnection();
+    void handleRead();
+    void handleDisconnect();
+
+private:
+    struct Connection
+    {
+        QByteArray buffer;
+        bool busy = false;
+        bool admitted = false;
+        bool continued = false;
+        QTimer *idle = nullptr;
+        std::shared_ptr<QAtomicInt> cancel;
+    };
+    struct Request
+    {
+        QByteArray method;
+        QByteArray path;
+        QUrlQuery query;
+        QHash<QByteArray, QByteArray> headers;
+        QByteArray body;
+        bool keepAlive = true;
+        QString error;
+    };
+    struct Reply
+    {
+        int status = 200;
+        QList<QPair<QByteArray, QByteArray> > headers;
+        QByteArray body;
+        Converter::Result result;
+        bool converted = false;
+    };
+
+    void processRequest(QTcpSocket *socket);
+    int readRequest(Connection &connection,
+                    QTcpSocket *socket,
+                    Request *request);
+    void startConversion(QTcpSocket *socket,
+                         const Request &request);
+    QString profilePath(const QString &name) const;
+    bool conversionOptions(const Request &request,
+                           Converter::Options *options,
+                           QString *error) const;
+    static Reply convert(Converter *converter,
+                         const Converter::Options &options,
+                         const QByteArray &body,
+                         qint64 queued);
+    void sendReply(QTcpSocket *socket,
+                   const Reply &reply,
+                   bool keepAlive);
+    void sendError(QTcpSocket *socket,
+                   int status,
+                   const QString &message,
+                   bool keepAlive);
+    static QByteArray statusText(int status);
+    static QByteArray contentType(const QByteArray &data);
+
+    Converter *_converter;
+    Converter::Options _options;
+    QTcpServer _server;
+    QThreadPool _pool;
+    QHash<QTcpSocket*, Connection> _connections;
+    int _pending;
+    int _maxPending;
+    qint64 _maxBody;
+    int _keepAlive;
+    QStringList _profileFolders;
+};
+
+#endif // HTTPSERVER_H
@@ -0,0 +1,221 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#include "inkcoverage.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define INK_SIMD
+#include <immintrin.h>
+#endif
+
+// four tables of counts, one per lane, so runs of equal coverage do not
+// wait on the same counter
+#define INK_TABLES 4
+
+// pixels counted before the tables are folded into the levels, well
+// below what a 32-bit counter holds
+#define INK_FLUSH Q_INT64_C(1073741824)
+
+static void addScalar(quint32 *counts,
+                      const unsigned char *pixels,
+                      size_t count,
+                      int channels)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned char *pixel = pixels + i * static_cast<size_t>(channels);
+        counts[(i % INK_TABLES) * InkCoverage::Levels + pixel[0] + pixel[1] + pixel[2] + pixel[3]]++;
+    }
+}
+
+static void addScalar16(quint32 *counts,
+                        const quint16 *pixels,
+                        size_t count,
+                        int channels)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const quint16 *pixel = pixels + i * static_cast<size_t>(channels);
+        const quint32 sum = static_cast<quint32>(pixel[0]) + pixel[1] + pixel[2] + pixel[3];
+        counts[(i % INK_TABLES) * InkCoverage::Levels + (sum + 128) / 257]++;
+    }
+}
+
+#ifdef INK_SIMD
+// the four inks of four pixels are summed with two multiply-adds
+__attribute__((target("sse4.1")))
+static void addSse41(quint32 *counts,
+                     const unsigned char *pixels,
+                     size_t count)
+{
+    const __m128i bytes = _mm_set1_epi8(1);
+    const __m128i words = _mm_set1_epi16(1);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i pixel = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i * 4));
+        const __m128i sums = _mm_madd_epi16(_mm_maddubs_epi16(pixel, bytes), words);
+        counts[_mm_cvtsi128_si32(sums)]++;
+        counts[InkCoverage::Levels + _mm_extract_epi32(sums, 1)]++;
+        counts[2 * InkCoverage::Levels + _mm_extract_epi32(sums, 2)]++;
+        counts[3 * InkCoverage::Levels + _mm_extract_epi32(sums, 3)]++;
+    }
+    if (i < count) { addScalar(counts, pixels + i * 4, count - i, 4); }
+}
+
+__attribute__((target("avx2")))
+static void addAvx2(quint32 *counts,
+                    const unsigned char *pixels,
+                    size_t count)
+{
+    const __m256i bytes = _mm256_set1_epi8(1);
+    const __m256i words = _mm256_set1_epi16(1);
+    alignas(32) qint32 sums[8];
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i pixel = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + i * 4));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(sums), _mm256_madd_epi16(_mm256_maddubs_epi16(pixel, bytes), words));
+        for (int lane = 0; lane < 8; ++lane) {
+            counts[(lane % INK_TABLES) * InkCoverage::Levels + sums[lane]]++;
+        }
+    }
+    if (i < count) { addScalar(counts, pixels + i * 4, count - i, 4); }
+}
+
+enum InkKernel {
+    ScalarInkKernel,
+    Sse41InkKernel,
+    Avx2InkKernel
+};
+
+static InkKernel inkKernel()
+{
+    static const InkKernel kernel = []() -> InkKernel {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) { return Avx2InkKernel; }
+        if (__builtin_cpu_supports("sse4.1")) { return Sse41InkKernel; }
+        return ScalarInkKernel;
+    }();
+    return kernel;
+}
+#endif
+
+InkCoverage::InkCoverage()
+    : _levels(Levels, 0)
+    , _pending(0)
+{
+}
+
+void InkCoverage::add(const unsigned char *pixels,
+                      size_t count,
+                      int channels,
+                      int bytes)
+{
+    // the tables stay from one band to the next and are only added up
+    // when the result is read
+    if (_pending + static_cast<qint64>(count) > INK_FLUSH) { flush(); }
+    if (_counts.empty()) { _counts.assign(INK_TABLES * Levels, 0); }
+    _pending += static_cast<qint64>(count);
+    std::vector<quint32> &counts = _counts;
+    if (bytes == 2) {
+        addScalar16(counts.data(), reinterpret_cast<const quint16*>(pixels), count, channels);
+    } else if (channels != 4) {
+        addScalar(counts.data(), pixels, count, channels);
+    } else {
+#ifdef INK_SIMD
+        switch (inkKernel()) {
+        case Avx2InkKernel:
+            addAvx2(counts.data(), pixels, count);
+            break;
+        case Sse41InkKernel:
+            addSse41(counts.data(), pixels, count);
+            break;
+        default:
+            addScalar(counts.data(), pixels, count, channels);
+        }
+#else
+        addScalar(counts.data(), pixels, count, channels);
+#endif
+    }
+}
+
+void InkCoverage::merge(const InkCoverage &other)
+{
+    other.flush();
+    for (size_t level = 0; level < _levels.size(); ++level) {
+        _levels[level] += other._levels.at(level);
+    }
+}
+
+qint64 InkCoverage::pixels() const
+{
+    flush();
+    qint64 total = 0;
+    for (size_t level = 0; level < _levels.size(); ++level) {
+        total += _levels.at(level);
+    }
+    return total;
+}
+
+// highest coverage in percent, -1 when nothing was measured
+int InkCoverage::maximum() const
+{
+    flush();
+    for (int level = Levels - 1; level >= 0; --level) {
+        if (_levels.at(static_cast<size_t>(level)) > 0) { return (level * 100 + 127) / 255; }
+    }
+    return -1;
+}
+
+// pixels with more than limit percent of ink
+qint64 InkCoverage::over(int limit) const
+{
+    flush();
+    qint64 total = 0;
+    for (int level = (limit * 255) / 100 + 1; level < Levels; ++level) {
+        if (level < 0) { continue; }
+        total += _levels.at(static_cast<size_t>(level));
+    }
+    return total;
+}
+
+// pixels per 10% of coverage, the last bin holds everything above
+void InkCoverage::histogram(qint64 *bins,
+                            int count) const
+{
+    flush();
+    std::memset(bins, 0, sizeof(qint64) * static_cast<size_t>(count));
+    for (int level = 0; level < Levels; ++level) {
+        const int bin = qMin(count - 1, (level * 100 / 255) / 10);
+        bins[bin] += _levels.at(static_cast<size_t>(level));
+    }
+}
+
+void InkCoverage::flush() const
+{
+    if (_pending == 0) { return; }
+    for (int table = 0; table < INK_TABLES; ++table) {
+        for (int level = 0; level < Levels; ++level) {
+            _levels[static_cast<size_t>(level)] += _counts[static_cast<size_t>(table * Levels + level)];
+        }
+    }
+    std::fill(_counts.begin(), _counts.end(), 0);
+    _pending = 0;
+}
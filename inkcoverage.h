@@ -0,0 +1,60 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#ifndef INKCOVERAGE_H
+#define INKCOVERAGE_H
+
+#include <QtGlobal>
+
+#include <vector>
+
+// total area coverage of CMYK pixels, counted per 8-bit coverage level
+// (0 to 4 x 255) so bands can be measured apart and merged afterwards,
+// one instance per thread is meant to take all the bands of that thread
+class InkCoverage
+{
+public:
+    enum {
+        Levels = 4 * 255 + 1
+    };
+
+    InkCoverage();
+
+    void add(const unsigned char *pixels,
+             size_t count,
+             int channels,
+             int bytes);
+    void merge(const InkCoverage &other);
+
+    qint64 pixels() const;
+    int maximum() const;
+    qint64 over(int limit) const;
+    void histogram(qint64 *bins,
+                   int count) const;
+
+private:
+    void flush() const;
+
+    mutable std::vector<qint64> _levels;
+    mutable std::vector<quint32> _counts;
+    mutable qint64 _pending;
+};
+
+#endif // INKCOVERAGE_H
@@ -0,0 +1,351 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include "jobreport.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+
+#include "transformcache.h"
+#include "executionbudget.h"
+#include "bufferpool.h"
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+static double milliseconds(qint64 nsecs)
+{
+    return static_cast<double>(nsecs) / 1000000.0;
+}
+
+static QString status(const Converter::Result &result)
+{
+    if (result.skipped) { return QString("skipped"); }
+    if (result.cancelled) { return QString("cancelled"); }
+    return QString(result.success ? "ok" : "failed");
+}
+
+static qint64 inkPixels(const Converter::Stats &stats)
+{
+    qint64 pixels = 0;
+    for (int bin = 0; bin < Converter::InkBins; ++bin) {
+        pixels += stats.inkHistogram[bin];
+    }
+    return pixels;
+}
+
+static double percent(qint64 part, qint64 whole)
+{
+    return whole > 0 ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 0.0;
+}
+
+static QString csvField(const QString &value)
+{
+    if (!value.contains(',') && !value.contains('"') && !value.contains('\n')) { return value; }
+    QString escaped = value;
+    escaped.replace(QString("\""), QString("\"\""));
+    return QString("\"%1\"").arg(escaped);
+}
+
+JobReport::JobReport()
+    : _elapsed(0)
+    , _hits(0)
+    , _misses(0)
+    , _bufferHits(0)
+    , _bufferMisses(0)
+{
+}
+
+void JobReport::start()
+{
+    _hits = TransformCache::instance()->hits();
+    _misses = TransformCache::instance()->misses();
+    _bufferHits = BufferPool::instance()->hits();
+    _bufferMisses = BufferPool::instance()->misses();
+    _timer.start();
+}
+
+void JobReport::finish(const QList<Converter::Result> &results)
+{
+    _elapsed = _timer.isValid() ? _timer.nsecsElapsed() : 0;
+    _hits = TransformCache::instance()->hits() - _hits;
+    _misses = TransformCache::instance()->misses() - _misses;
+    _bufferHits = BufferPool::instance()->hits() - _bufferHits;
+    _bufferMisses = BufferPool::instance()->misses() - _bufferMisses;
+    _results = results;
+}
+
+QByteArray JobReport::toText() const
+{
+    QString output;
+    for (int i = 0; i < _results.size(); ++i) {
+        const Converter::Result &result = _results.at(i);
+        output.append(QString("%1\t%2\t%3\t%4\n")
+                      .arg(status(result))
+                      .arg(result.filename)
+                      .arg(result.output)
+                      .arg(result.error));
+    }
+    return output.toUtf8();
+}
+
+QByteArray JobReport::toJson() const
+{
+    QJsonArray files;
+    qint64 stages[Converter::StageCount] = {};
+    qint64 pixels = 0;
+    qint64 bytesIn = 0;
+    qint64 bytesOut = 0;
+    qint64 peak = 0;
+    int failed = 0;
+    int skipped = 0;
+    int workers = 0;
+    int threads = 0;
+    int magickThreads = 0;
+    for (int i = 0; i < _results.size(); ++i) {
+        const Converter::Result &result = _results.at(i);
+        const Converter::Stats &stats = result.stats;
+        QJsonObject times;
+        for (int stage = 0; stage < Converter::StageCount; ++stage) {
+            times.insert(stageName(stage), milliseconds(stats.stages[stage]));
+            stages[stage] += stats.stages[stage];
+        }
+        QJsonObject file;
+        file.insert("input", result.filename);
+        file.insert("output", result.output);
+        file.insert("success", result.success);
+        file.insert("skipped", result.skipped);
+        if (!result.success) { file.insert("error", result.error); }
+        file.insert("streamed", stats.streamed);
+        file.insert("transformCached", stats.cached);
+        if (stats.lutDeltaE >= 0) { file.insert("lutDeltaE", stats.lutDeltaE); }
+        if (stats.inkMax >= 0) {
+            QJsonArray histogram;
+            for (int bin = 0; bin < Converter::InkBins; ++bin) {
+                histogram.append(static_cast<double>(stats.inkHistogram[bin]));
+            }
+            QJsonObject ink;
+            ink.insert("max", stats.inkMax);
+            ink.insert("limit", stats.inkLimit);
+            ink.insert("overPixels", static_cast<double>(stats.inkOver));
+            ink.insert("overPercent", percent(stats.inkOver, inkPixels(stats)));
+            ink.insert("histogram", histogram);
+            file.insert("ink", ink);
+        }
+        if (stats.gamutChecked > 0) {
+            QJsonObject gamut;
+            gamut.insert("checked", static_cast<double>(stats.gamutChecked));
+            gamut.insert("outside", static_cast<double>(stats.gamutOut));
+            gamut.insert("outsidePercent", percent(stats.gamutOut, stats.gamutChecked));
+            file.insert("gamut", gamut);
+        }
+        if (stats.threads > 0) {
+            QJsonObject execution;
+            execution.insert("workers", stats.workers);
+            execution.insert("threads", stats.threads);
+            execution.insert("magickThreads", stats.magickThreads);
+            file.insert("execution", execution);
+        }
+        file.insert("pixels", static_cast<double>(stats.pixels));
+        file.insert("bytesIn", static_cast<double>(stats.bytesIn));
+        file.insert("bytesOut", static_cast<double>(stats.bytesOut));
+        file.insert("totalMs", milliseconds(stats.total));
+        file.insert("stagesMs", times);
+        file.insert("peakMemory", static_cast<double>(stats.peakMemory));
+        files.append(file);
+
+        if (!result.success) { failed++; }
+        if (result.skipped) { skipped++; }
+        pixels += stats.pixels;
+        bytesIn += stats.bytesIn;
+        bytesOut += stats.bytesOut;
+        peak = qMax(peak, stats.peakMemory);
+        workers = qMax(workers, stats.workers);
+        threads = qMax(threads, stats.threads);
+        magickThreads = qMax(magickThreads, stats.magickThreads);
+    }
+
+    const double seconds = static_cast<double>(_elapsed) / 1000000000.0;
+    QJsonObject times;
+    for (int stage = 0; stage < Converter::StageCount; ++stage) {
+        times.insert(stageName(stage), milliseconds(stages[stage]));
+    }
+    QJsonObject cache;
+    cache.insert("hits", _hits);
+    cache.insert("misses", _misses);
+    QJsonObject buffers;
+    buffers.insert("hits", _bufferHits);
+    buffers.insert("misses", _bufferMisses);
+    buffers.insert("resident", static_cast<double>(BufferPool::instance()->resident()));
+    buffers.insert("peakResident", static_cast<double>(BufferPool::instance()->peak()));
+    const ExecutionBudget::Limits limits = ExecutionBudget::magickLimits();
+    QJsonObject execution;
+    execution.insert("cores", ExecutionBudget::cores());
+    execution.insert("workers", workers);
+    execution.insert("maxThreads", threads);
+    execution.insert("magickThreads", magickThreads);
+    execution.insert("magickMemory", static_cast<double>(limits.memory));
+    execution.insert("magickMap", static_cast<double>(limits.map));
+    execution.insert("magickDisk", static_cast<double>(limits.disk));
+
+    QJsonObject summary;
+    summary.insert("files", _results.size());
+    summary.insert("failed", failed);
+    summary.insert("skipped", skipped);
+    summary.insert("seconds", seconds);
+    summary.insert("pixels", static_cast<double>(pixels));
+    summary.insert("bytesIn", static_cast<double>(bytesIn));
+    summary.insert("bytesOut", static_cast<double>(bytesOut));
+    summary.insert("mpixPerSecond", seconds > 0 ? static_cast<double>(pixels) / 1000000.0 / seconds : 0.0);
+    summary.insert("filesPerSecond", seconds > 0 ? _results.size() / seconds : 0.0);
+    summary.insert("stagesMs", times);
+    summary.insert("transformCache", cache);
+    summary.insert("bufferPool", buffers);
+    summary.insert("execution", execution);
+    summary.insert("peakMemory", static_cast<double>(qMax(peak, peakMemory())));
+
+    QJsonObject report;
+    report.insert("summary", summary);
+    report.insert("files", files);
+    return QJsonDocument(report).toJson();
+}
+
+QByteArray JobReport::toCsv() const
+{
+    QStringList header;
+    header << "status" << "input" << "output" << "streamed" << "cached" << "lut_delta_e"
+           << "ink_max" << "ink_over_pct" << "ink_histogram" << "gamut_out_pct"
+           << "workers" << "threads" << "magick_threads"
+           << "pixels" << "bytes_in" << "bytes_out" << "total_ms";
+    for (int stage = 0; stage < Converter::StageCount; ++stage) {
+        header << QString("%1_ms").arg(stageName(stage));
+    }
+    header << "peak_memory" << "error";
+
+    QString output = header.join(',') + '\n';
+    for (int i = 0; i < _results.size(); ++i) {
+        const Converter::Result &result = _results.at(i);
+        const Converter::Stats &stats = result.stats;
+        QStringList histogram;
+        for (int bin = 0; bin < Converter::InkBins; ++bin) {
+            histogram << QString::number(stats.inkHistogram[bin]);
+        }
+        QStringList row;
+        row << status(result)
+            << csvField(result.filename)
+            << csvField(result.output)
+            << QString::number(stats.streamed ? 1 : 0)
+            << QString::number(stats.cached ? 1 : 0)
+            << (stats.lutDeltaE >= 0 ? QString::number(stats.lutDeltaE, 'f', 3) : QString())
+            << (stats.inkMax >= 0 ? QString::number(stats.inkMax) : QString())
+            << (stats.inkMax >= 0 ? QString::number(percent(stats.inkOver, inkPixels(stats)), 'f', 3) : QString())
+            << (stats.inkMax >= 0 ? histogram.join(';') : QString())
+            << (stats.gamutChecked > 0 ? QString::number(percent(stats.gamutOut, stats.gamutChecked), 'f', 3) : QString())
+            << QString::number(stats.workers)
+            << QString::number(stats.threads)
+            << QString::number(stats.magickThreads)
+            << QString::number(stats.pixels)
+            << QString::number(stats.bytesIn)
+            << QString::number(stats.bytesOut)
+            << QString::number(milliseconds(stats.total), 'f', 3);
+        for (int stage = 0; stage < Converter::StageCount; ++stage) {
+            row << QString::number(milliseconds(stats.stages[stage]), 'f', 3);
+        }
+        row << QString::number(stats.peakMemory) << csvField(result.error);
+        output.append(row.join(',') + '\n');
+    }
+    return output.toUtf8();
+}
+
+QByteArray JobReport::format(Format format) const
+{
+    switch (format) {
+    case JsonFormat:
+        return toJson();
+    case CsvFormat:
+        return toCsv();
+    default:;
+    }
+    return toText();
+}
+
+bool JobReport::parseFormat(const QString &name, Format *format)
+{
+    QString value = name.toLower();
+    if (value == QString("text")) {
+        *format = TextFormat;
+    } else if (value == QString("json")) {
+        *format = JsonFormat;
+    } else if (value == QString("csv")) {
+        *format = CsvFormat;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+QString JobReport::stageName(int stage)
+{
+    switch (stage) {
+    case Converter::AdmitStage:
+        return QString("admit");
+    case Converter::DecodeStage:
+        return QString("decode");
+    case Converter::ProfileStage:
+        return QString("profile");
+    case Converter::LookupStage:
+        return QString("lookup");
+    case Converter::TransformStage:
+        return QString("transform");
+    case Converter::EncodeStage:
+        return QString("encode");
+    case Converter::WriteStage:
+        return QString("write");
+    case Converter::StreamStage:
+        return QString("stream");
+    default:;
+    }
+    return QString();
+}
+
+qint64 JobReport::peakMemory()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return static_cast<qint64>(counters.PeakWorkingSetSize);
+    }
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef Q_OS_MAC
+        return static_cast<qint64>(usage.ru_maxrss);
+#else
+        return static_cast<qint64>(usage.ru_maxrss) * 1024;
+#endif
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef JOBREPORT_H
+#define JOBREPORT_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QList>
+#include <QString>
+
+#include "converter.h"
+
+class JobReport
+{
+public:
+
+    enum Format {
+        TextFormat,
+        JsonFormat,
+        CsvFormat
+    };
+
+    // adds the time spent in its scope to elapsed, does nothing when
+    // stats are off
+    class Timer
+    {
+    public:
+        Timer(bool enabled, qint64 *elapsed)
+            : _elapsed(enabled ? elapsed : nullptr)
+        {
+            if (_elapsed) { _timer.start(); }
+        }
+        ~Timer()
+        {
+            if (_elapsed) { *_elapsed += _timer.nsecsElapsed(); }
+        }
+
+    private:
+        qint64 *_elapsed;
+        QElapsedTimer _timer;
+    };
+
+    JobReport();
+
+    void start();
+    void finish(const QList<Converter::Result> &results);
+
+    QByteArray toText() const;
+    QByteArray toJson() const;
+    QByteArray toCsv() const;
+    QByteArray format(Format format) const;
+
+    static bool parseFormat(const QString &name, Format *format);
+    static QString stageName(int stage);
+    static qint64 peakMemory();
+
+private:
+    QElapsedTimer _timer;
+    qint64 _elapsed;
+    int _hits;
+    int _misses;
+    int _bufferHits;
+    int _bufferMisses;
+    QList<Converter::Result> _results;
+};
+
+#endif // JOBREPORT_H
@@ -0,0 +1,211 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include "jobscheduler.h"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+
+#include <functional>
+
+// waits for one job on the scheduler pool, queued by the job priority
+class JobTask : public QRunnable
+{
+public:
+    explicit JobTask(const std::function<void()> &function)
+        : _function(function)
+    {
+    }
+    void run() override
+    {
+        _function();
+    }
+
+private:
+    std::function<void()> _function;
+};
+
+JobScheduler::JobScheduler(Converter *converter,
+                           QObject *parent)
+    : QObject(parent)
+    , _converter(converter)
+    , _next(1)
+{
+    qRegisterMetaType<Converter::Result>("Converter::Result");
+    qRegisterMetaType<QList<Converter::Result> >("QList<Converter::Result>");
+}
+
+JobScheduler::~JobScheduler()
+{
+    cancelAll();
+    _pool.waitForDone();
+}
+
+std::shared_ptr<QAtomicInt> JobScheduler::reserve()
+{
+    // a cancel flag for work that turns into jobs later, like a folder
+    // scan, the jobs submitted with it stop together with the scan
+    std::shared_ptr<QAtomicInt> cancel = std::make_shared<QAtomicInt>(0);
+    QMutexLocker lock(&_mutex);
+    QMutableListIterator<std::weak_ptr<QAtomicInt> > it(_reserved);
+    while (it.hasNext()) {
+        if (it.next().expired()) { it.remove(); }
+    }
+    _reserved.append(cancel);
+    return cancel;
+}
+
+int JobScheduler::submit(const QList<QUrl> &urls,
+                         const Converter::Options &options,
+                         Priority priority,
+                         const std::shared_ptr<QAtomicInt> &cancel)
+{
+    // files found after their scan was cancelled are dropped
+    if (cancel && cancel->loadAcquire()) { return 0; }
+
+    // every target of a file reports on its own, and counts its input
+    const int targets = Converter::outputTargets(options).size();
+    Job job;
+    job.files = urls.size() * targets;
+    job.cancel = cancel ? cancel : std::make_shared<QAtomicInt>(0);
+    for (int i = 0; i < urls.size(); ++i) {
+        QString filename = urls.at(i).toLocalFile();
+        qint64 size = QFileInfo(filename).size();
+        job.sizes.insert(filename, size);
+        job.bytes += size * targets;
+    }
+
+    int id = 0;
+    {
+        QMutexLocker lock(&_mutex);
+        id = _next++;
+        if (_jobs.isEmpty()) {
+            _progress = Progress();
+            _timer.start();
+        }
+        _progress.jobs++;
+        _progress.files += job.files;
+        _progress.bytes += job.bytes;
+        _jobs.insert(id, job);
+    }
+    qDebug() << "submit job" << id << urls.size() << priority;
+
+    Converter::Options jobOptions = options;
+    jobOptions.priority = static_cast<int>(priority);
+    jobOptions.cancel = job.cancel;
+    jobOptions.progress = [this, id](const Converter::Result &result) {
+        fileDone(id, result);
+    };
+    // every running job holds a thread here while it waits for its files,
+    // so no more jobs run than files may be converted at once, the others
+    // wait in the pool, the most urgent first
+    Converter *converter = _converter;
+    _pool.setMaxThreadCount(converter->maxJobs());
+    _pool.start(new JobTask([this, converter, urls, jobOptions, id]() {
+        jobDone(id, converter->convertUrls(urls, jobOptions));
+    }), static_cast<int>(priority));
+    Q_EMIT progressChanged();
+    return id;
+}
+
+void JobScheduler::cancel(int job)
+{
+    QMutexLocker lock(&_mutex);
+    if (!_jobs.contains(job)) { return; }
+    _jobs[job].cancel->storeRelease(1);
+}
+
+void JobScheduler::cancelAll()
+{
+    QMutexLocker lock(&_mutex);
+    QMutableHashIterator<int, Job> it(_jobs);
+    while (it.hasNext()) {
+        it.next();
+        it.value().cancel->storeRelease(1);
+    }
+    for (int i = 0; i < _reserved.size(); ++i) {
+        std::shared_ptr<QAtomicInt> cancel = _reserved.at(i).lock();
+        if (cancel) { cancel->storeRelease(1); }
+    }
+    _reserved.clear();
+}
+
+bool JobScheduler::isBusy() const
+{
+    QMutexLocker lock(&_mutex);
+    return !_jobs.isEmpty();
+}
+
+JobScheduler::Progress JobScheduler::progress() const
+{
+    QMutexLocker lock(&_mutex);
+    Progress progress = _progress;
+    progress.elapsed = _timer.isValid() ? _timer.elapsed() : 0;
+
+    // remaining time from the measured throughput in input bytes, which
+    // follows the image sizes better than a file count
+    const double seconds = static_cast<double>(progress.elapsed) / 1000.0;
+    if (seconds > 0) { progress.filesPerSecond = progress.done / seconds; }
+    if (progress.bytesDone > 0 && progress.bytes >= progress.bytesDone) {
+        progress.remaining = static_cast<qint64>(static_cast<double>(progress.elapsed) *
+                                                 static_cast<double>(progress.bytes - progress.bytesDone) /
+                                                 static_cast<double>(progress.bytesDone));
+    }
+    return progress;
+}
+
+void JobScheduler::fileDone(int job, const Converter::Result &result)
+{
+    {
+        QMutexLocker lock(&_mutex);
+        QHash<int, Job>::iterator it = _jobs.find(job);
+        if (it == _jobs.end()) { return; }
+        const qint64 size = it.value().sizes.value(result.filename);
+        it.value().done++;
+        it.value().bytesDone += size;
+        _progress.done++;
+        _progress.bytesDone += size;
+        if (!result.success && !result.cancelled) { _progress.failed++; }
+        _progress.current = result.filename;
+    }
+    Q_EMIT fileFinished(job, result);
+    Q_EMIT progressChanged();
+}
+
+void JobScheduler::jobDone(int job, const QList<Converter::Result> &results)
+{
+    bool empty = false;
+    {
+        QMutexLocker lock(&_mutex);
+        QHash<int, Job>::iterator it = _jobs.find(job);
+        if (it == _jobs.end()) { return; }
+
+        // files that were never reported still count as done
+        _progress.done += it.value().files - it.value().done;
+        _progress.bytesDone += it.value().bytes - it.value().bytesDone;
+        _jobs.erase(it);
+        empty = _jobs.isEmpty();
+    }
+    qDebug() << "job done" << job << results.size();
+    Q_EMIT jobFinished(job, results);
+    Q_EMIT progressChanged();
+    if (empty) { Q_EMIT idle(); }
+}
@@ -0,0 +1,107 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef JOBSCHEDULER_H
+#define JOBSCHEDULER_H
+
+#include <QObject>
+#include <QList>
+#include <QUrl>
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QThreadPool>
+
+#include <memory>
+
+#include "converter.h"
+
+class JobScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    enum Priority {
+        LowPriority,
+        NormalPriority,
+        HighPriority
+    };
+
+    struct Progress
+    {
+        int jobs = 0;
+        int files = 0;
+        int done = 0;
+        int failed = 0;
+        qint64 bytes = 0;
+        qint64 bytesDone = 0;
+        qint64 elapsed = 0;
+        qint64 remaining = -1;
+        double filesPerSecond = 0;
+        QString current;
+    };
+
+    explicit JobScheduler(Converter *converter,
+                          QObject *parent = nullptr);
+    ~JobScheduler();
+
+    std::shared_ptr<QAtomicInt> reserve();
+    int submit(const QList<QUrl> &urls,
+               const Converter::Options &options,
+               Priority priority = NormalPriority,
+               const std::shared_ptr<QAtomicInt> &cancel = std::shared_ptr<QAtomicInt>());
+    bool isBusy() const;
+    Progress progress() const;
+
+public Q_SLOTS:
+    void cancel(int job);
+    void cancelAll();
+
+Q_SIGNALS:
+    void fileFinished(int job, const Converter::Result &result);
+    void jobFinished(int job, const QList<Converter::Result> &results);
+    void progressChanged();
+    void idle();
+
+private:
+    struct Job
+    {
+        int files = 0;
+        int done = 0;
+        qint64 bytes = 0;
+        qint64 bytesDone = 0;
+        QHash<QString, qint64> sizes;
+        std::shared_ptr<QAtomicInt> cancel;
+    };
+
+    void fileDone(int job, const Converter::Result &result);
+    void jobDone(int job, const QList<Converter::Result> &results);
+
+    Converter *_converter;
+    QThreadPool _pool;
+    mutable QMutex _mutex;
+    QHash<int, Job> _jobs;
+    QList<std::weak_ptr<QAtomicInt> > _reserved;
+    int _next;
+    Progress _progress;
+    QElapsedTimer _timer;
+};
+
+#endif // JOBSCHEDULER_H
@@ -0,0 +1,474 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include "lutkernel.h"
+
+#include <QDebug>
+#include <QGlobalStatic>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSharedPointer>
+
+#include <cstring>
+
+#include "transformcache.h"
+#include "profileregistry.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LUT_SIMD
+#include <immintrin.h>
+#endif
+
+#define LUT_GRID 33
+#define LUT_FRACTION_BITS 12
+#define LUT_VALIDATION_STEP 5
+#define LUT_CACHE_SIZE 16
+
+struct LutEntry
+{
+    QMutex mutex;
+    bool built = false;
+    quint64 used = 0;
+    LutKernel::Lut lut;
+};
+
+struct LutCache
+{
+    QMutex mutex;
+    quint64 clock = 0;
+    QHash<TransformCache::Key, QSharedPointer<LutEntry> > entries;
+};
+
+Q_GLOBAL_STATIC(LutCache, lutCache)
+
+// grid cell and fraction for every 8-bit input value, the last cell is
+// used with a full fraction for 255
+struct LutAxis
+{
+    int offset[256];
+    int fraction[256];
+    LutAxis()
+    {
+        for (int v = 0; v < 256; ++v) {
+            int position = (v * (LUT_GRID - 1) << LUT_FRACTION_BITS) / 255;
+            int index = position >> LUT_FRACTION_BITS;
+            int fraction = position & ((1 << LUT_FRACTION_BITS) - 1);
+            if (index >= LUT_GRID - 1) {
+                index = LUT_GRID - 2;
+                fraction = 1 << LUT_FRACTION_BITS;
+            }
+            offset[v] = index;
+            this->fraction[v] = fraction;
+        }
+    }
+};
+
+static const LutAxis &lutAxis()
+{
+    static const LutAxis axis;
+    return axis;
+}
+
+struct LutCell
+{
+    int c0;
+    int c1;
+    int c2;
+    int c3;
+    int a;
+    int b;
+    int c;
+};
+
+// the tetrahedron of the cube holding the pixel, as four table offsets
+// and the three sorted fractions weighting the edges between them
+static inline void lutCell(const LutAxis &axis, const unsigned char *pixel, LutCell *cell)
+{
+    const int sr = LUT_GRID * LUT_GRID * 4;
+    const int sg = LUT_GRID * 4;
+    const int sb = 4;
+    const int rx = axis.fraction[pixel[0]];
+    const int ry = axis.fraction[pixel[1]];
+    const int rz = axis.fraction[pixel[2]];
+    const int base = axis.offset[pixel[0]] * sr + axis.offset[pixel[1]] * sg + axis.offset[pixel[2]] * sb;
+    cell->c0 = base;
+    cell->c3 = base + sr + sg + sb;
+    if (rx >= ry) {
+        if (ry >= rz) {
+            cell->c1 = base + sr;
+            cell->c2 = base + sr + sg;
+            cell->a = rx; cell->b = ry; cell->c = rz;
+        } else if (rx >= rz) {
+            cell->c1 = base + sr;
+            cell->c2 = base + sr + sb;
+            cell->a = rx; cell->b = rz; cell->c = ry;
+        } else {
+            cell->c1 = base + sb;
+            cell->c2 = base + sr + sb;
+            cell->a = rz; cell->b = rx; cell->c = ry;
+        }
+    } else {
+        if (rx >= rz) {
+            cell->c1 = base + sg;
+            cell->c2 = base + sr + sg;
+            cell->a = ry; cell->b = rx; cell->c = rz;
+        } else if (ry >= rz) {
+            cell->c1 = base + sg;
+            cell->c2 = base + sg + sb;
+            cell->a = ry; cell->b = rz; cell->c = rx;
+        } else {
+            cell->c1 = base + sb;
+            cell->c2 = base + sg + sb;
+            cell->a = rz; cell->b = ry; cell->c = rx;
+        }
+    }
+}
+
+// table values are 8.8 fixed point, fractions have LUT_FRACTION_BITS,
+// so the sum fits in 29 bits and all kernels round the same way
+static void applyScalar(const quint16 *table,
+                        const unsigned char *input,
+                        unsigned char *output,
+                        size_t pixels,
+                        int channels)
+{
+    const LutAxis &axis = lutAxis();
+    const int round = 1 << (LUT_FRACTION_BITS + 7);
+    for (size_t i = 0; i < pixels; ++i) {
+        LutCell cell;
+        lutCell(axis, input + i * 3, &cell);
+        for (int ch = 0; ch < channels; ++ch) {
+            const int v0 = table[cell.c0 + ch];
+            const int v1 = table[cell.c1 + ch];
+            const int v2 = table[cell.c2 + ch];
+            const int v3 = table[cell.c3 + ch];
+            const int value = (v0 << LUT_FRACTION_BITS) + (v1 - v0) * cell.a + (v2 - v1) * cell.b + (v3 - v2) * cell.c;
+            output[i * channels + ch] = static_cast<unsigned char>((value + round) >> (LUT_FRACTION_BITS + 8));
+        }
+    }
+}
+
+#ifdef LUT_SIMD
+__attribute__((target("sse4.1")))
+static void applySse41(const quint16 *table,
+                       const unsigned char *input,
+                       unsigned char *output,
+                       size_t pixels,
+                       int channels)
+{
+    const LutAxis &axis = lutAxis();
+    const __m128i round = _mm_set1_epi32(1 << (LUT_FRACTION_BITS + 7));
+    for (size_t i = 0; i < pixels; ++i) {
+        LutCell cell;
+        lutCell(axis, input + i * 3, &cell);
+        const __m128i v0 = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(table + cell.c0)));
+        const __m128i v1 = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(table + cell.c1)));
+        const __m128i v2 = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(table + cell.c2)));
+        const __m128i v3 = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(table + cell.c3)));
+        __m128i value = _mm_slli_epi32(v0, LUT_FRACTION_BITS);
+        value = _mm_add_epi32(value, _mm_mullo_epi32(_mm_sub_epi32(v1, v0), _mm_set1_epi32(cell.a)));
+        value = _mm_add_epi32(value, _mm_mullo_epi32(_mm_sub_epi32(v2, v1), _mm_set1_epi32(cell.b)));
+        value = _mm_add_epi32(value, _mm_mullo_epi32(_mm_sub_epi32(v3, v2), _mm_set1_epi32(cell.c)));
+        value = _mm_srli_epi32(_mm_add_epi32(value, round), LUT_FRACTION_BITS + 8);
+        const __m128i bytes = _mm_packus_epi16(_mm_packus_epi32(value, value), value);
+        const int packed = _mm_cvtsi128_si32(bytes);
+        std::memcpy(output + i * channels, &packed, static_cast<size_t>(channels));
+    }
+}
+
+// two pixels per iteration, one in each 128-bit lane
+__attribute__((target("avx2")))
+static void applyAvx2(const quint16 *table,
+                      const unsigned char *input,
+                      unsigned char *output,
+                      size_t pixels,
+                      int channels)
+{
+    const LutAxis &axis = lutAxis();
+    const __m256i round = _mm256_set1_epi32(1 << (LUT_FRACTION_BITS + 7));
+    size_t i = 0;
+    for (; i + 1 < pixels; i += 2) {
+        LutCell p;
+        LutCell q;
+        lutCell(axis, input + i * 3, &p);
+        lutCell(axis, input + (i + 1) * 3, &q);
+        const __m256i v0 = _mm256_cvtepu16_epi32(_mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(table + p.c0)),
+                                                                    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(table + q.c0))));
+        const __m256i v1 = _mm256_cvtepu16_epi32(_mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(table + p.c1)),
+                                                                    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(table + q.c1))));
+        const __m256i v2 = _mm256_cvtepu16_epi32(_mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(table + p.c2)),
+                                                                    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(table + q.c2))));
+        const __m256i v3 = _mm256_cvtepu16_epi32(_mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(table + p.c3)),
+                                                                    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(table + q.c3))));
+        __m256i value = _mm256_slli_epi32(v0, LUT_FRACTION_BITS);
+        value = _mm256_add_epi32(value, _mm256_mullo_epi32(_mm256_sub_epi32(v1, v0), _mm256_setr_epi32(p.a, p.a, p.a, p.a, q.a, q.a, q.a, q.a)));
+        value = _mm256_add_epi32(value, _mm256_mullo_epi32(_mm256_sub_epi32(v2, v1), _mm256_setr_epi32(p.b, p.b, p.b, p.b, q.b, q.b, q.b, q.b)));
+        value = _mm256_add_epi32(value, _mm256_mullo_epi32(_mm256_sub_epi32(v3, v2), _mm256_setr_epi32(p.c, p.c, p.c, p.c, q.c, q.c, q.c, q.c)));
+        value = _mm256_srli_epi32(_mm256_add_epi32(value, round), LUT_FRACTION_BITS + 8);
+        const __m256i words = _mm256_packus_epi32(value, value);
+        const __m256i bytes = _mm256_packus_epi16(words, words);
+        const int first = _mm_cvtsi128_si32(_mm256_castsi256_si128(bytes));
+        const int second = _mm_cvtsi128_si32(_mm256_extracti128_si256(bytes, 1));
+        std::memcpy(output + i * channels, &first, static_cast<size_t>(channels));
+        std::memcpy(output + (i + 1) * channels, &second, static_cast<size_t>(channels));
+    }
+    if (i < pixels) {
+        applyScalar(table, input + i * 3, output + i * channels, pixels - i, channels);
+    }
+}
+#endif
+
+LutKernel::LutKernel()
+    : _channels(0)
+    , _maxDeltaE(0)
+    , _meanDeltaE(0)
+{
+}
+
+LutKernel::Lut LutKernel::get(const Converter::Profile &input,
+                              const Converter::Profile &output,
+                              cmsUInt32Number outputFormat,
+                              cmsUInt32Number intent,
+                              bool blackPoint)
+{
+    TransformCache::Key key;
+    key.input = input.digest;
+    key.output = output.digest;
+    key.inputFormat = Converter::pixelFormat(Converter::colorSpaceRGB, false, 1);
+    key.outputFormat = outputFormat;
+    key.intent = intent;
+    key.blackPoint = blackPoint;
+
+    // only 8-bit RGB without extra channels has a table
+    if (input.cs != Converter::colorSpaceRGB ||
+        T_BYTES(outputFormat) != 1 ||
+        T_EXTRA(outputFormat) != 0 ||
+        T_CHANNELS(outputFormat) > 4) { return Lut(); }
+
+    LutCache *cache = lutCache();
+    QSharedPointer<LutEntry> entry;
+    {
+        QMutexLocker lock(&cache->mutex);
+        entry = cache->entries.value(key);
+        if (entry.isNull()) {
+            entry = QSharedPointer<LutEntry>(new LutEntry);
+            cache->entries.insert(key, entry);
+        }
+        entry->used = ++cache->clock;
+
+        // tables are large, keep the recently used ones only
+        while (cache->entries.size() > LUT_CACHE_SIZE) {
+            QHash<TransformCache::Key, QSharedPointer<LutEntry> >::iterator oldest = cache->entries.begin();
+            for (QHash<TransformCache::Key, QSharedPointer<LutEntry> >::iterator it = cache->entries.begin(); it != cache->entries.end(); ++it) {
+                if (it.value()->used < oldest.value()->used) { oldest = it; }
+            }
+            cache->entries.erase(oldest);
+        }
+    }
+
+    QMutexLocker lock(&entry->mutex);
+    if (entry->built) { return entry->lut; }
+    entry->built = true;
+    std::shared_ptr<LutKernel> lut(new LutKernel);
+    if (!lut->bake(input, output, outputFormat, intent, blackPoint)) { return Lut(); }
+    lut->validate(input, output, outputFormat, intent, blackPoint);
+    qDebug() << "LUT" << kernelName(bestKernel()) << "max dE2000" << lut->_maxDeltaE << "mean" << lut->_meanDeltaE;
+    entry->lut = lut;
+    return entry->lut;
+}
+
+LutKernel::Kernel LutKernel::bestKernel()
+{
+#ifdef LUT_SIMD
+    static const Kernel kernel = []() -> Kernel {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) { return Avx2Kernel; }
+        if (__builtin_cpu_supports("sse4.1")) { return Sse41Kernel; }
+        return ScalarKernel;
+    }();
+    return kernel;
+#else
+    return ScalarKernel;
+#endif
+}
+
+QString LutKernel::kernelName(Kernel kernel)
+{
+    switch (kernel) {
+    case Sse41Kernel:
+        return QString("sse4.1");
+    case Avx2Kernel:
+        return QString("avx2");
+    default:;
+    }
+    return QString("scalar");
+}
+
+int LutKernel::outputChannels() const
+{
+    return _channels;
+}
+
+double LutKernel::maxDeltaE() const
+{
+    return _maxDeltaE;
+}
+
+double LutKernel::meanDeltaE() const
+{
+    return _meanDeltaE;
+}
+
+void LutKernel::apply(const unsigned char *input,
+                      unsigned char *output,
+                      size_t pixels) const
+{
+    apply(input, output, pixels, bestKernel());
+}
+
+void LutKernel::apply(const unsigned char *input,
+                      unsigned char *output,
+                      size_t pixels,
+                      Kernel kernel) const
+{
+#ifdef LUT_SIMD
+    switch (kernel) {
+    case Avx2Kernel:
+        applyAvx2(_table.data(), input, output, pixels, _channels);
+        return;
+    case Sse41Kernel:
+        applySse41(_table.data(), input, output, pixels, _channels);
+        return;
+    default:;
+    }
+#else
+    Q_UNUSED(kernel)
+#endif
+    applyScalar(_table.data(), input, output, pixels, _channels);
+}
+
+bool LutKernel::bake(const Converter::Profile &input,
+                     const Converter::Profile &output,
+                     cmsUInt32Number outputFormat,
+                     cmsUInt32Number intent,
+                     bool blackPoint)
+{
+    // the grid goes through the cached 16-bit transform, so the table
+    // has the same flavour and black point handling as the direct path
+    const cmsUInt32Number gridFormat = (outputFormat & ~BYTES_SH(7)) | BYTES_SH(2);
+    TransformCache::Transform transform = TransformCache::instance()->transform(input.data,
+                                                                               input.digest,
+                                                                               output.data,
+                                                                               output.digest,
+                                                                               Converter::pixelFormat(Converter::colorSpaceRGB, false, 2),
+                                                                               gridFormat,
+                                                                               intent,
+                                                                               blackPoint);
+    if (!transform) { return false; }
+
+    _channels = static_cast<int>(T_CHANNELS(outputFormat));
+    const size_t points = LUT_GRID * LUT_GRID * LUT_GRID;
+    std::vector<quint16> grid(points * 3);
+    size_t index = 0;
+    for (int r = 0; r < LUT_GRID; ++r) {
+        for (int g = 0; g < LUT_GRID; ++g) {
+            for (int b = 0; b < LUT_GRID; ++b) {
+                grid[index++] = static_cast<quint16>((r * 65535 + (LUT_GRID - 1) / 2) / (LUT_GRID - 1));
+                grid[index++] = static_cast<quint16>((g * 65535 + (LUT_GRID - 1) / 2) / (LUT_GRID - 1));
+                grid[index++] = static_cast<quint16>((b * 65535 + (LUT_GRID - 1) / 2) / (LUT_GRID - 1));
+            }
+        }
+    }
+    std::vector<quint16> values(points * static_cast<size_t>(_channels));
+    cmsDoTransform(transform.get(), grid.data(), values.data(), static_cast<cmsUInt32Number>(points));
+
+    _table.assign(points * 4, 0);
+    for (size_t i = 0; i < points; ++i) {
+        for (int ch = 0; ch < _channels; ++ch) {
+            const quint32 value = values[i * static_cast<size_t>(_channels) + ch];
+            _table[i * 4 + ch] = static_cast<quint16>((value * 65280 + 32767) / 65535);
+        }
+    }
+    return true;
+}
+
+void LutKernel::validate(const Converter::Profile &input,
+                         const Converter::Profile &output,
+                         cmsUInt32Number outputFormat,
+                         cmsUInt32Number intent,
+                         bool blackPoint)
+{
+    TransformCache::Transform reference = TransformCache::instance()->transform(input.data,
+                                                                               input.digest,
+                                                                               output.data,
+                                                                               output.digest,
+                                                                               Converter::pixelFormat(Converter::colorSpaceRGB, false, 1),
+                                                                               outputFormat,
+                                                                               intent,
+                                                                               blackPoint);
+    cmsContext context = ProfileRegistry::context();
+    cmsHPROFILE profile = cmsOpenProfileFromMemTHR(context, output.data.constData(), static_cast<cmsUInt32Number>(output.data.size()));
+    cmsHPROFILE lab = cmsCreateLab4ProfileTHR(context, nullptr);
+    cmsHTRANSFORM toLab = nullptr;
+    if (profile && lab) {
+        toLab = cmsCreateTransformTHR(context, profile, outputFormat, lab, TYPE_Lab_DBL,
+                                      INTENT_RELATIVE_COLORIMETRIC, 0);
+    }
+    if (profile) { cmsCloseProfile(profile); }
+    if (lab) { cmsCloseProfile(lab); }
+    if (!reference || !toLab) {
+        if (toLab) { cmsDeleteTransform(toLab); }
+        _maxDeltaE = -1;
+        _meanDeltaE = -1;
+        return;
+    }
+
+    // every fifth code value on each axis, the corners included
+    std::vector<unsigned char> samples;
+    for (int r = 0; r < 256; r += LUT_VALIDATION_STEP) {
+        for (int g = 0; g < 256; g += LUT_VALIDATION_STEP) {
+            for (int b = 0; b < 256; b += LUT_VALIDATION_STEP) {
+                samples.push_back(static_cast<unsigned char>(r));
+                samples.push_back(static_cast<unsigned char>(g));
+                samples.push_back(static_cast<unsigned char>(b));
+            }
+        }
+    }
+    const size_t count = samples.size() / 3;
+    std::vector<unsigned char> expected(count * static_cast<size_t>(_channels));
+    std::vector<unsigned char> actual(count * static_cast<size_t>(_channels));
+    cmsDoTransform(reference.get(), samples.data(), expected.data(), static_cast<cmsUInt32Number>(count));
+    apply(samples.data(), actual.data(), count, ScalarKernel);
+
+    std::vector<cmsCIELab> expectedLab(count);
+    std::vector<cmsCIELab> actualLab(count);
+    cmsDoTransform(toLab, expected.data(), expectedLab.data(), static_cast<cmsUInt32Number>(count));
+    cmsDoTransform(toLab, actual.data(), actualLab.data(), static_cast<cmsUInt32Number>(count));
+    cmsDeleteTransform(toLab);
+
+    double sum = 0;
+    _maxDeltaE = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const double deltaE = cmsCIE2000DeltaE(&expectedLab[i], &actualLab[i], 1, 1, 1);
+        _maxDeltaE = qMax(_maxDeltaE, deltaE);
+        sum += deltaE;
+    }
+    _meanDeltaE = count > 0 ? sum / static_cast<double>(count) : 0;
+}
@@ -0,0 +1,84 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef LUTKERNEL_H
+#define LUTKERNEL_H
+
+#include <QString>
+
+#include <memory>
+#include <vector>
+
+#include <lcms2.h>
+
+#include "converter.h"
+
+class LutKernel
+{
+public:
+
+    enum Kernel {
+        ScalarKernel,
+        Sse41Kernel,
+        Avx2Kernel
+    };
+
+    typedef std::shared_ptr<const LutKernel> Lut;
+
+    static Lut get(const Converter::Profile &input,
+                   const Converter::Profile &output,
+                   cmsUInt32Number outputFormat,
+                   cmsUInt32Number intent,
+                   bool blackPoint);
+    static Kernel bestKernel();
+    static QString kernelName(Kernel kernel);
+
+    int outputChannels() const;
+    double maxDeltaE() const;
+    double meanDeltaE() const;
+
+    void apply(const unsigned char *input,
+               unsigned char *output,
+               size_t pixels) const;
+    void apply(const unsigned char *input,
+               unsigned char *output,
+               size_t pixels,
+               Kernel kernel) const;
+
+private:
+    LutKernel();
+
+    bool bake(const Converter::Profile &input,
+              const Converter::Profile &output,
+              cmsUInt32Number outputFormat,
+              cmsUInt32Number intent,
+              bool blackPoint);
+    void validate(const Converter::Profile &input,
+                  const Converter::Profile &output,
+                  cmsUInt32Number outputFormat,
+                  cmsUInt32Number intent,
+                  bool blackPoint);
+
+    std::vector<quint16> _table;
+    int _channels;
+    double _maxDeltaE;
+    double _meanDeltaE;
+};
+
+#endif // LUTKERNEL_H
@@ -18,20 +18,60 @@
 */
 
 #include "mainwindow.h"
+#include "headless.h"
+#include "singleinstance.h"
 
 #include <QApplication>
 
+#include <Magick++.h>
+
 int main(int argc, char *argv[])
 {
-    QApplication a(argc, argv);
+    QCoreApplication::setApplicationName(QString("color-converter"));
+    QCoreApplication::setOrganizationName(QString("NettStudio AS"));
+    QCoreApplication::setOrganizationDomain(QString("nettstudio.no"));
+    QCoreApplication::setApplicationVersion(QString(VERSION_APP));
+
+    if (Headless::isRequested(argc, argv)) {
+        Magick::InitializeMagick(*argv);
+        QCoreApplication a(argc, argv);
+        return Headless::exec(QCoreApplication::arguments());
+    }
+
+    // a second launch hands its files to the running window and exits
+    // before the window system and the profiles are set up, the blocking
+    // socket calls need no application object
+    const bool single = !SingleInstance::isDisabled(argc, argv);
+    if (single) {
+        QStringList files;
+        for (int i = 1; i < argc; ++i) {
+            files.append(QString::fromLocal8Bit(argv[i]));
+        }
+        SingleInstance instance;
+        if (instance.forward(files)) { return 0; }
+    }
 
-    QApplication::setApplicationName(QString("color-converter"));
-    QApplication::setOrganizationName(QString("NettStudio AS"));
-    QApplication::setOrganizationDomain(QString("nettstudio.no"));
-    QApplication::setApplicationVersion(QString(VERSION_APP));
+    // only the window that stays up needs the image library
+    Magick::InitializeMagick(*argv);
+
+    QApplication a(argc, argv);
     QStringList args = QApplication::arguments();
+    args.removeAll(QString("--new-instance"));
+
+    // listen before the profiles are loaded, launches in the meantime
+    // are queued until the window is up
+    SingleInstance instance;
+    const bool listening = single && instance.listen();
 
     MainWindow w(args);
+    if (listening) {
+        QObject::connect(&instance, SIGNAL(received(QStringList)),
+                         &w, SLOT(handleArgs(QStringList)));
+        QObject::connect(&instance, &SingleInstance::received, &w, [&w]() {
+            w.raise();
+            w.activateWindow();
+        });
+    }
     w.show();
     return a.exec();
 }
@@ -23,40 +23,71 @@
 #include <QStyleFactory>
 #include <QDebug>
 #include <QMimeData>
-#include <QMimeDatabase>
-#include <QMimeType>
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
 #include <QStandardPaths>
-#include <QtConcurrent/QtConcurrentRun>
-#include <QDirIterator>
 #include <QSettings>
 #include <QMessageBox>
+#include <QThread>
+#include <QPixmap>
+#include <QAction>
 
-#include <Magick++.h>
+#include "profileregistry.h"
 
 MainWindow::MainWindow(QStringList args,
                        QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
-    , _isBusy(false)
+    , _converter(new Converter(this))
+    , _catalog(new ProfileCatalog(this))
+    , _scanner(new FileScanner(this))
+    , _scheduler(new JobScheduler(_converter, this))
+    , _previewer(new Previewer(this))
+    , _targets(new QMenu(this))
+    , _nextScan(1)
 {
     ui->setupUi(this);
+    ui->targetsButton->setMenu(_targets);
 
     setupTheme();
     setupInfo();
     setupICC();
     progressClear();
+    ui->preview->hide();
 
     QObject::connect(this, SIGNAL(droppedUrls(QList<QUrl>)),
                      this, SLOT(handleUrls(QList<QUrl>)));
-    QObject::connect(this, SIGNAL(convertDone()),
+    QObject::connect(_scanner, SIGNAL(found(QStringList,int)),
+                     this, SLOT(queueFiles(QStringList,int)));
+    QObject::connect(_scanner, SIGNAL(finished(int,int)),
+                     this, SLOT(scanFinished(int,int)));
+    QObject::connect(_scheduler, SIGNAL(fileFinished(int,Converter::Result)),
+                     this, SLOT(convertedFile(int,Converter::Result)));
+    QObject::connect(_scheduler, SIGNAL(progressChanged()),
+                     this, SLOT(progressUpdate()));
+    QObject::connect(_scheduler, SIGNAL(idle()),
                      this, SLOT(convertedUrls()));
     QObject::connect(this, SIGNAL(showWarning(QString,QString)),
                      this, SLOT(handleWarning(QString,QString)));
-    QObject::connect(this, SIGNAL(stopProgress()),
-                     this, SLOT(progressClear()));
+    QObject::connect(ui->cancelButton, SIGNAL(clicked()),
+                     _scheduler, SLOT(cancelAll()));
+    QObject::connect(ui->jobs, SIGNAL(valueChanged(int)),
+                     this, SLOT(handleJobsChanged(int)));
+    QObject::connect(ui->previewButton, SIGNAL(toggled(bool)),
+                     this, SLOT(previewToggled(bool)));
+    QObject::connect(_previewer, SIGNAL(rendered(QImage,qint64)),
+                     this, SLOT(previewRendered(QImage,qint64)));
+    QObject::connect(_previewer, SIGNAL(failed(QString,QString)),
+                     this, SLOT(previewFailed(QString,QString)));
+    QObject::connect(ui->selectedProfile, SIGNAL(currentIndexChanged(int)),
+                     this, SLOT(previewUpdate()));
+    QObject::connect(ui->selectedIntent, SIGNAL(currentIndexChanged(int)),
+                     this, SLOT(previewUpdate()));
+    QObject::connect(ui->blackPoint, SIGNAL(toggled(bool)),
+                     this, SLOT(previewUpdate()));
+    QObject::connect(ui->monitorProfile, SIGNAL(currentIndexChanged(int)),
+                     this, SLOT(previewUpdate()));
 
     handleArgs(args);
 }
@@ -102,197 +133,208 @@ void MainWindow::setupInfo()
 
 void MainWindow::setupICC()
 {
-    QFile readRgb(QString(":/profile-rgb.icc"));
-    if (readRgb.open(QIODevice::ReadOnly)) {
-        _iccRgb = readRgb.readAll();
-        readRgb.close();
-    }
-    QFile readCmyk(QString(":/profile-cmyk.icc"));
-    if (readCmyk.open(QIODevice::ReadOnly)) {
-        _iccCmyk = readCmyk.readAll();
-        readCmyk.close();
-    }
-    QFile readGray(QString(":/profile-gray.icc"));
-    if (readGray.open(QIODevice::ReadOnly)) {
-        _iccGray = readGray.readAll();
-        readGray.close();
-    }
-
-    QIcon itemIcon(":/fargerom.png");
-
-    QString noProfileText = tr("Select output");
-    ui->selectedProfile->addItem(itemIcon, noProfileText);
-    ui->selectedProfile->insertSeparator(1);
-
-    populateColorProfiles(colorSpaceRGB, ui->selectedProfile, false);
-    populateColorProfiles(colorSpaceCMYK, ui->selectedProfile, false);
-    populateColorProfiles(colorSpaceGRAY, ui->selectedProfile, false);
-
-    ui->selectedIntent->addItem(tr("Undefined"), UndefinedRenderingIntent);
-    ui->selectedIntent->addItem(tr("Saturation"), SaturationRenderingIntent);
-    ui->selectedIntent->addItem(tr("Perceptual"), PerceptualRenderingIntent);
-    ui->selectedIntent->addItem(tr("Absolute"), AbsoluteRenderingIntent);
-    ui->selectedIntent->addItem(tr("Relative"), RelativeRenderingIntent);
+    // show what we knew last time right away, the rescan fills in the rest
+    _catalog->load();
+    refreshColorProfiles();
+    QObject::connect(_catalog, SIGNAL(updated()),
+                     this, SLOT(refreshColorProfiles()));
+    _catalog->rescan();
+
+    ui->selectedIntent->addItem(tr("Undefined"), Converter::UndefinedRenderingIntent);
+    ui->selectedIntent->addItem(tr("Saturation"), Converter::SaturationRenderingIntent);
+    ui->selectedIntent->addItem(tr("Perceptual"), Converter::PerceptualRenderingIntent);
+    ui->selectedIntent->addItem(tr("Absolute"), Converter::AbsoluteRenderingIntent);
+    ui->selectedIntent->addItem(tr("Relative"), Converter::RelativeRenderingIntent);
     ui->selectedIntent->setCurrentIndex(2);
+
+    QSettings settings;
+    ui->jobs->setMaximum(QThread::idealThreadCount() * 4);
+    ui->jobs->setValue(settings.value("jobs", QThread::idealThreadCount()).toInt());
+    _converter->setMaxJobs(ui->jobs->value());
 }
 
-void MainWindow::progressBusy()
+void MainWindow::progressUpdate()
 {
-    _isBusy = true;
-    ui->progressBar->setFormat(tr("Converting ..."));
-    ui->progressBar->setMaximum(0);
-    ui->progressBar->setValue(0);
+    JobScheduler::Progress progress = _scheduler->progress();
+    if (progress.files == 0) { return; }
+    ui->cancelButton->setEnabled(true);
+    ui->progressBar->setMaximum(progress.files);
+    ui->progressBar->setValue(progress.done);
+    QString remaining;
+    if (progress.remaining >= 0) {
+        const qint64 seconds = (progress.remaining + 999) / 1000;
+        remaining = tr(", %1:%2 left").arg(seconds / 60).arg(seconds % 60, 2, 10, QChar('0'));
+    }
+    ui->progressBar->setFormat(tr("Converting %1 of %2 (%3 files/s%4) ...")
+                               .arg(progress.done)
+                               .arg(progress.files)
+                               .arg(progress.filesPerSecond, 0, 'f', 1)
+                               .arg(remaining));
+    if (!progress.current.isEmpty()) { ui->progressBar->setToolTip(progress.current); }
 }
 
 void MainWindow::progressClear()
 {
-    _isBusy = false;
+    ui->cancelButton->setEnabled(false);
     ui->progressBar->setMaximum(1);
     ui->progressBar->setValue(1);
     ui->progressBar->setFormat(tr("Ready!"));
+    ui->progressBar->setToolTip(QString());
 }
 
 void MainWindow::handleUrls(QList<QUrl> urls)
 {
-    int added = 0;
+    scanUrls(urls, JobScheduler::NormalPriority);
+}
+
+void MainWindow::scanUrls(const QList<QUrl> &urls,
+                          int priority)
+{
+    // in preview mode the first dropped image is shown as well
+    if (ui->previewButton->isChecked()) {
+        for (int i = 0; i < urls.size(); ++i) {
+            QString filename = urls.at(i).toLocalFile();
+            if (!Converter::isValidImage(filename)) { continue; }
+            ui->preview->setToolTip(filename);
+            _previewer->load(filename);
+            previewUpdate();
+            break;
+        }
+    }
+
+    // folders are walked in the background, files arrive in queueFiles
+    QStringList paths;
     for (int i = 0; i < urls.size(); ++i) {
         QString filename = urls.at(i).toLocalFile();
-        if (!QFile::exists(filename)) { continue; }
-        if (!isValidImage(filename)) { continue; }
-        if (_queue.contains(QUrl::fromLocalFile(filename))) { continue; }
-        _queue.append(QUrl::fromLocalFile(filename));
-        added++;
+        if (filename.isEmpty() || !QFile::exists(filename)) { continue; }
+        paths.append(filename);
     }
-    if (added > 0 && !_isBusy) {
-        progressBusy();
-        QtConcurrent::run(this, &MainWindow::convertUrls, _queue);
-        _queue.clear();
+    if (paths.isEmpty()) { return; }
+
+    // the scan and the jobs made from what it finds share one cancel
+    // flag, cancelling stops the walk and drops files still on the way
+    Scan scan;
+    scan.priority = priority;
+    scan.cancel = _scheduler->reserve();
+    const int tag = _nextScan++;
+    _scans.insert(tag, scan);
+    _scanner->scan(paths, tag, scan.cancel);
+}
+
+void MainWindow::queueFiles(const QStringList &files,
+                            int scan)
+{
+    const Scan source = _scans.value(scan);
+    if (!source.cancel || source.cancel->loadAcquire()) { return; }
+
+    // files already waiting or converting are not added again
+    QList<QUrl> urls;
+    for (int i = 0; i < files.size(); ++i) {
+        if (_queued.contains(files.at(i))) { continue; }
+        _queued.insert(files.at(i));
+        urls.append(QUrl::fromLocalFile(files.at(i)));
     }
+    if (urls.size() > 0) { convertUrls(urls, source.priority, source.cancel); }
+}
+
+void MainWindow::scanFinished(int files,
+                              int scan)
+{
+    Q_UNUSED(files)
+    _scans.remove(scan);
 }
 
-void MainWindow::convertUrls(QList<QUrl> urls)
+void MainWindow::convertUrls(const QList<QUrl> &urls,
+                             int priority,
+                             const std::shared_ptr<QAtomicInt> &cancel)
 {
-    qDebug() << "convertUrls" << urls;
+    qDebug() << "convertUrls" << urls.size() << priority;
 
     QString outputColorProfile = ui->selectedProfile->itemData(ui->selectedProfile->currentIndex()).toString();
-
-    if (outputColorProfile.isEmpty()) {
+    Converter::Profile outputProfile;
+    if (!outputColorProfile.isEmpty()) { outputProfile = ProfileRegistry::instance()->load(outputColorProfile); }
+    if (outputProfile.cs == Converter::colorSpaceUnknown) {
+        for (int i = 0; i < urls.size(); ++i) {
+            _queued.remove(urls.at(i).toLocalFile());
+        }
         Q_EMIT showWarning(tr("Missing output profile"),
                            tr("No output profile selected, unable to convert."));
-        Q_EMIT stopProgress();
         return;
     }
 
-    QByteArray outputProfileData = fileToByteArray(outputColorProfile);
-    if (!isValidProfile(outputProfileData)) {
-        Q_EMIT showWarning(tr("Missing output profile"),
-                           tr("No output profile selected, unable to convert."));
-        Q_EMIT stopProgress();
-        return;
+    Converter::Options options;
+    options.outputProfile = outputProfile.data;
+    options.intent = (Converter::RenderingIntent)ui->selectedIntent->itemData(ui->selectedIntent->currentIndex()).toInt();
+    options.blackPoint = ui->blackPoint->isChecked();
+    QSettings settings;
+    if (settings.value("mode").toString() == QString("magick")) {
+        options.mode = Converter::MagickConversionMode;
+    } else if (settings.value("mode").toString() == QString("stream")) {
+        options.mode = Converter::StreamConversionMode;
     }
-
-    RenderingIntent intent = (RenderingIntent)ui->selectedIntent->itemData(ui->selectedIntent->currentIndex()).toInt();
-
-    QString suf;
-    switch (getFileColorspace(outputProfileData)) {
-    case colorSpaceCMYK:
-        suf = QString("CMYK");
-        break;
-    case colorSpaceGRAY:
-        suf = QString("GRAY");
-        break;
-    default:
-        suf = QString("RGB");
+    options.pipeline = settings.value("pipeline", false).toBool();
+    options.lut = settings.value("lut", false).toBool();
+    options.incremental = settings.value("incremental", false).toBool();
+    options.memoryLimit = settings.value("memory", 0).toLongLong() * 1024 * 1024;
+    options.suffix = Converter::colorSpaceSuffix(outputProfile.cs);
+
+    // the profiles checked under the targets button are written from the
+    // same decode, with the intent and black point compensation above
+    QStringList paths(outputColorProfile);
+    QList<QAction*> actions = _targets->actions();
+    for (int i = 0; i < actions.size(); ++i) {
+        QString path = actions.at(i)->data().toString();
+        if (!actions.at(i)->isChecked() || paths.contains(path)) { continue; }
+        Converter::Profile profile = ProfileRegistry::instance()->load(path);
+        if (profile.cs == Converter::colorSpaceUnknown) { continue; }
+        if (options.targets.isEmpty()) { options.targets = Converter::outputTargets(options); }
+        Converter::Target target;
+        target.outputProfile = profile.data;
+        target.intent = options.intent;
+        target.blackPoint = options.blackPoint;
+        options.targets.append(target);
+        paths.append(path);
     }
 
-    for (int i = 0; i < urls.size(); ++i) {
-        QString filename = urls.at(i).toLocalFile();
-        QFileInfo fileInfo(filename);
-        QString ext = fileInfo.suffix().toLower();
-        int counter = 1;
-        QString filePath = fileInfo.absolutePath();
-        if (!fileInfo.isWritable()) {
-            filePath = QStandardPaths::writableLocation(QStandardPaths::DesktopLocation);
-            if (filePath.isEmpty()) {
-                filePath = QDir::homePath();
-            }
-        }
-        QString oFilename = QString("%4/%1_%2.%3").arg(fileInfo.baseName()).arg(suf).arg(ext).arg(filePath);
-        if (QFile::exists(oFilename)) {
-            while (QFile::exists(QString("%5/%1_%2_copy%4.%3").arg(fileInfo.baseName()).arg(suf).arg(ext).arg(counter).arg(filePath))) {
-                counter++;
-            }
-            oFilename = QString("%5/%1_%2_copy%4.%3").arg(fileInfo.baseName()).arg(suf).arg(ext).arg(counter).arg(filePath);
-        }
-
-        qDebug() << "CONVERT" << filename << oFilename;
+    // targets in the same colour space get the profile name in their
+    // suffix, or they would only differ by a _copyN
+    QHash<int, int> spaces;
+    for (int i = 0; i < options.targets.size(); ++i) {
+        spaces[Converter::profileColorspace(options.targets.at(i).outputProfile)]++;
+    }
+    for (int i = 0; i < options.targets.size(); ++i) {
+        Converter::colorSpace cs = Converter::profileColorspace(options.targets.at(i).outputProfile);
+        if (spaces.value(cs) < 2) { continue; }
+        options.targets[i].suffix = QString("%1_%2").arg(Converter::colorSpaceSuffix(cs))
+                                                    .arg(QFileInfo(paths.at(i)).completeBaseName());
+    }
 
-        Magick::Image image;
-        try {
-            image.read(filename.toStdString());
-        }
-        catch(Magick::Error &error ) { qWarning() << error.what(); }
-        catch(Magick::Warning &warn ) { qWarning() << warn.what(); }
-        try {
-            QByteArray inputProfileData;
-            switch(image.colorSpace()) {
-            case Magick::CMYKColorspace:
-                inputProfileData = _iccCmyk;
-                break;
-            case Magick::GRAYColorspace:
-                inputProfileData = _iccGray;
-                break;
-            default:
-                inputProfileData = _iccRgb;
-            }
-            Magick::Blob inputProfile(inputProfileData.data(), inputProfileData.size());
-            Magick::Blob outputProfile(outputProfileData.data(), outputProfileData.size());
-            image.quiet(true);
-            if (image.colorSpace() == Magick::YCbCrColorspace) {
-                image.colorSpace(Magick::sRGBColorspace);
-            }
-            switch (intent) {
-            case SaturationRenderingIntent:
-                image.renderingIntent(Magick::SaturationIntent);
-                break;
-            case PerceptualRenderingIntent:
-                image.renderingIntent(Magick::PerceptualIntent);
-                break;
-            case AbsoluteRenderingIntent:
-                image.renderingIntent(Magick::AbsoluteIntent);
-                break;
-            case RelativeRenderingIntent:
-                image.renderingIntent(Magick::RelativeIntent);
-                break;
-            default:;
-            }
-
-            image.blackPointCompensation(ui->blackPoint->isChecked());
-
-            if (image.iccColorProfile().length() == 0) {
-                image.profile("ICC", inputProfile);
-            }
-            image.profile("ICC", outputProfile);
-        }
-        catch(Magick::Error &error ) { qWarning() << error.what(); }
-        catch(Magick::Warning &warn ) { qWarning() << warn.what(); }
-        try {
-            image.write(oFilename.toStdString());
+    if (_scheduler->submit(urls, options, static_cast<JobScheduler::Priority>(priority), cancel) == 0) {
+        for (int i = 0; i < urls.size(); ++i) {
+            _queued.remove(urls.at(i).toLocalFile());
         }
-        catch(Magick::Error &error ) { qWarning() << error.what(); }
-        catch(Magick::Warning &warn ) { qWarning() << warn.what(); }
     }
-    Q_EMIT convertDone();
+}
+
+void MainWindow::convertedFile(int job,
+                               const Converter::Result &result)
+{
+    Q_UNUSED(job)
+    _queued.remove(result.filename);
+    if (result.success || result.cancelled) { return; }
+    qWarning() << result.filename << result.error;
+    _failed << QString("%1: %2").arg(QFileInfo(result.filename).fileName()).arg(result.error);
 }
 
 void MainWindow::convertedUrls()
 {
+    JobScheduler::Progress progress = _scheduler->progress();
     progressClear();
-    if (!_queue.isEmpty()) {
-        progressBusy();
-        QtConcurrent::run(this, &MainWindow::convertUrls, _queue);
-        _queue.clear();
+    if (_failed.size() > 0) {
+        Q_EMIT showWarning(tr("Conversion failed"),
+                           tr("Unable to convert %1 of %2 file(s):\n\n%3").arg(_failed.size()).arg(progress.files).arg(_failed.join("\n")));
     }
+    _failed.clear();
 }
 
 void MainWindow::handleArgs(QStringList args)
@@ -313,206 +355,151 @@ void MainWindow::handleWarning(const QString &title, const QString &msg)
     QMessageBox::warning(this, title, msg);
 }
 
-QByteArray MainWindow::fileToByteArray(const QString &filename)
+void MainWindow::handleJobsChanged(int jobs)
 {
-    if (QFile::exists(filename)) {
-        QFile file(filename);
-        if (file.open(QIODevice::ReadOnly)) {
-            QByteArray profile =  file.readAll();
-            file.close();
-            if (profile.size() > 0) {
-                return profile;
-            }
-        }
-    }
-    return QByteArray();
+    _converter->setMaxJobs(jobs);
+    QSettings settings;
+    settings.setValue("jobs", jobs);
 }
 
-bool MainWindow::isValidImage(const QString &filename)
+void MainWindow::previewToggled(bool checked)
 {
-    QStringList supported;
-    supported << "image/jpeg" << "image/png" << "image/tiff";
-    if (QFile::exists(filename)) {
-        QMimeDatabase db;
-        QMimeType type = db.mimeTypeForFile(filename);
-        if (supported.contains(type.name())) { return true; }
+    ui->logo->setVisible(!checked);
+    ui->version->setVisible(!checked);
+    ui->info->setVisible(!checked);
+    ui->preview->setVisible(checked);
+    if (checked) {
+        resize(qMax(width(), 640), qMax(height(), 640));
+        previewUpdate();
     }
-    return false;
 }
 
-bool MainWindow::isValidProfile(QByteArray buffer)
+void MainWindow::previewUpdate()
 {
-    if (buffer.size() > 0) {
-        if (getFileColorspace(buffer) != colorSpaceUnknown) { return true; }
-    }
-    return false;
+    if (!ui->previewButton->isChecked()) { return; }
+    QString outputColorProfile = ui->selectedProfile->itemData(ui->selectedProfile->currentIndex()).toString();
+    if (outputColorProfile.isEmpty()) { return; }
+    QString monitorColorProfile = ui->monitorProfile->itemData(ui->monitorProfile->currentIndex()).toString();
+
+    // only the transforms run again, the decoded preview is kept
+    Previewer::Settings settings;
+    settings.output = ProfileRegistry::instance()->load(outputColorProfile);
+    if (!monitorColorProfile.isEmpty()) { settings.monitor = ProfileRegistry::instance()->load(monitorColorProfile); }
+    settings.intent = (Converter::RenderingIntent)ui->selectedIntent->itemData(ui->selectedIntent->currentIndex()).toInt();
+    settings.blackPoint = ui->blackPoint->isChecked();
+    _previewer->render(settings);
 }
 
-MainWindow::colorSpace MainWindow::getFileColorspace(cmsHPROFILE profile)
+void MainWindow::previewRendered(const QImage &image,
+                                 qint64 elapsed)
 {
-    colorSpace cs = colorSpaceUnknown;
-    if (profile) {
-        if (cmsGetColorSpace(profile) == cmsSigRgbData) {
-            cs = colorSpaceRGB;
-        } else if (cmsGetColorSpace(profile) == cmsSigCmykData) {
-            cs = colorSpaceCMYK;
-        } else if (cmsGetColorSpace(profile) == cmsSigGrayData) {
-            cs = colorSpaceGRAY;
-        }
-    }
-    cmsCloseProfile(profile);
-    return cs;
+    qDebug() << "preview" << _previewer->filename() << elapsed << "ms";
+    _preview = image;
+    previewShow();
 }
 
-MainWindow::colorSpace MainWindow::getFileColorspace(const QString &filename)
+void MainWindow::previewFailed(const QString &filename,
+                               const QString &error)
 {
-    if (QFile::exists(filename)) {
-        return getFileColorspace(cmsOpenProfileFromFile(filename.toStdString().c_str(), "r"));
-    }
-    return colorSpaceUnknown;
+    Q_EMIT showWarning(tr("Preview failed"),
+                       tr("Unable to preview %1:\n\n%2").arg(QFileInfo(filename).fileName()).arg(error));
 }
 
-MainWindow::colorSpace MainWindow::getFileColorspace(QByteArray buffer)
+void MainWindow::previewShow()
 {
-    if (buffer.size()>0) {
-        return getFileColorspace(cmsOpenProfileFromMem(buffer.data(),
-                                                       static_cast<cmsUInt32Number>(buffer.size())));
-    }
-    return colorSpaceUnknown;
+    if (_preview.isNull()) { return; }
+    ui->preview->setPixmap(QPixmap::fromImage(_preview).scaled(ui->preview->size(),
+                                                               Qt::KeepAspectRatio,
+                                                               Qt::SmoothTransformation));
 }
 
-QString MainWindow::getProfileTag(cmsHPROFILE profile, MainWindow::ICCTag tag)
+void MainWindow::refreshColorProfiles()
 {
-    QString result;
-    if (profile) {
-        cmsUInt32Number size = 0;
-        cmsInfoType cmsSelectedType;
-        switch(tag) {
-        case ICCManufacturer:
-            cmsSelectedType = cmsInfoManufacturer;
-            break;
-        case ICCModel:
-            cmsSelectedType = cmsInfoModel;
-            break;
-        case ICCCopyright:
-            cmsSelectedType = cmsInfoCopyright;
-            break;
-        default:
-            cmsSelectedType = cmsInfoDescription;
-        }
-        size = cmsGetProfileInfoASCII(profile, cmsSelectedType,
-                                      "en", "US", nullptr, 0);
-        if (size > 0) {
-            std::vector<char> buffer(size);
-            cmsUInt32Number newsize = cmsGetProfileInfoASCII(profile, cmsSelectedType,
-                                          "en", "US", &buffer[0], size);
-            if (size == newsize) {
-                result = buffer.data();
-            }
-        }
-    }
-    cmsCloseProfile(profile);
-    return result;
+    QString current = ui->selectedProfile->itemData(ui->selectedProfile->currentIndex()).toString();
 
-}
+    ui->selectedProfile->blockSignals(true);
+    ui->selectedProfile->clear();
 
-QString MainWindow::getProfileTag(const QString &filename, MainWindow::ICCTag tag)
-{
-    if (QFile::exists(filename)) {
-        return getProfileTag(cmsOpenProfileFromFile(filename.toStdString().c_str(), "r"), tag);
-    }
-    return "";
-}
+    QIcon itemIcon(":/fargerom.png");
+    QString noProfileText = tr("Select output");
+    ui->selectedProfile->addItem(itemIcon, noProfileText);
+    ui->selectedProfile->insertSeparator(1);
 
-QString MainWindow::getProfileTag(QByteArray buffer, MainWindow::ICCTag tag)
-{
-    if (buffer.size()>0) {
-        return getProfileTag(cmsOpenProfileFromMem(buffer.data(),
-                                                   static_cast<cmsUInt32Number>(buffer.size())),tag);
-    }
-    return "";
-}
+    populateColorProfiles(Converter::colorSpaceRGB, ui->selectedProfile);
+    populateColorProfiles(Converter::colorSpaceCMYK, ui->selectedProfile);
+    populateColorProfiles(Converter::colorSpaceGRAY, ui->selectedProfile);
 
-void MainWindow::populateColorProfiles(MainWindow::colorSpace cs, QComboBox *box, bool proof)
-{
-    Q_UNUSED(proof)
-    if (!box) { return; }
+    int index = current.isEmpty() ? -1 : ui->selectedProfile->findData(current);
+    ui->selectedProfile->setCurrentIndex(index > 0 ? index : 0);
+    ui->selectedProfile->blockSignals(false);
 
-    /*QString defaultProfile;
-    int defaultIndex = -1;
-    QSettings settings;
-    settings.beginGroup("profiles");
-    QString profileType;
-    if (isMonitor) {
-        profileType = "monitor";
-    } else {
-        profileType = QString::number(colorspace);
-    }
-    if (!settings.value(profileType).toString().isEmpty()) {
-        defaultProfile = settings.value(profileType).toString();
-    }
-    settings.endGroup();*/
-
-    QMap<QString,QString> profiles = getProfiles(cs);
-    if (profiles.size() > 0) {
-        //box->clear();
-        QIcon itemIcon(":/fargerom.png");
-        /*QString noProfileText = tr("Select ...");
-        if (proof) {
-            noProfileText = tr("None");
-        }
-        box->addItem(itemIcon, noProfileText);
-        box->insertSeparator(1);*/
+    QString monitor = ui->monitorProfile->itemData(ui->monitorProfile->currentIndex()).toString();
+    ui->monitorProfile->blockSignals(true);
+    ui->monitorProfile->clear();
+    ui->monitorProfile->addItem(itemIcon, tr("Default monitor"));
+    ui->monitorProfile->insertSeparator(1);
+    populateColorProfiles(Converter::colorSpaceRGB, ui->monitorProfile);
+    index = monitor.isEmpty() ? -1 : ui->monitorProfile->findData(monitor);
+    ui->monitorProfile->setCurrentIndex(index > 0 ? index : 0);
+    ui->monitorProfile->blockSignals(false);
 
-        int it = 0;
-        QMapIterator<QString, QString> profile(profiles);
+    QSettings settings;
+    QStringList targets = settings.value("targets").toStringList();
+    _targets->clear();
+    QList<Converter::colorSpace> spaces;
+    spaces << Converter::colorSpaceRGB << Converter::colorSpaceCMYK << Converter::colorSpaceGRAY;
+    for (int i = 0; i < spaces.size(); ++i) {
+        if (i > 0) { _targets->addSeparator(); }
+        QMapIterator<QString, QString> profile(_catalog->profiles(spaces.at(i)));
         while (profile.hasNext()) {
             profile.next();
-            box->addItem(itemIcon, profile.key(), profile.value());
-            //if (profile.value() == defaultProfile) { defaultIndex = it+2; }
-            ++it;
+            QAction *action = _targets->addAction(profile.key());
+            action->setData(profile.value());
+            action->setCheckable(true);
+            action->setChecked(targets.contains(profile.value()));
+            QObject::connect(action, SIGNAL(toggled(bool)),
+                             this, SLOT(targetsChanged()));
         }
-        /*if (defaultIndex >= 0) {
-            box->setCurrentIndex(defaultIndex);
-        }*/
     }
+    targetsChanged();
+}
 
+void MainWindow::targetsChanged()
+{
+    QStringList targets;
+    QList<QAction*> actions = _targets->actions();
+    for (int i = 0; i < actions.size(); ++i) {
+        if (actions.at(i)->isChecked()) { targets << actions.at(i)->data().toString(); }
+    }
+    ui->targetsButton->setText(targets.isEmpty() ? QString("+") : QString("+%1").arg(targets.size()));
+    ui->targetsButton->setToolTip(targets.isEmpty() ? tr("More output profiles converted from the same decode")
+                                                    : targets.join("\n"));
+    if (!_targets->isEmpty()) {
+        QSettings settings;
+        settings.setValue("targets", targets);
+    }
 }
 
-QMap<QString, QString> MainWindow::getProfiles(MainWindow::colorSpace colorspace)
+void MainWindow::populateColorProfiles(Converter::colorSpace cs, QComboBox *box)
 {
-    QMap<QString,QString> output;
-    QStringList folders;
-    folders << QDir::rootPath() + "/WINDOWS/System32/spool/drivers/color";
-    folders << "/Library/ColorSync/Profiles";
-    folders << QDir::homePath() + "/Library/ColorSync/Profiles";
-    folders << "/usr/share/color/icc";
-    folders << "/usr/local/share/color/icc";
-    folders << qApp->applicationDirPath() + "/../share/color/icc";
-    folders << QDir::homePath() + "/.color/icc";
-    folders << QDir::homePath() + "/.config/Cyan/icc";
-    folders << qApp->applicationDirPath() + "/profiles";
-    folders << qApp->applicationDirPath() + "/icc";
-
-    for (int i = 0; i < folders.size(); ++i) {
-        QStringList filter;
-        filter << "*.icc" << "*.icm";
-        QDirIterator it(folders.at(i), filter, QDir::Files, QDirIterator::Subdirectories);
-        while (it.hasNext()) {
-            QString iccFile = it.next();
-            QString profile = getProfileTag(iccFile, ICCDescription);
-            if (iccFile.isEmpty() || profile.isEmpty()) { continue; }
-            if (getFileColorspace(iccFile) != colorspace) { continue; }
-            output[profile] = iccFile;
-        }
+    if (!box) { return; }
+    QIcon itemIcon(":/fargerom.png");
+    QMapIterator<QString, QString> profile(_catalog->profiles(cs));
+    while (profile.hasNext()) {
+        profile.next();
+        box->addItem(itemIcon, profile.key(), profile.value());
     }
-    return output;
 }
 
 void MainWindow::dropEvent(QDropEvent *event)
 {
     const QMimeData* mimeData = event->mimeData();
-    if (mimeData->hasUrls()) {
+    if (!mimeData->hasUrls()) { return; }
+
+    // shift-drops jump ahead of everything already queued
+    if (event->keyboardModifiers() & Qt::ShiftModifier) {
+        scanUrls(mimeData->urls(), JobScheduler::HighPriority);
+    } else {
         Q_EMIT droppedUrls(mimeData->urls());
     }
 }
@@ -522,3 +509,9 @@ void MainWindow::dragEnterEvent(QDragEnterEvent *event)
     event->acceptProposedAction();
 }
 
+void MainWindow::resizeEvent(QResizeEvent *event)
+{
+    QMainWindow::resizeEvent(event);
+    previewShow();
+}
+
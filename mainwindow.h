@@ -28,9 +28,18 @@
 #include <QByteArray>
 #include <QStringList>
 #include <QComboBox>
+#include <QMenu>
 #include <QMap>
+#include <QHash>
+#include <QSet>
+#include <QImage>
+#include <QResizeEvent>
 
-#include <lcms2.h>
+#include "converter.h"
+#include "profilecatalog.h"
+#include "filescanner.h"
+#include "jobscheduler.h"
+#include "previewer.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -41,69 +50,69 @@ class MainWindow : public QMainWindow
     Q_OBJECT
 
 public:
-
-    enum colorSpace {
-        colorSpaceUnknown,
-        colorSpaceRGB,
-        colorSpaceCMYK,
-        colorSpaceGRAY
-    };
-    enum ICCTag {
-        ICCDescription,
-        ICCManufacturer,
-        ICCModel,
-        ICCCopyright
-    };
-    enum RenderingIntent {
-        UndefinedRenderingIntent,
-        SaturationRenderingIntent,
-        PerceptualRenderingIntent,
-        AbsoluteRenderingIntent,
-        RelativeRenderingIntent
-    };
-
     MainWindow(QStringList args, QWidget *parent = nullptr);
     ~MainWindow();
 
 Q_SIGNALS:
     void droppedUrls(QList<QUrl> urls);
-    void convertDone();
     void showWarning(const QString &title, const QString &msg);
-    void stopProgress();
 
 private Q_SLOTS:
     void setupTheme();
     void setupInfo();
     void setupICC();
-    void progressBusy();
+    void progressUpdate();
     void progressClear();
     void handleUrls(QList<QUrl> urls);
-    void convertUrls(QList<QUrl> urls);
+    void scanUrls(const QList<QUrl> &urls,
+                  int priority);
+    void queueFiles(const QStringList &files,
+                    int scan);
+    void scanFinished(int files,
+                      int scan);
+    void convertUrls(const QList<QUrl> &urls,
+                     int priority,
+                     const std::shared_ptr<QAtomicInt> &cancel = std::shared_ptr<QAtomicInt>());
+    void convertedFile(int job,
+                       const Converter::Result &result);
     void convertedUrls();
     void handleArgs(QStringList args);
     void handleWarning(const QString &title, const QString &msg);
-    QByteArray fileToByteArray(const QString &filename);
-    bool isValidImage(const QString &filename);
-    bool isValidProfile(QByteArray buffer);
-    colorSpace getFileColorspace(cmsHPROFILE profile);
-    colorSpace getFileColorspace(const QString &filename);
-    colorSpace getFileColorspace(QByteArray buffer);
-    QString getProfileTag(cmsHPROFILE profile, ICCTag tag);
-    QString getProfileTag(const QString &filename, ICCTag tag);
-    QString getProfileTag(QByteArray buffer, ICCTag tag);
-    void populateColorProfiles(colorSpace cs, QComboBox *box, bool proof);
-    QMap<QString, QString> getProfiles(colorSpace colorspace);
+    void handleJobsChanged(int jobs);
+    void previewToggled(bool checked);
+    void previewUpdate();
+    void previewRendered(const QImage &image,
+                         qint64 elapsed);
+    void previewFailed(const QString &filename,
+                       const QString &error);
+    void previewShow();
+    void refreshColorProfiles();
+    void targetsChanged();
+    void populateColorProfiles(Converter::colorSpace cs, QComboBox *box);
 
 private:
+    struct Scan
+    {
+        int priority = 0;
+        std::shared_ptr<QAtomicInt> cancel;
+    };
+
     Ui::MainWindow *ui;
-    QList<QUrl> _queue;
-    bool _isBusy;
-    QByteArray _iccRgb;
-    QByteArray _iccCmyk;
-    QByteArray _iccGray;
+    Converter *_converter;
+    ProfileCatalog *_catalog;
+    FileScanner *_scanner;
+    JobScheduler *_scheduler;
+    Previewer *_previewer;
+    QMenu *_targets;
+    QImage _preview;
+    QSet<QString> _queued;
+    QStringList _failed;
+    QHash<int, Scan> _scans;
+    int _nextScan;
 
 protected:
     void dropEvent(QDropEvent *event) override;
     void dragEnterEvent(QDragEnterEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
 };
 #endif // MAINWINDOW_H
@@ -0,0 +1,208 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include "manifest.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#define MANIFEST_MAGIC 0x4652434d
+#define MANIFEST_VERSION 2
+
+Manifest::Manifest(const QString &filename)
+    : _filename(filename.isEmpty() ? defaultFile() : filename)
+{
+}
+
+QString Manifest::defaultFile()
+{
+    return QString("%1/manifest.cache").arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+}
+
+QByteArray Manifest::hashFile(const QString &filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) { return QByteArray(); }
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    if (!hash.addData(&file)) { return QByteArray(); }
+    return hash.result();
+}
+
+QString Manifest::filename() const
+{
+    return _filename;
+}
+
+bool Manifest::load()
+{
+    QHash<QString, Entry> entries;
+    if (!read(_filename, &entries)) { return false; }
+
+    QMutexLocker lock(&_mutex);
+    _entries = entries;
+    _inserted.clear();
+    return true;
+}
+
+bool Manifest::read(const QString &filename,
+                    QHash<QString, Entry> *entries)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) { return false; }
+
+    QDataStream stream(&file);
+    quint32 magic = 0;
+    quint32 version = 0;
+    quint32 count = 0;
+    stream >> magic >> version >> count;
+    if (magic != MANIFEST_MAGIC || version != MANIFEST_VERSION) { return false; }
+
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        Entry entry;
+        stream >> entry.input >> entry.size >> entry.modified >> entry.hash
+               >> entry.settings.profile >> entry.settings.intent >> entry.settings.blackPoint
+               >> entry.settings.suffix >> entry.settings.mode >> entry.settings.lut
+               >> entry.output >> entry.outputSize >> entry.outputModified;
+        entries->insert(key(entry.input, entry.settings), entry);
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+bool Manifest::save()
+{
+    QDir().mkpath(QFileInfo(_filename).absolutePath());
+
+    // batches running side by side share the file, so what they saved in
+    // the meantime is read again and only the entries of this batch are
+    // laid over it
+    QLockFile lockFile(_filename + QString(".lock"));
+    if (!lockFile.lock()) { return false; }
+    QHash<QString, Entry> entries;
+    read(_filename, &entries);
+
+    QMutexLocker lock(&_mutex);
+    QSetIterator<QString> inserted(_inserted);
+    while (inserted.hasNext()) {
+        const QString &name = inserted.next();
+        entries.insert(name, _entries.value(name));
+    }
+    _entries = entries;
+    _inserted.clear();
+
+    QSaveFile file(_filename);
+    if (!file.open(QIODevice::WriteOnly)) { return false; }
+    QDataStream stream(&file);
+    stream << quint32(MANIFEST_MAGIC) << quint32(MANIFEST_VERSION) << quint32(_entries.size());
+    QHashIterator<QString, Entry> it(_entries);
+    while (it.hasNext()) {
+        it.next();
+        const Entry &entry = it.value();
+        stream << entry.input << entry.size << entry.modified << entry.hash
+               << entry.settings.profile << entry.settings.intent << entry.settings.blackPoint
+               << entry.settings.suffix << entry.settings.mode << entry.settings.lut
+               << entry.output << entry.outputSize << entry.outputModified;
+    }
+    return file.commit();
+}
+
+bool Manifest::lookup(const QString &input,
+                      const Settings &settings,
+                      const QString &directory,
+                      Lookup *result) const
+{
+    QFileInfo info(input);
+    result->size = info.size();
+    result->modified = info.lastModified().toMSecsSinceEpoch();
+    result->output.clear();
+
+    Entry entry;
+    bool found = false;
+    {
+        QMutexLocker lock(&_mutex);
+        QHash<QString, Entry>::const_iterator it = _entries.constFind(key(input, settings));
+        if (it != _entries.constEnd()) {
+            entry = it.value();
+            found = true;
+        }
+    }
+
+    // a file with the same size and time is taken to be unchanged, the
+    // content is only hashed when one of them differs
+    if (found && entry.size == result->size && entry.modified == result->modified) {
+        result->hash = entry.hash;
+    } else {
+        result->hash = hashFile(input);
+    }
+    if (!found || result->hash.isEmpty() || result->hash != entry.hash) { return false; }
+
+    // the earlier output must still be there, untouched and where this
+    // batch would write it
+    QFileInfo output(entry.output);
+    if (!output.exists() ||
+        output.size() != entry.outputSize ||
+        output.lastModified().toMSecsSinceEpoch() != entry.outputModified ||
+        QDir(output.absolutePath()) != QDir(directory)) { return false; }
+
+    result->output = entry.output;
+    return true;
+}
+
+void Manifest::insert(const QString &input,
+                      const Settings &settings,
+                      const Lookup &lookup,
+                      const QString &output)
+{
+    QFileInfo info(output);
+    Entry entry;
+    entry.input = input;
+    entry.size = lookup.size;
+    entry.modified = lookup.modified;
+    entry.hash = lookup.hash;
+    entry.settings = settings;
+    entry.output = output;
+    entry.outputSize = info.size();
+    entry.outputModified = info.lastModified().toMSecsSinceEpoch();
+
+    const QString name = key(input, settings);
+    QMutexLocker lock(&_mutex);
+    _entries.insert(name, entry);
+    _inserted.insert(name);
+}
+
+QString Manifest::key(const QString &input,
+                      const Settings &settings)
+{
+    return QString("%1|%2|%3|%4|%5|%6|%7")
+            .arg(QFileInfo(input).absoluteFilePath())
+            .arg(QString::fromLatin1(settings.profile.toHex()))
+            .arg(settings.intent)
+            .arg(settings.blackPoint ? 1 : 0)
+            .arg(settings.suffix)
+            .arg(settings.mode)
+            .arg(settings.lut ? 1 : 0);
+}
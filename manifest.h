@@ -0,0 +1,93 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+
+class Manifest
+{
+public:
+
+    // everything that changes the output of one target
+    struct Settings
+    {
+        QByteArray profile;
+        quint32 intent = 0;
+        bool blackPoint = true;
+        QString suffix;
+        quint32 mode = 0;
+        bool lut = false;
+    };
+
+    struct Entry
+    {
+        QString input;
+        qint64 size = 0;
+        qint64 modified = 0;
+        QByteArray hash;
+        Settings settings;
+        QString output;
+        qint64 outputSize = 0;
+        qint64 outputModified = 0;
+    };
+
+    struct Lookup
+    {
+        QByteArray hash;
+        qint64 size = 0;
+        qint64 modified = 0;
+        QString output;
+    };
+
+    explicit Manifest(const QString &filename = QString());
+
+    static QString defaultFile();
+    static QByteArray hashFile(const QString &filename);
+
+    QString filename() const;
+    bool load();
+    bool save();
+    bool lookup(const QString &input,
+                const Settings &settings,
+                const QString &directory,
+                Lookup *result) const;
+    void insert(const QString &input,
+                const Settings &settings,
+                const Lookup &lookup,
+                const QString &output);
+
+private:
+    static bool read(const QString &filename,
+                     QHash<QString, Entry> *entries);
+    static QString key(const QString &input,
+                       const Settings &settings);
+
+    QString _filename;
+    mutable QMutex _mutex;
+    QHash<QString, Entry> _entries;
+    QSet<QString> _inserted;
+};
+
+#endif // MANIFEST_H
@@ -0,0 +1,92 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include "memorybudget.h"
+
+#include <QMutexLocker>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#elif defined(Q_OS_UNIX)
+#include <unistd.h>
+#endif
+
+MemoryBudget::MemoryBudget(qint64 limit)
+    : _limit(limit)
+    , _used(0)
+{
+    if (_limit <= 0) { _limit = physicalMemory() / 2; }
+}
+
+qint64 MemoryBudget::limit() const
+{
+    QMutexLocker lock(&_mutex);
+    return _limit;
+}
+
+void MemoryBudget::setLimit(qint64 limit)
+{
+    QMutexLocker lock(&_mutex);
+    _limit = limit > 0 ? limit : physicalMemory() / 2;
+    _released.wakeAll();
+}
+
+qint64 MemoryBudget::used() const
+{
+    QMutexLocker lock(&_mutex);
+    return _used;
+}
+
+qint64 MemoryBudget::acquire(qint64 bytes)
+{
+    QMutexLocker lock(&_mutex);
+    // an image larger than the whole budget still runs, but alone
+    if (bytes > _limit) { bytes = _limit; }
+    while (_used > 0 && _used + bytes > _limit) {
+        _released.wait(&_mutex);
+    }
+    _used += bytes;
+    return bytes;
+}
+
+void MemoryBudget::release(qint64 bytes)
+{
+    QMutexLocker lock(&_mutex);
+    _used -= bytes;
+    if (_used < 0) { _used = 0; }
+    _released.wakeAll();
+}
+
+qint64 MemoryBudget::physicalMemory()
+{
+#if defined(Q_OS_WIN)
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status)) {
+        return static_cast<qint64>(status.ullTotalPhys);
+    }
+#elif defined(Q_OS_UNIX)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long size = sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && size > 0) {
+        return static_cast<qint64>(pages) * size;
+    }
+#endif
+    return Q_INT64_C(4294967296);
+}
@@ -0,0 +1,47 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QMutex>
+#include <QWaitCondition>
+
+class MemoryBudget
+{
+public:
+    explicit MemoryBudget(qint64 limit = 0);
+
+    qint64 limit() const;
+    void setLimit(qint64 limit);
+    qint64 used() const;
+
+    qint64 acquire(qint64 bytes);
+    void release(qint64 bytes);
+
+    static qint64 physicalMemory();
+
+private:
+    mutable QMutex _mutex;
+    QWaitCondition _released;
+    qint64 _limit;
+    qint64 _used;
+};
+
+#endif // MEMORYBUDGET_H
@@ -0,0 +1,305 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#include "previewer.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <Magick++.h>
+#include <tiffio.h>
+#include <lcms2.h>
+
+#include <vector>
+#include <cstring>
+
+#include "bandprocessor.h"
+#include "filescanner.h"
+#include "profileregistry.h"
+#include "transformcache.h"
+
+#define PREVIEW_SIZE 1024
+
+// the downscaled source, kept as 8-bit pixels so profile, intent and
+// black point changes only run the transforms again
+struct Previewer::Source
+{
+    QString filename;
+    QString error;
+    Converter::Profile input;
+    Converter::colorSpace cs = Converter::colorSpaceUnknown;
+    size_t width = 0;
+    size_t height = 0;
+    std::vector<unsigned char> pixels;
+};
+
+Previewer::Previewer(QObject *parent)
+    : QObject(parent)
+    , _size(PREVIEW_SIZE)
+    , _dirty(false)
+{
+    // one decode and one render at a time, newer requests replace the
+    // waiting one instead of queueing up behind it
+    _pool.setMaxThreadCount(2);
+    connect(&_loading, SIGNAL(finished()), this, SLOT(loadDone()));
+    connect(&_rendering, SIGNAL(finished()), this, SLOT(renderDone()));
+}
+
+Previewer::~Previewer()
+{
+    _pool.waitForDone();
+}
+
+int Previewer::size() const
+{
+    return _size;
+}
+
+void Previewer::setSize(int pixels)
+{
+    _size = qMax(64, pixels);
+}
+
+QString Previewer::filename() const
+{
+    return _filename;
+}
+
+void Previewer::load(const QString &filename)
+{
+    _filename = filename;
+    if (!_loading.isRunning()) { startLoad(); }
+}
+
+void Previewer::render(const Previewer::Settings &settings)
+{
+    _settings = settings;
+    _dirty = true;
+    if (!_rendering.isRunning()) { startRender(); }
+}
+
+void Previewer::loadDone()
+{
+    std::shared_ptr<const Source> source = _loading.result();
+    if (source->filename != _filename) {
+        startLoad();
+        return;
+    }
+    if (!source->error.isEmpty()) {
+        Q_EMIT failed(source->filename, source->error);
+        return;
+    }
+    _source = source;
+    _dirty = true;
+    if (!_rendering.isRunning()) { startRender(); }
+}
+
+void Previewer::renderDone()
+{
+    Frame frame = _rendering.result();
+    if (!frame.image.isNull()) { Q_EMIT rendered(frame.image, frame.elapsed); }
+    startRender();
+}
+
+void Previewer::startLoad()
+{
+    const QString filename = _filename;
+    const int size = _size;
+    _loading.setFuture(QtConcurrent::run(&_pool, [filename, size]() {
+        return decode(filename, size);
+    }));
+}
+
+void Previewer::startRender()
+{
+    if (!_source || !_dirty || _settings.output.cs == Converter::colorSpaceUnknown) { return; }
+    _dirty = false;
+    std::shared_ptr<const Source> source = _source;
+    const Settings settings = _settings;
+    _rendering.setFuture(QtConcurrent::run(&_pool, [source, settings]() {
+        return renderImage(*source, settings);
+    }));
+}
+
+std::shared_ptr<const Previewer::Source> Previewer::decode(const QString &filename,
+                                                           int size)
+{
+    std::shared_ptr<Source> source = std::make_shared<Source>();
+    source->filename = filename;
+
+    // the JPEG reader scales by 1/2, 1/4 or 1/8 in the DCT when it knows
+    // the size wanted, TIFF files are read from the smallest reduced
+    // resolution page still large enough
+    QString path = filename;
+    if (FileScanner::sniff(filename) == FileScanner::TiffFormat) {
+        int page = reducedPage(filename, size);
+        if (page > 0) { path = QString("%1[%2]").arg(filename).arg(page); }
+    }
+    QElapsedTimer timer;
+    timer.start();
+    Magick::Image image;
+    try {
+        image.quiet(true);
+        image.defineValue("jpeg", "size", QString("%1x%1").arg(size).toStdString());
+        image.read(path.toStdString());
+
+        Magick::Blob embedded = image.iccColorProfile();
+        if (embedded.length() > 0) {
+            source->input = Converter::loadProfile(QByteArray(static_cast<const char*>(embedded.data()),
+                                                              static_cast<int>(embedded.length())));
+        }
+        if (image.colorSpace() == Magick::YCbCrColorspace) {
+            image.colorSpace(Magick::sRGBColorspace);
+        }
+        switch (image.colorSpace()) {
+        case Magick::CMYKColorspace:
+            source->cs = Converter::colorSpaceCMYK;
+            break;
+        case Magick::GRAYColorspace:
+            source->cs = Converter::colorSpaceGRAY;
+            break;
+        default:
+            source->cs = Converter::colorSpaceRGB;
+        }
+        if (embedded.length() == 0 || source->input.cs != source->cs) {
+            source->input = ProfileRegistry::instance()->fallback(source->cs);
+        }
+
+        Magick::Geometry geometry(static_cast<size_t>(size), static_cast<size_t>(size));
+        geometry.greater(true);
+        image.resize(geometry);
+
+        source->width = image.columns();
+        source->height = image.rows();
+        source->pixels.resize(source->width * source->height * Converter::pixelChannels(source->cs, false));
+        const char *map = source->cs == Converter::colorSpaceCMYK ? "CMYK" : (source->cs == Converter::colorSpaceGRAY ? "I" : "RGB");
+        image.write(0, 0, source->width, source->height, map, Magick::CharPixel, source->pixels.data());
+    }
+    catch(Magick::Error &error ) {
+        source->error = QString::fromUtf8(error.what());
+    }
+    catch(Magick::Warning &warn ) { qWarning() << warn.what(); }
+    qDebug() << "preview decode" << path << source->width << source->height << timer.elapsed();
+    return source;
+}
+
+int Previewer::reducedPage(const QString &filename,
+                           int size)
+{
+#ifdef Q_OS_WIN
+    TIFF *tiff = TIFFOpenW(filename.toStdWString().c_str(), "r");
+#else
+    TIFF *tiff = TIFFOpen(QFile::encodeName(filename).constData(), "r");
+#endif
+    if (!tiff) { return 0; }
+    int page = 0;
+    int best = 0;
+    quint32 bestSize = 0;
+    do {
+        quint32 type = 0;
+        quint32 width = 0;
+        quint32 height = 0;
+        TIFFGetField(tiff, TIFFTAG_SUBFILETYPE, &type);
+        TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &width);
+        TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &height);
+        const quint32 longest = qMax(width, height);
+        if ((page == 0 || (type & FILETYPE_REDUCEDIMAGE)) &&
+            longest >= static_cast<quint32>(size) &&
+            (bestSize == 0 || longest < bestSize)) {
+            best = page;
+            bestSize = longest;
+        }
+        page++;
+    } while (TIFFReadDirectory(tiff));
+    TIFFClose(tiff);
+    return best;
+}
+
+Previewer::Frame Previewer::renderImage(const Source &source,
+                                        const Settings &settings)
+{
+    Frame frame;
+    QElapsedTimer timer;
+    timer.start();
+
+    // the source goes through the same cached transform as a conversion,
+    // then from the output to the monitor with the relative intent, so
+    // the preview shows what the output profile can reproduce
+    Converter::Profile monitor = settings.monitor.cs == Converter::colorSpaceRGB ? settings.monitor : ProfileRegistry::instance()->fallback(Converter::colorSpaceRGB);
+    const quint32 inputFormat = Converter::pixelFormat(source.cs, false, 1);
+    const quint32 outputFormat = Converter::pixelFormat(settings.output.cs, false, 1);
+    const quint32 monitorFormat = Converter::pixelFormat(Converter::colorSpaceRGB, false, 1);
+    TransformCache::Transform toOutput;
+    if (source.input.digest != settings.output.digest) {
+        toOutput = TransformCache::instance()->transform(source.input.data,
+                                                         source.input.digest,
+                                                         settings.output.data,
+                                                         settings.output.digest,
+                                                         inputFormat,
+                                                         outputFormat,
+                                                         Converter::lcmsIntent(settings.intent),
+                                                         settings.blackPoint);
+        if (!toOutput) { return frame; }
+    }
+    TransformCache::Transform toMonitor;
+    if (settings.output.digest != monitor.digest) {
+        toMonitor = TransformCache::instance()->transform(settings.output.data,
+                                                          settings.output.digest,
+                                                          monitor.data,
+                                                          monitor.digest,
+                                                          outputFormat,
+                                                          monitorFormat,
+                                                          INTENT_RELATIVE_COLORIMETRIC,
+                                                          false);
+        if (!toMonitor) { return frame; }
+    }
+
+    QImage image(static_cast<int>(source.width), static_cast<int>(source.height), QImage::Format_RGB888);
+    if (image.isNull()) { return frame; }
+    uchar *bits = image.bits();
+    const size_t bytesPerLine = static_cast<size_t>(image.bytesPerLine());
+    const size_t inputPixel = Converter::pixelChannels(source.cs, false);
+    const size_t outputPixel = Converter::pixelChannels(settings.output.cs, false);
+    const size_t width = source.width;
+    BandProcessor::run(source.height, BandProcessor::bandRows(width), 0,
+                       [&](size_t first, size_t count) {
+        std::vector<unsigned char> band;
+        const unsigned char *proofed = source.pixels.data() + first * width * inputPixel;
+        if (toOutput) {
+            band.resize(count * width * outputPixel);
+            cmsDoTransform(toOutput.get(), proofed, band.data(), static_cast<cmsUInt32Number>(count * width));
+            proofed = band.data();
+        }
+        for (size_t y = 0; y < count; ++y) {
+            uchar *line = bits + (first + y) * bytesPerLine;
+            if (toMonitor) {
+                cmsDoTransform(toMonitor.get(), proofed + y * width * outputPixel, line, static_cast<cmsUInt32Number>(width));
+            } else {
+                std::memcpy(line, proofed + y * width * outputPixel, width * outputPixel);
+            }
+        }
+    });
+    frame.image = image;
+    frame.elapsed = timer.elapsed();
+    qDebug() << "preview render" << source.filename << frame.elapsed;
+    return frame;
+}
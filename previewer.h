@@ -0,0 +1,96 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#ifndef PREVIEWER_H
+#define PREVIEWER_H
+
+#include <QObject>
+#include <QString>
+#include <QImage>
+#include <QThreadPool>
+#include <QFutureWatcher>
+
+#include <memory>
+
+#include "converter.h"
+
+class Previewer : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    struct Settings
+    {
+        Converter::Profile output;
+        Converter::Profile monitor;
+        Converter::RenderingIntent intent = Converter::PerceptualRenderingIntent;
+        bool blackPoint = true;
+    };
+
+    explicit Previewer(QObject *parent = nullptr);
+    ~Previewer();
+
+    int size() const;
+    void setSize(int pixels);
+    QString filename() const;
+
+public Q_SLOTS:
+    void load(const QString &filename);
+    void render(const Previewer::Settings &settings);
+
+Q_SIGNALS:
+    void rendered(const QImage &image,
+                  qint64 elapsed);
+    void failed(const QString &filename,
+                const QString &error);
+
+private Q_SLOTS:
+    void loadDone();
+    void renderDone();
+
+private:
+    struct Source;
+    struct Frame
+    {
+        QImage image;
+        qint64 elapsed = 0;
+    };
+
+    void startLoad();
+    void startRender();
+    static std::shared_ptr<const Source> decode(const QString &filename,
+                                                int size);
+    static int reducedPage(const QString &filename,
+                           int size);
+    static Frame renderImage(const Source &source,
+                             const Settings &settings);
+
+    QThreadPool _pool;
+    int _size;
+    QString _filename;
+    std::shared_ptr<const Source> _source;
+    Settings _settings;
+    bool _dirty;
+    QFutureWatcher<std::shared_ptr<const Source> > _loading;
+    QFutureWatcher<Frame> _rendering;
+};
+
+#endif // PREVIEWER_H
@@ -0,0 +1,242 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include "profilecatalog.h"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QPair>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <vector>
+#include <algorithm>
+
+#include <lcms2.h>
+
+#include "profileregistry.h"
+
+#define CATALOG_MAGIC 0x46524350
+#define CATALOG_VERSION 1
+
+ProfileCatalog::ProfileCatalog(QObject *parent)
+    : QObject(parent)
+    , _abort(0)
+{
+}
+
+ProfileCatalog::~ProfileCatalog()
+{
+    _abort.storeRelease(1);
+    _scanning.waitForFinished();
+}
+
+QStringList ProfileCatalog::folders()
+{
+    QStringList folders;
+    folders << QDir::rootPath() + "/WINDOWS/System32/spool/drivers/color";
+    folders << "/Library/ColorSync/Profiles";
+    folders << QDir::homePath() + "/Library/ColorSync/Profiles";
+    folders << "/usr/share/color/icc";
+    folders << "/usr/local/share/color/icc";
+    folders << QCoreApplication::applicationDirPath() + "/../share/color/icc";
+    folders << QDir::homePath() + "/.color/icc";
+    folders << QDir::homePath() + "/.config/Cyan/icc";
+    folders << QCoreApplication::applicationDirPath() + "/profiles";
+    folders << QCoreApplication::applicationDirPath() + "/icc";
+    return folders;
+}
+
+QString ProfileCatalog::cacheFile()
+{
+    return QString("%1/profiles.cache").arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+}
+
+bool ProfileCatalog::load()
+{
+    QFile file(cacheFile());
+    if (!file.open(QIODevice::ReadOnly)) { return false; }
+
+    QDataStream stream(&file);
+    quint32 magic = 0;
+    quint32 version = 0;
+    quint32 count = 0;
+    stream >> magic >> version >> count;
+    if (magic != CATALOG_MAGIC || version != CATALOG_VERSION) { return false; }
+
+    QHash<QString, Entry> entries;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        Entry entry;
+        qint32 cs = 0;
+        stream >> entry.path >> entry.size >> entry.modified >> entry.description >> cs >> entry.deviceClass >> entry.version;
+        entry.cs = static_cast<Converter::colorSpace>(cs);
+        entries.insert(entry.path, entry);
+    }
+    if (stream.status() != QDataStream::Ok) { return false; }
+
+    QMutexLocker lock(&_mutex);
+    _entries = entries;
+    return true;
+}
+
+void ProfileCatalog::rescan()
+{
+    if (isScanning()) { return; }
+    _scanning = QtConcurrent::run(this, &ProfileCatalog::scan);
+}
+
+bool ProfileCatalog::isScanning() const
+{
+    return _scanning.isRunning();
+}
+
+QMap<QString, QString> ProfileCatalog::profiles(Converter::colorSpace cs) const
+{
+    QStringList folderList = folders();
+    QList<QPair<int, QString> > paths;
+    QMutexLocker lock(&_mutex);
+    QHashIterator<QString, Entry> it(_entries);
+    while (it.hasNext()) {
+        it.next();
+        if (it.value().cs != cs || it.value().description.isEmpty()) { continue; }
+        int folder = 0;
+        while (folder < folderList.size() && !it.key().startsWith(folderList.at(folder))) { folder++; }
+        paths.append(qMakePair(folder, it.key()));
+    }
+
+    // same precedence as walking the folders, later folders win on equal descriptions
+    std::sort(paths.begin(), paths.end());
+    QMap<QString, QString> output;
+    for (int i = 0; i < paths.size(); ++i) {
+        output[_entries.value(paths.at(i).second).description] = paths.at(i).second;
+    }
+    return output;
+}
+
+QList<ProfileCatalog::Entry> ProfileCatalog::entries() const
+{
+    QMutexLocker lock(&_mutex);
+    return _entries.values();
+}
+
+void ProfileCatalog::scan()
+{
+    QHash<QString, Entry> previous;
+    {
+        QMutexLocker lock(&_mutex);
+        previous = _entries;
+    }
+
+    QHash<QString, Entry> current;
+    int opened = 0;
+    QStringList folderList = folders();
+    for (int i = 0; i < folderList.size(); ++i) {
+        QStringList filter;
+        filter << "*.icc" << "*.icm";
+        QDirIterator it(folderList.at(i), filter, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            if (_abort.loadAcquire()) { return; }
+            QString iccFile = it.next();
+            QFileInfo info = it.fileInfo();
+            Entry entry;
+            entry.path = iccFile;
+            entry.size = info.size();
+            entry.modified = info.lastModified().toMSecsSinceEpoch();
+            if (previous.contains(iccFile) &&
+                previous.value(iccFile).size == entry.size &&
+                previous.value(iccFile).modified == entry.modified) {
+                current.insert(iccFile, previous.value(iccFile));
+                continue;
+            }
+            readEntry(iccFile, &entry);
+            current.insert(iccFile, entry);
+            opened++;
+        }
+    }
+
+    qDebug() << "profile catalog" << current.size() << "profiles," << opened << "read";
+    if (opened == 0 && current.size() == previous.size()) { return; }
+
+    {
+        QMutexLocker lock(&_mutex);
+        _entries = current;
+    }
+    save(current);
+    Q_EMIT updated();
+}
+
+bool ProfileCatalog::save(const QHash<QString, Entry> &entries)
+{
+    QDir().mkpath(QFileInfo(cacheFile()).absolutePath());
+    QSaveFile file(cacheFile());
+    if (!file.open(QIODevice::WriteOnly)) { return false; }
+
+    QDataStream stream(&file);
+    stream << quint32(CATALOG_MAGIC) << quint32(CATALOG_VERSION) << quint32(entries.size());
+    QHashIterator<QString, Entry> it(entries);
+    while (it.hasNext()) {
+        it.next();
+        const Entry &entry = it.value();
+        stream << entry.path << entry.size << entry.modified << entry.description << qint32(entry.cs) << entry.deviceClass << entry.version;
+    }
+    return file.commit();
+}
+
+bool ProfileCatalog::readEntry(const QString &filename, Entry *entry)
+{
+    cmsHPROFILE profile = cmsOpenProfileFromFileTHR(ProfileRegistry::context(), filename.toStdString().c_str(), "r");
+    if (!profile) { return false; }
+
+    switch (cmsGetColorSpace(profile)) {
+    case cmsSigRgbData:
+        entry->cs = Converter::colorSpaceRGB;
+        break;
+    case cmsSigCmykData:
+        entry->cs = Converter::colorSpaceCMYK;
+        break;
+    case cmsSigGrayData:
+        entry->cs = Converter::colorSpaceGRAY;
+        break;
+    default:
+        entry->cs = Converter::colorSpaceUnknown;
+    }
+    entry->deviceClass = cmsGetDeviceClass(profile);
+    entry->version = cmsGetEncodedICCversion(profile);
+
+    cmsUInt32Number size = cmsGetProfileInfoASCII(profile, cmsInfoDescription,
+                                                  "en", "US", nullptr, 0);
+    if (size > 0) {
+        std::vector<char> buffer(size);
+        cmsUInt32Number newsize = cmsGetProfileInfoASCII(profile, cmsInfoDescription,
+                                                         "en", "US", &buffer[0], size);
+        if (size == newsize) {
+            entry->description = buffer.data();
+        }
+    }
+    cmsCloseProfile(profile);
+    return true;
+}
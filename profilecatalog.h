@@ -0,0 +1,77 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef PROFILECATALOG_H
+#define PROFILECATALOG_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QFuture>
+#include <QAtomicInt>
+
+#include "converter.h"
+
+class ProfileCatalog : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    struct Entry
+    {
+        QString path;
+        qint64 size = 0;
+        qint64 modified = 0;
+        QString description;
+        Converter::colorSpace cs = Converter::colorSpaceUnknown;
+        quint32 deviceClass = 0;
+        quint32 version = 0;
+    };
+
+    explicit ProfileCatalog(QObject *parent = nullptr);
+    ~ProfileCatalog();
+
+    static QStringList folders();
+    static QString cacheFile();
+
+    bool load();
+    void rescan();
+    bool isScanning() const;
+    QMap<QString, QString> profiles(Converter::colorSpace cs) const;
+    QList<Entry> entries() const;
+
+Q_SIGNALS:
+    void updated();
+
+private:
+    void scan();
+    bool save(const QHash<QString, Entry> &entries);
+    static bool readEntry(const QString &filename, Entry *entry);
+
+    mutable QMutex _mutex;
+    QHash<QString, Entry> _entries;
+    QFuture<void> _scanning;
+    QAtomicInt _abort;
+};
+
+#endif // PROFILECATALOG_H
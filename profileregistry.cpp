@@ -0,0 +1,283 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#include "profileregistry.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QGlobalStatic>
+#include <QMutexLocker>
+#include <QThreadStorage>
+
+#include <climits>
+
+#include <Magick++.h>
+
+#include "transformcache.h"
+
+// hands the context of a thread back to the registry when the thread
+// ends, so pool threads coming and going reuse a few contexts
+class ThreadContext
+{
+public:
+    explicit ThreadContext(cmsContext id)
+        : _id(id)
+    {
+    }
+    ~ThreadContext()
+    {
+        ProfileRegistry *registry = ProfileRegistry::instance();
+        if (registry) { registry->releaseContext(_id); }
+    }
+    cmsContext id() const
+    {
+        return _id;
+    }
+
+private:
+    cmsContext _id;
+};
+
+Q_GLOBAL_STATIC(ProfileRegistry, profileRegistry)
+static QThreadStorage<ThreadContext*> threadContext;
+
+ProfileRegistry::ProfileRegistry()
+{
+    // the fallback profiles are linked in with the engine, which does not
+    // register them by itself when it is built as a static library
+    Q_INIT_RESOURCE(assets);
+}
+
+ProfileRegistry::~ProfileRegistry()
+{
+    for (size_t i = 0; i < _contexts.size(); ++i) {
+        cmsDeleteContext(_contexts.at(i));
+    }
+    qDeleteAll(_maps);
+}
+
+ProfileRegistry *ProfileRegistry::instance()
+{
+    return profileRegistry();
+}
+
+// every thread opens profiles and builds transforms in its own lcms
+// context, so the error and plugin state of lcms is never shared
+// between workers; transforms are still shared, a context is never
+// deleted while the registry lives
+cmsContext ProfileRegistry::context()
+{
+    if (!threadContext.hasLocalData()) {
+        ProfileRegistry *registry = instance();
+        if (!registry) { return nullptr; }
+        threadContext.setLocalData(new ThreadContext(registry->acquireContext()));
+    }
+    return threadContext.localData()->id();
+}
+
+Converter::Profile ProfileRegistry::load(const QString &filename)
+{
+    QFileInfo info(filename);
+    const QString path = info.absoluteFilePath();
+    const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+    {
+        QMutexLocker lock(&_mutex);
+        QHash<QString, File>::const_iterator it = _files.constFind(path);
+        if (it != _files.constEnd() &&
+            it.value().size == info.size() &&
+            it.value().modified == modified) {
+            return _entries.value(it.value().digest).profile;
+        }
+    }
+
+    // the file stays mapped and the profile data handed out points into
+    // the mapping, resources compressed by rcc can not be mapped and are
+    // read instead; a profile rewritten on disk gets a new mapping, the
+    // old one is kept for the batches still using it
+    QFile *file = new QFile(filename);
+    if (!file->open(QIODevice::ReadOnly) || file->size() <= 0 || file->size() > INT_MAX) {
+        delete file;
+        return Converter::Profile();
+    }
+    QByteArray data;
+    uchar *mapped = file->map(0, file->size());
+    if (mapped) {
+        data = QByteArray::fromRawData(reinterpret_cast<const char*>(mapped), static_cast<int>(file->size()));
+    } else {
+        data = file->readAll();
+        delete file;
+        file = nullptr;
+    }
+
+    Entry entry;
+    entry.profile.data = data;
+    entry.profile.digest = TransformCache::digest(data);
+    if (!parse(data, &entry.profile.cs, entry.tags)) {
+        entry.profile.cs = Converter::colorSpaceUnknown;
+    }
+
+    File record;
+    record.size = info.size();
+    record.modified = modified;
+    record.digest = entry.profile.digest;
+    QMutexLocker lock(&_mutex);
+    _files.insert(path, record);
+
+    // the same profile found in another folder is shared
+    QHash<QByteArray, Entry>::const_iterator it = _entries.constFind(record.digest);
+    if (it != _entries.constEnd()) {
+        Converter::Profile profile = it.value().profile;
+        delete file;
+        return profile;
+    }
+    qDebug() << "profile registry" << path << data.size() << (file ? "mapped" : "read");
+    _entries.insert(record.digest, entry);
+    _data.insert(data.constData(), record.digest);
+    if (file) { _maps.append(file); }
+    return entry.profile;
+}
+
+Converter::Profile ProfileRegistry::profile(const QByteArray &data)
+{
+    {
+        QMutexLocker lock(&_mutex);
+        QHash<const char*, QByteArray>::const_iterator it = _data.constFind(data.constData());
+        if (it != _data.constEnd()) {
+            Converter::Profile known = _entries.value(it.value()).profile;
+            if (known.data.size() == data.size()) { return known; }
+        }
+    }
+
+    // profiles that did not come from the registry, like embedded ones,
+    // are hashed every time and not kept
+    Converter::Profile profile;
+    profile.data = data;
+    profile.digest = TransformCache::digest(data);
+    profile.cs = Converter::profileColorspace(data);
+    return profile;
+}
+
+Converter::Profile ProfileRegistry::fallback(Converter::colorSpace cs)
+{
+    // the bundled profiles are only read once an image needs them
+    switch (cs) {
+    case Converter::colorSpaceCMYK:
+        return load(QString(":/profile-cmyk.icc"));
+    case Converter::colorSpaceGRAY:
+        return load(QString(":/profile-gray.icc"));
+    default:;
+    }
+    return load(QString(":/profile-rgb.icc"));
+}
+
+QString ProfileRegistry::tag(const Converter::Profile &profile,
+                             Tag tag)
+{
+    {
+        QMutexLocker lock(&_mutex);
+        QHash<QByteArray, Entry>::const_iterator it = _entries.constFind(profile.digest);
+        if (it != _entries.constEnd()) { return it.value().tags[tag]; }
+    }
+    Converter::colorSpace cs = Converter::colorSpaceUnknown;
+    QString tags[TagCount];
+    parse(profile.data, &cs, tags);
+    return tags[tag];
+}
+
+Magick::Blob ProfileRegistry::blob(const Converter::Profile &profile)
+{
+    // blobs are reference counted, one copy per profile is enough
+    {
+        QMutexLocker lock(&_mutex);
+        QHash<QByteArray, Entry>::iterator it = _entries.find(profile.digest);
+        if (it != _entries.end()) {
+            if (!it.value().blob) {
+                it.value().blob = std::make_shared<Magick::Blob>(profile.data.constData(),
+                                                                 static_cast<size_t>(profile.data.size()));
+            }
+            return *it.value().blob;
+        }
+    }
+    return Magick::Blob(profile.data.constData(), static_cast<size_t>(profile.data.size()));
+}
+
+void ProfileRegistry::releaseContext(cmsContext context)
+{
+    if (!context) { return; }
+    QMutexLocker lock(&_mutex);
+    _free.push_back(context);
+}
+
+cmsContext ProfileRegistry::acquireContext()
+{
+    QMutexLocker lock(&_mutex);
+    if (!_free.empty()) {
+        cmsContext context = _free.back();
+        _free.pop_back();
+        return context;
+    }
+    cmsContext context = cmsCreateContext(nullptr, nullptr);
+    if (context) { _contexts.push_back(context); }
+    return context;
+}
+
+bool ProfileRegistry::parse(const QByteArray &data,
+                            Converter::colorSpace *cs,
+                            QString *tags)
+{
+    if (data.isEmpty()) { return false; }
+    cmsHPROFILE profile = cmsOpenProfileFromMemTHR(context(),
+                                                   data.constData(),
+                                                   static_cast<cmsUInt32Number>(data.size()));
+    if (!profile) { return false; }
+
+    switch (cmsGetColorSpace(profile)) {
+    case cmsSigRgbData:
+        *cs = Converter::colorSpaceRGB;
+        break;
+    case cmsSigCmykData:
+        *cs = Converter::colorSpaceCMYK;
+        break;
+    case cmsSigGrayData:
+        *cs = Converter::colorSpaceGRAY;
+        break;
+    default:
+        *cs = Converter::colorSpaceUnknown;
+    }
+
+    const cmsInfoType types[TagCount] = { cmsInfoDescription,
+                                          cmsInfoManufacturer,
+                                          cmsInfoModel,
+                                          cmsInfoCopyright };
+    for (int i = 0; i < TagCount; ++i) {
+        cmsUInt32Number size = cmsGetProfileInfoASCII(profile, types[i],
+                                                      "en", "US", nullptr, 0);
+        if (size == 0) { continue; }
+        std::vector<char> buffer(size);
+        if (cmsGetProfileInfoASCII(profile, types[i],
+                                   "en", "US", &buffer[0], size) == size) {
+            tags[i] = buffer.data();
+        }
+    }
+    cmsCloseProfile(profile);
+    return true;
+}
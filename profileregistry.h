@@ -0,0 +1,95 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#ifndef PROFILEREGISTRY_H
+#define PROFILEREGISTRY_H
+
+#include <QByteArray>
+#include <QString>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+
+#include <memory>
+#include <vector>
+
+#include <lcms2.h>
+
+#include "converter.h"
+
+class QFile;
+namespace Magick { class Blob; }
+
+class ProfileRegistry
+{
+public:
+
+    enum Tag {
+        DescriptionTag,
+        ManufacturerTag,
+        ModelTag,
+        CopyrightTag,
+        TagCount
+    };
+
+    ProfileRegistry();
+    ~ProfileRegistry();
+
+    static ProfileRegistry *instance();
+    static cmsContext context();
+
+    Converter::Profile load(const QString &filename);
+    Converter::Profile profile(const QByteArray &data);
+    Converter::Profile fallback(Converter::colorSpace cs);
+    QString tag(const Converter::Profile &profile,
+                Tag tag);
+    Magick::Blob blob(const Converter::Profile &profile);
+
+    void releaseContext(cmsContext context);
+
+private:
+    struct Entry
+    {
+        Converter::Profile profile;
+        QString tags[TagCount];
+        std::shared_ptr<Magick::Blob> blob;
+    };
+    struct File
+    {
+        qint64 size = 0;
+        qint64 modified = 0;
+        QByteArray digest;
+    };
+
+    static bool parse(const QByteArray &data,
+                      Converter::colorSpace *cs,
+                      QString *tags);
+    cmsContext acquireContext();
+
+    mutable QMutex _mutex;
+    QHash<QByteArray, Entry> _entries;
+    QHash<QString, File> _files;
+    QHash<const char*, QByteArray> _data;
+    QList<QFile*> _maps;
+    std::vector<cmsContext> _contexts;
+    std::vector<cmsContext> _free;
+};
+
+#endif // PROFILEREGISTRY_H
@@ -0,0 +1,124 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#include "singleinstance.h"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QDebug>
+
+#include <cstring>
+
+SingleInstance::SingleInstance(QObject *parent)
+    : QObject(parent)
+{
+    // one instance per user, the name has to be the same in every process
+    _name = QString("%1-%2").arg(QCoreApplication::applicationName())
+                            .arg(qHash(QDir::homePath()), 0, 16);
+    connect(&_server, SIGNAL(newConnection()), this, SLOT(handleConnection()));
+}
+
+bool SingleInstance::isDisabled(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--new-instance") == 0) { return true; }
+    }
+    return false;
+}
+
+bool SingleInstance::forward(const QStringList &args,
+                             int timeout)
+{
+    QLocalSocket socket;
+    socket.connectToServer(_name);
+    if (!socket.waitForConnected(timeout)) { return false; }
+
+    // the running instance has another working directory
+    QStringList files;
+    for (int i = 0; i < args.size(); ++i) {
+        files.append(QFileInfo(args.at(i)).absoluteFilePath());
+    }
+    QByteArray message;
+    QDataStream stream(&message, QIODevice::WriteOnly);
+    stream << files;
+    socket.write(message);
+    if (!socket.waitForBytesWritten(timeout)) { return false; }
+
+    // the arguments only count as handed over once they are acknowledged,
+    // otherwise this process takes them itself
+    if (!socket.waitForReadyRead(timeout)) { return false; }
+    return socket.read(1) == QByteArray("1");
+}
+
+bool SingleInstance::listen()
+{
+    // only the same user may hand files to the window, whatever the umask
+    _server.setSocketOptions(QLocalServer::UserAccessOption);
+    if (_server.listen(_name)) { return true; }
+
+    // a crashed instance leaves its socket file behind on unix, it is
+    // only removed when nobody answers on it
+    if (_server.serverError() == QAbstractSocket::AddressInUseError) {
+        QLocalSocket probe;
+        probe.connectToServer(_name);
+        if (probe.waitForConnected(100)) { return false; }
+        QLocalServer::removeServer(_name);
+        if (_server.listen(_name)) { return true; }
+    }
+    qWarning() << "unable to listen for other instances" << _server.errorString();
+    return false;
+}
+
+QString SingleInstance::serverName() const
+{
+    return _name;
+}
+
+void SingleInstance::handleConnection()
+{
+    while (_server.hasPendingConnections()) {
+        QLocalSocket *socket = _server.nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), this, SLOT(handleRead()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+        if (socket->bytesAvailable() > 0) { readArgs(socket); }
+    }
+}
+
+void SingleInstance::handleRead()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+    if (socket) { readArgs(socket); }
+}
+
+void SingleInstance::readArgs(QLocalSocket *socket)
+{
+    // the list may arrive in several pieces
+    QDataStream stream(socket);
+    stream.startTransaction();
+    QStringList args;
+    stream >> args;
+    if (!stream.commitTransaction()) { return; }
+    socket->write("1");
+    socket->flush();
+    socket->disconnectFromServer();
+    Q_EMIT received(args);
+}
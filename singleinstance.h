@@ -0,0 +1,58 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+
+#ifndef SINGLEINSTANCE_H
+#define SINGLEINSTANCE_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+class SingleInstance : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SingleInstance(QObject *parent = nullptr);
+
+    static bool isDisabled(int argc, char *argv[]);
+
+    bool forward(const QStringList &args,
+                 int timeout = 1000);
+    bool listen();
+    QString serverName() const;
+
+Q_SIGNALS:
+    void received(const QStringList &args);
+
+private Q_SLOTS:
+    void handleConnection();
+    void handleRead();
+
+private:
+    void readArgs(QLocalSocket *socket);
+
+    QString _name;
+    QLocalServer _server;
+};
+
+#endif // SINGLEINSTANCE_H
@@ -0,0 +1,832 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include "streamconverter.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QThread>
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <png.h>
+#include <jpeglib.h>
+#include <tiffio.h>
+
+#include <csetjmp>
+
+#include "transformcache.h"
+#include "bandprocessor.h"
+#include "filescanner.h"
+#include "lutkernel.h"
+#include "profileregistry.h"
+#include "bufferpool.h"
+
+struct Band
+{
+    TransformCache::Transform transform;
+    LutKernel::Lut lut;
+    size_t width = 0;
+    size_t rows = 0;
+    size_t inputPixel = 0;
+    size_t outputPixel = 0;
+    bool alpha = false;
+    int bytes = 1;
+    std::vector<unsigned char> input;
+    std::vector<unsigned char> output;
+
+    ~Band()
+    {
+        BufferPool::instance()->give(input);
+        BufferPool::instance()->give(output);
+    }
+};
+
+static size_t streamRows(size_t width, int threads)
+{
+    if (threads < 1) { threads = QThread::idealThreadCount(); }
+    return BandProcessor::bandRows(width) * static_cast<size_t>(threads);
+}
+
+static bool prepareBand(Band *band,
+                        const QByteArray &embedded,
+                        Converter::colorSpace cs,
+                        bool alpha,
+                        int bytes,
+                        size_t width,
+                        size_t rows,
+                        cmsUInt32Number inputFlavor,
+                        cmsUInt32Number outputFlavor,
+                        const StreamConverter::Settings &settings)
+{
+    Converter::Profile input;
+    if (!embedded.isEmpty()) {
+        input = Converter::loadProfile(embedded);
+    } else {
+        input = ProfileRegistry::instance()->fallback(cs);
+    }
+    if (input.cs != cs || input.digest == settings.output.digest) { return false; }
+
+    if (settings.lut &&
+        cs == Converter::colorSpaceRGB &&
+        !alpha &&
+        bytes == 1 &&
+        inputFlavor == 0) {
+        band->lut = LutKernel::get(input,
+                                   settings.output,
+                                   Converter::pixelFormat(settings.output.cs, false, 1) | outputFlavor,
+                                   settings.intent,
+                                   settings.blackPoint);
+    }
+    if (!band->lut) {
+        band->transform = TransformCache::instance()->transform(input.data,
+                                                                input.digest,
+                                                                settings.output.data,
+                                                                settings.output.digest,
+                                                                Converter::pixelFormat(cs, alpha, bytes) | inputFlavor,
+                                                                Converter::pixelFormat(settings.output.cs, alpha, bytes) | outputFlavor,
+                                                                settings.intent,
+                                                                settings.blackPoint);
+        if (!band->transform) { return false; }
+    }
+
+    band->width = width;
+    band->rows = rows;
+    band->alpha = alpha;
+    band->bytes = bytes;
+    band->inputPixel = Converter::pixelChannels(cs, alpha) * static_cast<size_t>(bytes);
+    band->outputPixel = Converter::pixelChannels(settings.output.cs, alpha) * static_cast<size_t>(bytes);
+    BufferPool::instance()->take(band->input, width * rows * band->inputPixel);
+    BufferPool::instance()->take(band->output, width * rows * band->outputPixel);
+    return true;
+}
+
+static void transformBand(Band *band,
+                          size_t rows,
+                          int threads)
+{
+    Converter::transformPixels(band->transform,
+                               band->input.data(),
+                               band->output.data(),
+                               band->width,
+                               rows,
+                               band->inputPixel,
+                               band->outputPixel,
+                               band->alpha ? band->bytes : 0,
+                               threads,
+                               band->lut.get());
+}
+
+static bool isCancelled(const StreamConverter::Settings &settings)
+{
+    return settings.cancel && settings.cancel->loadAcquire();
+}
+
+static FILE *openFile(const QString &filename,
+                      const char *mode)
+{
+#ifdef Q_OS_WIN
+    return _wfopen(filename.toStdWString().c_str(), QString(mode).toStdWString().c_str());
+#else
+    return fopen(QFile::encodeName(filename).constData(), mode);
+#endif
+}
+
+// libjpeg and libpng report errors with longjmp, so everything touched
+// after setjmp lives in a heap allocated stream and not on the stack
+
+struct JpegError
+{
+    jpeg_error_mgr manager;
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+struct JpegStream
+{
+    JpegError error;
+    jpeg_decompress_struct in;
+    jpeg_compress_struct out;
+    bool decompressing = false;
+    bool compressing = false;
+    FILE *input = nullptr;
+    FILE *output = nullptr;
+    QByteArray icc;
+    Band band;
+};
+
+static void jpegErrorExit(j_common_ptr info)
+{
+    JpegError *error = reinterpret_cast<JpegError*>(info->err);
+    (*info->err->format_message)(info, error->message);
+    longjmp(error->jump, 1);
+}
+
+static void closeJpeg(JpegStream *stream)
+{
+    if (stream->compressing) { jpeg_destroy_compress(&stream->out); }
+    if (stream->decompressing) { jpeg_destroy_decompress(&stream->in); }
+    if (stream->output) { fclose(stream->output); }
+    if (stream->input) { fclose(stream->input); }
+    stream->compressing = false;
+    stream->decompressing = false;
+    stream->output = nullptr;
+    stream->input = nullptr;
+}
+
+static QByteArray jpegIccProfile(jpeg_decompress_struct *info)
+{
+    QMap<int, QByteArray> chunks;
+    for (jpeg_saved_marker_ptr marker = info->marker_list; marker; marker = marker->next) {
+        if (marker->marker != JPEG_APP0 + 2 ||
+            marker->data_length < 14 ||
+            std::memcmp(marker->data, "ICC_PROFILE", 12) != 0) { continue; }
+        chunks.insert(marker->data[12], QByteArray(reinterpret_cast<const char*>(marker->data + 14),
+                                                   static_cast<int>(marker->data_length - 14)));
+    }
+    QByteArray profile;
+    QMapIterator<int, QByteArray> it(chunks);
+    while (it.hasNext()) {
+        it.next();
+        profile.append(it.value());
+    }
+    return profile;
+}
+
+static void jpegWriteIccProfile(jpeg_compress_struct *info,
+                                const QByteArray &profile)
+{
+    const char name[] = "ICC_PROFILE";
+    const int chunk = 65533 - 14;
+    const int count = (profile.size() + chunk - 1) / chunk;
+    const unsigned char *data = reinterpret_cast<const unsigned char*>(profile.constData());
+    for (int i = 0; i < count; ++i) {
+        const int length = qMin(chunk, profile.size() - i * chunk);
+        jpeg_write_m_header(info, JPEG_APP0 + 2, static_cast<unsigned int>(length + 14));
+        for (size_t j = 0; j < sizeof(name); ++j) { jpeg_write_m_byte(info, name[j]); }
+        jpeg_write_m_byte(info, i + 1);
+        jpeg_write_m_byte(info, count);
+        for (int j = 0; j < length; ++j) { jpeg_write_m_byte(info, data[i * chunk + j]); }
+    }
+}
+
+struct PngStream
+{
+    jmp_buf jump;
+    char message[256];
+    FILE *input = nullptr;
+    FILE *output = nullptr;
+    png_structp read = nullptr;
+    png_infop info = nullptr;
+    png_infop end = nullptr;
+    png_structp write = nullptr;
+    png_infop writeInfo = nullptr;
+    QByteArray icc;
+    Band band;
+};
+
+static void pngError(png_structp png,
+                     png_const_charp message)
+{
+    PngStream *stream = static_cast<PngStream*>(png_get_error_ptr(png));
+    qstrncpy(stream->message, message, sizeof(stream->message));
+    longjmp(stream->jump, 1);
+}
+
+static void pngWarning(png_structp png,
+                       png_const_charp message)
+{
+    Q_UNUSED(png)
+    qWarning() << message;
+}
+
+static void closePng(PngStream *stream)
+{
+    if (stream->write) { png_destroy_write_struct(&stream->write, &stream->writeInfo); }
+    if (stream->read) { png_destroy_read_struct(&stream->read, &stream->info, &stream->end); }
+    if (stream->output) { fclose(stream->output); }
+    if (stream->input) { fclose(stream->input); }
+    stream->write = nullptr;
+    stream->read = nullptr;
+    stream->output = nullptr;
+    stream->input = nullptr;
+}
+
+struct TiffStream
+{
+    TIFF *input = nullptr;
+    TIFF *output = nullptr;
+    std::vector<unsigned char> tile;
+    Band band;
+};
+
+static TIFF *openTiff(const QString &filename,
+                      const char *mode)
+{
+#ifdef Q_OS_WIN
+    return TIFFOpenW(filename.toStdWString().c_str(), mode);
+#else
+    return TIFFOpen(QFile::encodeName(filename).constData(), mode);
+#endif
+}
+
+static void closeTiff(TiffStream *stream)
+{
+    if (stream->output) { TIFFClose(stream->output); }
+    if (stream->input) { TIFFClose(stream->input); }
+    stream->output = nullptr;
+    stream->input = nullptr;
+}
+
+static bool tiffCompression(uint16_t compression)
+{
+    switch (compression) {
+    case COMPRESSION_NONE:
+    case COMPRESSION_LZW:
+    case COMPRESSION_ADOBE_DEFLATE:
+    case COMPRESSION_DEFLATE:
+    case COMPRESSION_PACKBITS:
+        return true;
+    default:;
+    }
+    return false;
+}
+
+static void copyTiffTags(TIFF *in,
+                         TIFF *out)
+{
+    uint16_t value = 0;
+    if (TIFFGetField(in, TIFFTAG_ORIENTATION, &value)) { TIFFSetField(out, TIFFTAG_ORIENTATION, value); }
+    if (TIFFGetField(in, TIFFTAG_RESOLUTIONUNIT, &value)) { TIFFSetField(out, TIFFTAG_RESOLUTIONUNIT, value); }
+    float resolution = 0;
+    if (TIFFGetField(in, TIFFTAG_XRESOLUTION, &resolution)) { TIFFSetField(out, TIFFTAG_XRESOLUTION, resolution); }
+    if (TIFFGetField(in, TIFFTAG_YRESOLUTION, &resolution)) { TIFFSetField(out, TIFFTAG_YRESOLUTION, resolution); }
+
+    const uint32_t strings[] = { TIFFTAG_DOCUMENTNAME, TIFFTAG_IMAGEDESCRIPTION, TIFFTAG_MAKE, TIFFTAG_MODEL,
+                                 TIFFTAG_SOFTWARE, TIFFTAG_DATETIME, TIFFTAG_ARTIST, TIFFTAG_COPYRIGHT };
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); ++i) {
+        char *text = nullptr;
+        if (TIFFGetField(in, strings[i], &text) && text) { TIFFSetField(out, strings[i], text); }
+    }
+
+    // xmp, 8bim and iptc, the same blocks the regular path keeps
+    const uint32_t blocks[] = { TIFFTAG_XMLPACKET, TIFFTAG_PHOTOSHOP, TIFFTAG_RICHTIFFIPTC };
+    for (size_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); ++i) {
+        uint32_t length = 0;
+        void *data = nullptr;
+        if (TIFFGetField(in, blocks[i], &length, &data) && data) { TIFFSetField(out, blocks[i], length, data); }
+    }
+}
+
+static bool readTiffTiles(TiffStream *stream,
+                          uint32_t y,
+                          uint32_t rows,
+                          uint32_t width,
+                          uint32_t tileWidth)
+{
+    const size_t inputPixel = stream->band.inputPixel;
+    for (uint32_t x = 0; x < width; x += tileWidth) {
+        if (TIFFReadTile(stream->input, stream->tile.data(), x, y, 0, 0) < 0) { return false; }
+        const size_t columns = qMin(tileWidth, width - x);
+        for (uint32_t r = 0; r < rows; ++r) {
+            std::memcpy(stream->band.input.data() + (static_cast<size_t>(r) * width + x) * inputPixel,
+                        stream->tile.data() + static_cast<size_t>(r) * tileWidth * inputPixel,
+                        columns * inputPixel);
+        }
+    }
+    return true;
+}
+
+bool StreamConverter::isSupported(const QString &filename)
+{
+    return FileScanner::sniff(filename) != FileScanner::UnknownFormat;
+}
+
+StreamConverter::Status StreamConverter::convert(const QString &input,
+                                                 const QString &output,
+                                                 const Settings &settings,
+                                                 QString *error)
+{
+    // the output is written in the input format, so it has to be what
+    // the output name says as well
+    const FileScanner::Format format = FileScanner::sniff(input);
+    const QString suffix = QFileInfo(output).suffix().toLower();
+    switch (format) {
+    case FileScanner::JpegFormat:
+        if (suffix != "jpg" && suffix != "jpeg") { break; }
+        return convertJpeg(input, output, settings, error);
+    case FileScanner::PngFormat:
+        if (suffix != "png") { break; }
+        return convertPng(input, output, settings, error);
+    case FileScanner::TiffFormat:
+        if (suffix != "tif" && suffix != "tiff") { break; }
+        return convertTiff(input, output, settings, error);
+    default:;
+    }
+    return StreamUnsupported;
+}
+
+StreamConverter::Status StreamConverter::convertJpeg(const QString &input,
+                                                     const QString &output,
+                                                     const Settings &settings,
+                                                     QString *error)
+{
+    std::unique_ptr<JpegStream> holder(new JpegStream());
+    JpegStream *stream = holder.get();
+    stream->input = openFile(input, "rb");
+    if (!stream->input) {
+        *error = QString("Unable to read %1").arg(input);
+        return StreamFailed;
+    }
+    stream->in.err = jpeg_std_error(&stream->error.manager);
+    stream->out.err = &stream->error.manager;
+    stream->error.manager.error_exit = jpegErrorExit;
+    if (setjmp(stream->error.jump)) {
+        const bool written = stream->output != nullptr;
+        closeJpeg(stream);
+        if (written) { QFile::remove(output); }
+        *error = QString::fromLocal8Bit(stream->error.message);
+        return StreamFailed;
+    }
+
+    jpeg_create_decompress(&stream->in);
+    stream->decompressing = true;
+    jpeg_stdio_src(&stream->in, stream->input);
+    jpeg_save_markers(&stream->in, JPEG_APP0 + 1, 0xFFFF);
+    jpeg_save_markers(&stream->in, JPEG_APP0 + 2, 0xFFFF);
+    jpeg_save_markers(&stream->in, JPEG_APP0 + 13, 0xFFFF);
+    jpeg_read_header(&stream->in, TRUE);
+
+    Converter::colorSpace cs = Converter::colorSpaceRGB;
+    cmsUInt32Number inputFlavor = 0;
+    switch (stream->in.jpeg_color_space) {
+    case JCS_GRAYSCALE:
+        cs = Converter::colorSpaceGRAY;
+        stream->in.out_color_space = JCS_GRAYSCALE;
+        break;
+    case JCS_CMYK:
+    case JCS_YCCK:
+        cs = Converter::colorSpaceCMYK;
+        stream->in.out_color_space = JCS_CMYK;
+        // Adobe applications store CMYK inverted
+        if (stream->in.saw_Adobe_marker) { inputFlavor = FLAVOR_SH(1); }
+        break;
+    default:
+        stream->in.out_color_space = JCS_RGB;
+    }
+
+    // CMYK is written inverted with an Adobe marker, as ImageMagick does
+    const cmsUInt32Number outputFlavor = settings.output.cs == Converter::colorSpaceCMYK ? FLAVOR_SH(1) : 0;
+    const size_t width = stream->in.image_width;
+    const size_t height = stream->in.image_height;
+    stream->icc = jpegIccProfile(&stream->in);
+    if (!prepareBand(&stream->band, stream->icc, cs, false, 1, width,
+                     streamRows(width, settings.threads), inputFlavor, outputFlavor, settings)) {
+        closeJpeg(stream);
+        return StreamUnsupported;
+    }
+    jpeg_start_decompress(&stream->in);
+
+    stream->output = openFile(output, "wb");
+    if (!stream->output) {
+        closeJpeg(stream);
+        *error = QString("Unable to write %1").arg(output);
+        return StreamFailed;
+    }
+    jpeg_create_compress(&stream->out);
+    stream->compressing = true;
+    jpeg_stdio_dest(&stream->out, stream->output);
+    stream->out.image_width = stream->in.image_width;
+    stream->out.image_height = stream->in.image_height;
+    stream->out.input_components = static_cast<int>(Converter::pixelChannels(settings.output.cs, false));
+    switch (settings.output.cs) {
+    case Converter::colorSpaceCMYK:
+        stream->out.in_color_space = JCS_CMYK;
+        break;
+    case Converter::colorSpaceGRAY:
+        stream->out.in_color_space = JCS_GRAYSCALE;
+        break;
+    default:
+        stream->out.in_color_space = JCS_RGB;
+    }
+    jpeg_set_defaults(&stream->out);
+
+    // reuse the source quantization tables to keep the source quality
+    for (int i = 0; i < NUM_QUANT_TBLS; ++i) {
+        if (!stream->in.quant_tbl_ptrs[i]) { continue; }
+        if (!stream->out.quant_tbl_ptrs[i]) {
+            stream->out.quant_tbl_ptrs[i] = jpeg_alloc_quant_table(reinterpret_cast<j_common_ptr>(&stream->out));
+        }
+        std::memcpy(stream->out.quant_tbl_ptrs[i]->quantval,
+                    stream->in.quant_tbl_ptrs[i]->quantval,
+                    sizeof(stream->out.quant_tbl_ptrs[i]->quantval));
+        stream->out.quant_tbl_ptrs[i]->sent_table = FALSE;
+    }
+    stream->out.density_unit = stream->in.density_unit;
+    stream->out.X_density = stream->in.X_density;
+    stream->out.Y_density = stream->in.Y_density;
+    if (stream->in.progressive_mode) { jpeg_simple_progression(&stream->out); }
+
+    jpeg_start_compress(&stream->out, TRUE);
+    for (jpeg_saved_marker_ptr marker = stream->in.marker_list; marker; marker = marker->next) {
+        if (marker->marker == JPEG_APP0 + 1 || marker->marker == JPEG_APP0 + 13) {
+            jpeg_write_marker(&stream->out, marker->marker, marker->data, marker->data_length);
+        }
+    }
+    jpegWriteIccProfile(&stream->out, settings.output.data);
+
+    Band *band = &stream->band;
+    for (size_t y = 0; y < height; ) {
+        if (isCancelled(settings)) {
+            closeJpeg(stream);
+            QFile::remove(output);
+            *error = QString("Cancelled");
+            return StreamFailed;
+        }
+        const size_t rows = qMin(band->rows, height - y);
+        for (size_t i = 0; i < rows; ) {
+            JSAMPROW row = band->input.data() + i * width * band->inputPixel;
+            i += jpeg_read_scanlines(&stream->in, &row, 1);
+        }
+        transformBand(band, rows, settings.threads);
+        for (size_t i = 0; i < rows; ) {
+            JSAMPROW row = band->output.data() + i * width * band->outputPixel;
+            i += jpeg_write_scanlines(&stream->out, &row, 1);
+        }
+        y += rows;
+    }
+
+    jpeg_finish_compress(&stream->out);
+    jpeg_finish_decompress(&stream->in);
+    closeJpeg(stream);
+    return StreamConverted;
+}
+
+StreamConverter::Status StreamConverter::convertPng(const QString &input,
+                                                    const QString &output,
+                                                    const Settings &settings,
+                                                    QString *error)
+{
+    // PNG has no CMYK
+    if (settings.output.cs == Converter::colorSpaceCMYK) { return StreamUnsupported; }
+
+    std::unique_ptr<PngStream> holder(new PngStream());
+    PngStream *stream = holder.get();
+    stream->input = openFile(input, "rb");
+    if (!stream->input) {
+        *error = QString("Unable to read %1").arg(input);
+        return StreamFailed;
+    }
+    if (setjmp(stream->jump)) {
+        const bool written = stream->output != nullptr;
+        closePng(stream);
+        if (written) { QFile::remove(output); }
+        *error = QString::fromLocal8Bit(stream->message);
+        return StreamFailed;
+    }
+
+    stream->read = png_create_read_struct(PNG_LIBPNG_VER_STRING, stream, pngError, pngWarning);
+    if (stream->read) {
+        stream->info = png_create_info_struct(stream->read);
+        stream->end = png_create_info_struct(stream->read);
+    }
+    if (!stream->info || !stream->end) {
+        closePng(stream);
+        *error = QString("Unable to read %1").arg(input);
+        return StreamFailed;
+    }
+    png_init_io(stream->read, stream->input);
+    png_read_info(stream->read, stream->info);
+
+    // interlaced images need every pass before a single row is complete
+    if (png_get_interlace_type(stream->read, stream->info) != PNG_INTERLACE_NONE) {
+        closePng(stream);
+        return StreamUnsupported;
+    }
+    const int sourceType = png_get_color_type(stream->read, stream->info);
+    if (sourceType == PNG_COLOR_TYPE_PALETTE) { png_set_palette_to_rgb(stream->read); }
+    if (sourceType == PNG_COLOR_TYPE_GRAY && png_get_bit_depth(stream->read, stream->info) < 8) {
+        png_set_expand_gray_1_2_4_to_8(stream->read);
+    }
+    if (png_get_valid(stream->read, stream->info, PNG_INFO_tRNS)) { png_set_tRNS_to_alpha(stream->read); }
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    if (png_get_bit_depth(stream->read, stream->info) == 16) { png_set_swap(stream->read); }
+#endif
+    png_read_update_info(stream->read, stream->info);
+
+    const int colorType = png_get_color_type(stream->read, stream->info);
+    const int bitDepth = png_get_bit_depth(stream->read, stream->info);
+    const Converter::colorSpace cs = (colorType & PNG_COLOR_MASK_COLOR) ? Converter::colorSpaceRGB : Converter::colorSpaceGRAY;
+    const bool alpha = (colorType & PNG_COLOR_MASK_ALPHA) != 0;
+    const size_t width = png_get_image_width(stream->read, stream->info);
+    const size_t height = png_get_image_height(stream->read, stream->info);
+
+    png_charp name = nullptr;
+    int compression = 0;
+    png_bytep profile = nullptr;
+    png_uint_32 length = 0;
+    if (png_get_iCCP(stream->read, stream->info, &name, &compression, &profile, &length) && profile) {
+        stream->icc = QByteArray(reinterpret_cast<const char*>(profile), static_cast<int>(length));
+    }
+    if (!prepareBand(&stream->band, stream->icc, cs, alpha, bitDepth == 16 ? 2 : 1, width,
+                     streamRows(width, settings.threads), 0, 0, settings)) {
+        closePng(stream);
+        return StreamUnsupported;
+    }
+
+    stream->output = openFile(output, "wb");
+    if (stream->output) {
+        stream->write = png_create_write_struct(PNG_LIBPNG_VER_STRING, stream, pngError, pngWarning);
+    }
+    if (stream->write) { stream->writeInfo = png_create_info_struct(stream->write); }
+    if (!stream->writeInfo) {
+        const bool written = stream->output != nullptr;
+        closePng(stream);
+        if (written) { QFile::remove(output); }
+        *error = QString("Unable to write %1").arg(output);
+        return StreamFailed;
+    }
+    png_init_io(stream->write, stream->output);
+
+    int outputType = settings.output.cs == Converter::colorSpaceGRAY ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGB;
+    if (alpha) { outputType |= PNG_COLOR_MASK_ALPHA; }
+    png_set_IHDR(stream->write, stream->writeInfo,
+                 static_cast<png_uint_32>(width), static_cast<png_uint_32>(height),
+                 bitDepth, outputType, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_set_iCCP(stream->write, stream->writeInfo, "ICC Profile", PNG_COMPRESSION_TYPE_BASE,
+                 reinterpret_cast<png_const_bytep>(settings.output.data.constData()),
+                 static_cast<png_uint_32>(settings.output.data.size()));
+    png_uint_32 resolutionX = 0;
+    png_uint_32 resolutionY = 0;
+    int unit = 0;
+    if (png_get_pHYs(stream->read, stream->info, &resolutionX, &resolutionY, &unit)) {
+        png_set_pHYs(stream->write, stream->writeInfo, resolutionX, resolutionY, unit);
+    }
+    png_textp text = nullptr;
+    int texts = 0;
+    if (png_get_text(stream->read, stream->info, &text, &texts) > 0) {
+        png_set_text(stream->write, stream->writeInfo, text, texts);
+    }
+#ifdef PNG_eXIf_SUPPORTED
+    png_bytep exif = nullptr;
+    png_uint_32 exifLength = 0;
+    if (png_get_eXIf_1(stream->read, stream->info, &exifLength, &exif) && exif) {
+        png_set_eXIf_1(stream->write, stream->writeInfo, exifLength, exif);
+    }
+#endif
+    png_write_info(stream->write, stream->writeInfo);
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    if (bitDepth == 16) { png_set_swap(stream->write); }
+#endif
+
+    Band *band = &stream->band;
+    for (size_t y = 0; y < height; ) {
+        if (isCancelled(settings)) {
+            closePng(stream);
+            QFile::remove(output);
+            *error = QString("Cancelled");
+            return StreamFailed;
+        }
+        const size_t rows = qMin(band->rows, height - y);
+        for (size_t i = 0; i < rows; ++i) {
+            png_read_row(stream->read, band->input.data() + i * width * band->inputPixel, nullptr);
+        }
+        transformBand(band, rows, settings.threads);
+        for (size_t i = 0; i < rows; ++i) {
+            png_write_row(stream->write, band->output.data() + i * width * band->outputPixel);
+        }
+        y += rows;
+    }
+
+    // text chunks may also follow the image data
+    png_read_end(stream->read, stream->end);
+    if (png_get_text(stream->read, stream->end, &text, &texts) > 0) {
+        png_set_text(stream->write, stream->writeInfo, text, texts);
+    }
+    png_write_end(stream->write, stream->writeInfo);
+    closePng(stream);
+    return StreamConverted;
+}
+
+StreamConverter::Status StreamConverter::convertTiff(const QString &input,
+                                                     const QString &output,
+                                                     const Settings &settings,
+                                                     QString *error)
+{
+    TiffStream stream;
+    stream.input = openTiff(input, "r");
+    if (!stream.input) {
+        *error = QString("Unable to read %1").arg(input);
+        return StreamFailed;
+    }
+    TIFF *in = stream.input;
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint16_t photometric = 0;
+    uint16_t bits = 0;
+    uint16_t samples = 0;
+    uint16_t planar = 0;
+    uint16_t format = 0;
+    uint16_t compression = 0;
+    uint16_t predictor = 0;
+    uint16_t inkset = 0;
+    uint16_t extraCount = 0;
+    uint16_t *extraTypes = nullptr;
+    TIFFGetField(in, TIFFTAG_IMAGEWIDTH, &width);
+    TIFFGetField(in, TIFFTAG_IMAGELENGTH, &height);
+    TIFFGetField(in, TIFFTAG_PHOTOMETRIC, &photometric);
+    TIFFGetFieldDefaulted(in, TIFFTAG_BITSPERSAMPLE, &bits);
+    TIFFGetFieldDefaulted(in, TIFFTAG_SAMPLESPERPIXEL, &samples);
+    TIFFGetFieldDefaulted(in, TIFFTAG_PLANARCONFIG, &planar);
+    TIFFGetFieldDefaulted(in, TIFFTAG_SAMPLEFORMAT, &format);
+    TIFFGetFieldDefaulted(in, TIFFTAG_COMPRESSION, &compression);
+    TIFFGetFieldDefaulted(in, TIFFTAG_PREDICTOR, &predictor);
+    TIFFGetFieldDefaulted(in, TIFFTAG_INKSET, &inkset);
+    TIFFGetFieldDefaulted(in, TIFFTAG_EXTRASAMPLES, &extraCount, &extraTypes);
+
+    Converter::colorSpace cs = Converter::colorSpaceUnknown;
+    switch (photometric) {
+    case PHOTOMETRIC_MINISBLACK:
+        cs = Converter::colorSpaceGRAY;
+        break;
+    case PHOTOMETRIC_RGB:
+        cs = Converter::colorSpaceRGB;
+        break;
+    case PHOTOMETRIC_SEPARATED:
+        if (inkset == INKSET_CMYK) { cs = Converter::colorSpaceCMYK; }
+        break;
+    default:;
+    }
+    const bool alpha = extraCount == 1 && extraTypes && extraTypes[0] != EXTRASAMPLE_ASSOCALPHA;
+
+    // planar, float, palette, premultiplied and other layouts, and codecs
+    // that can not be written back as is, are left to ImageMagick
+    if (cs == Converter::colorSpaceUnknown ||
+        (bits != 8 && bits != 16) ||
+        planar != PLANARCONFIG_CONTIG ||
+        format != SAMPLEFORMAT_UINT ||
+        samples != Converter::pixelChannels(cs, alpha) ||
+        !tiffCompression(compression)) {
+        closeTiff(&stream);
+        return StreamUnsupported;
+    }
+
+    uint32_t iccLength = 0;
+    void *iccData = nullptr;
+    QByteArray icc;
+    if (TIFFGetField(in, TIFFTAG_ICCPROFILE, &iccLength, &iccData) && iccData) {
+        icc = QByteArray(static_cast<const char*>(iccData), static_cast<int>(iccLength));
+    }
+
+    // tiled images are read one row of tiles at a time
+    const bool tiled = TIFFIsTiled(in);
+    uint32_t tileWidth = 0;
+    uint32_t tileLength = 0;
+    size_t rows = streamRows(width, settings.threads);
+    if (tiled) {
+        TIFFGetField(in, TIFFTAG_TILEWIDTH, &tileWidth);
+        TIFFGetField(in, TIFFTAG_TILELENGTH, &tileLength);
+        if (tileWidth == 0 || tileLength == 0) {
+            closeTiff(&stream);
+            return StreamUnsupported;
+        }
+        stream.tile.resize(static_cast<size_t>(TIFFTileSize(in)));
+        rows = tileLength;
+    }
+    if (!prepareBand(&stream.band, icc, cs, alpha, bits / 8, width, rows, 0, 0, settings)) {
+        closeTiff(&stream);
+        return StreamUnsupported;
+    }
+
+    const qint64 outputSize = static_cast<qint64>(width) * height * static_cast<qint64>(stream.band.outputPixel);
+    stream.output = openTiff(output, outputSize > Q_INT64_C(0xF0000000) ? "w8" : "w");
+    if (!stream.output) {
+        closeTiff(&stream);
+        *error = QString("Unable to write %1").arg(output);
+        return StreamFailed;
+    }
+    TIFF *out = stream.output;
+    TIFFSetField(out, TIFFTAG_IMAGEWIDTH, width);
+    TIFFSetField(out, TIFFTAG_IMAGELENGTH, height);
+    TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, bits);
+    TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, static_cast<uint16_t>(Converter::pixelChannels(settings.output.cs, alpha)));
+    TIFFSetField(out, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+    TIFFSetField(out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(out, TIFFTAG_COMPRESSION, compression);
+    if (predictor == PREDICTOR_HORIZONTAL && compression != COMPRESSION_NONE && compression != COMPRESSION_PACKBITS) {
+        TIFFSetField(out, TIFFTAG_PREDICTOR, predictor);
+    }
+    switch (settings.output.cs) {
+    case Converter::colorSpaceCMYK:
+        TIFFSetField(out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_SEPARATED);
+        TIFFSetField(out, TIFFTAG_INKSET, INKSET_CMYK);
+        break;
+    case Converter::colorSpaceGRAY:
+        TIFFSetField(out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+        break;
+    default:
+        TIFFSetField(out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+    }
+    if (alpha) { TIFFSetField(out, TIFFTAG_EXTRASAMPLES, extraCount, extraTypes); }
+    TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(out, 0));
+    TIFFSetField(out, TIFFTAG_ICCPROFILE,
+                 static_cast<uint32_t>(settings.output.data.size()),
+                 settings.output.data.constData());
+    copyTiffTags(in, out);
+
+    Band *band = &stream.band;
+    bool ok = true;
+    bool cancelled = false;
+    for (uint32_t y = 0; ok && y < height; ) {
+        cancelled = isCancelled(settings);
+        if (cancelled) {
+            ok = false;
+            break;
+        }
+        const uint32_t count = static_cast<uint32_t>(qMin<size_t>(band->rows, height - y));
+        if (tiled) {
+            ok = readTiffTiles(&stream, y, count, width, tileWidth);
+        } else {
+            for (uint32_t i = 0; ok && i < count; ++i) {
+                ok = TIFFReadScanline(in, band->input.data() + static_cast<size_t>(i) * width * band->inputPixel, y + i, 0) >= 0;
+            }
+        }
+        if (!ok) { break; }
+        transformBand(band, count, settings.threads);
+        for (uint32_t i = 0; ok && i < count; ++i) {
+            ok = TIFFWriteScanline(out, band->output.data() + static_cast<size_t>(i) * width * band->outputPixel, y + i, 0) >= 0;
+        }
+        y += count;
+    }
+    if (ok) { ok = TIFFFlush(out) != 0; }
+    closeTiff(&stream);
+    if (!ok) {
+        QFile::remove(output);
+        *error = cancelled ? QString("Cancelled") : QString("Unable to convert %1").arg(input);
+        return StreamFailed;
+    }
+    return StreamConverted;
+}
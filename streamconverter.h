@@ -0,0 +1,71 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef STREAMCONVERTER_H
+#define STREAMCONVERTER_H
+
+#include <QString>
+#include <QAtomicInt>
+
+#include <lcms2.h>
+
+#include "converter.h"
+
+class StreamConverter
+{
+public:
+
+    enum Status {
+        StreamConverted,
+        StreamUnsupported,
+        StreamFailed
+    };
+
+    struct Settings
+    {
+        Converter::Profile output;
+        cmsUInt32Number intent = INTENT_PERCEPTUAL;
+        bool blackPoint = true;
+        int threads = 0;
+        bool lut = false;
+        const QAtomicInt *cancel = nullptr;
+    };
+
+    static bool isSupported(const QString &filename);
+    static Status convert(const QString &input,
+                          const QString &output,
+                          const Settings &settings,
+                          QString *error);
+
+private:
+    static Status convertJpeg(const QString &input,
+                              const QString &output,
+                              const Settings &settings,
+                              QString *error);
+    static Status convertPng(const QString &input,
+                             const QString &output,
+                             const Settings &settings,
+                             QString *error);
+    static Status convertTiff(const QString &input,
+                              const QString &output,
+                              const Settings &settings,
+                              QString *error);
+};
+
+#endif // STREAMCONVERTER_H
@@ -0,0 +1,241 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#include "transformcache.h"
+
+#include <QCryptographicHash>
+#include <QMutexLocker>
+#include <QGlobalStatic>
+#include <QDebug>
+
+#include "profileregistry.h"
+
+#define TRANSFORM_CACHE_SIZE 64
+
+Q_GLOBAL_STATIC(TransformCache, transformCache)
+
+TransformCache::TransformCache()
+    : _capacity(TRANSFORM_CACHE_SIZE)
+    , _clock(0)
+{
+}
+
+bool TransformCache::Key::operator==(const TransformCache::Key &other) const
+{
+    return input == other.input &&
+           output == other.output &&
+           inputFormat == other.inputFormat &&
+           outputFormat == other.outputFormat &&
+           intent == other.intent &&
+           blackPoint == other.blackPoint &&
+           gamut == other.gamut;
+}
+
+uint qHash(const TransformCache::Key &key, uint seed)
+{
+    uint hash = qHash(key.input, seed);
+    hash = hash * 31 + qHash(key.output, seed);
+    hash = hash * 31 + key.inputFormat;
+    hash = hash * 31 + key.outputFormat;
+    hash = hash * 31 + key.intent;
+    hash = hash * 31 + (key.blackPoint ? 1 : 0);
+    hash = hash * 31 + (key.gamut ? 1 : 0);
+    return hash;
+}
+
+TransformCache *TransformCache::instance()
+{
+    return transformCache();
+}
+
+QByteArray TransformCache::digest(const QByteArray &profile)
+{
+    return QCryptographicHash::hash(profile, QCryptographicHash::Md5);
+}
+
+TransformCache::Transform TransformCache::transform(const QByteArray &inputProfile,
+                                                   const QByteArray &inputDigest,
+                                                   const QByteArray &outputProfile,
+                                                   const QByteArray &outputDigest,
+                                                   cmsUInt32Number inputFormat,
+                                                   cmsUInt32Number outputFormat,
+                                                   cmsUInt32Number intent,
+                                                   bool blackPoint,
+                                                   bool *cached)
+{
+    Key key;
+    key.input = inputDigest;
+    key.output = outputDigest;
+    key.inputFormat = inputFormat;
+    key.outputFormat = outputFormat;
+    key.intent = intent;
+    key.blackPoint = blackPoint;
+    return lookup(key, inputProfile, outputProfile, cached);
+}
+
+// checks input pixels against the gamut of the output profile, the
+// output is Lab with 0/-128/-128 for colors the output cannot reproduce
+TransformCache::Transform TransformCache::gamutCheck(const QByteArray &inputProfile,
+                                                    const QByteArray &inputDigest,
+                                                    const QByteArray &outputProfile,
+                                                    const QByteArray &outputDigest,
+                                                    cmsUInt32Number inputFormat,
+                                                    cmsUInt32Number intent,
+                                                    bool blackPoint)
+{
+    Key key;
+    key.input = inputDigest;
+    key.output = outputDigest;
+    key.inputFormat = inputFormat;
+    key.outputFormat = TYPE_Lab_8;
+    key.intent = intent;
+    key.blackPoint = blackPoint;
+    key.gamut = true;
+    return lookup(key, inputProfile, outputProfile, nullptr);
+}
+
+TransformCache::Transform TransformCache::lookup(const Key &key,
+                                                const QByteArray &inputProfile,
+                                                const QByteArray &outputProfile,
+                                                bool *cached)
+{
+    QSharedPointer<Entry> entry;
+    {
+        QMutexLocker lock(&_mutex);
+        entry = _entries.value(key);
+        if (entry.isNull()) {
+            entry = QSharedPointer<Entry>(new Entry);
+            _entries.insert(key, entry);
+        }
+        entry->used = ++_clock;
+        evict();
+    }
+
+    // workers asking for the same key wait here for the first one to
+    // build it, workers asking for other keys are not blocked
+    QMutexLocker lock(&entry->mutex);
+    // the counters only follow the conversion transforms
+    if (entry->built) {
+        if (!key.gamut) { _hits.ref(); }
+        if (cached) { *cached = true; }
+        return entry->transform;
+    }
+    if (!key.gamut) { _misses.ref(); }
+    if (cached) { *cached = false; }
+    entry->transform = createTransform(inputProfile, outputProfile, key);
+    entry->built = true;
+    return entry->transform;
+}
+
+int TransformCache::hits() const
+{
+    return _hits.load();
+}
+
+int TransformCache::misses() const
+{
+    return _misses.load();
+}
+
+int TransformCache::capacity() const
+{
+    return _capacity;
+}
+
+void TransformCache::setCapacity(int entries)
+{
+    QMutexLocker lock(&_mutex);
+    _capacity = entries;
+    evict();
+}
+
+void TransformCache::clear()
+{
+    QMutexLocker lock(&_mutex);
+    _entries.clear();
+}
+
+// drops the least recently used transforms over the capacity, workers
+// still holding one keep it alive until they are done, 0 is no limit
+void TransformCache::evict()
+{
+    while (_capacity > 0 && _entries.size() > _capacity) {
+        QHash<Key, QSharedPointer<Entry> >::iterator oldest = _entries.begin();
+        for (QHash<Key, QSharedPointer<Entry> >::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            if (it.value()->used < oldest.value()->used) { oldest = it; }
+        }
+        _entries.erase(oldest);
+    }
+}
+
+TransformCache::Transform TransformCache::createTransform(const QByteArray &inputProfile,
+                                                         const QByteArray &outputProfile,
+                                                         const Key &key)
+{
+    qDebug() << "createTransform" << key.input.toHex() << key.output.toHex() << key.intent << key.blackPoint;
+
+    cmsContext context = ProfileRegistry::context();
+    cmsHPROFILE input = cmsOpenProfileFromMemTHR(context,
+                                                 inputProfile.constData(),
+                                                 static_cast<cmsUInt32Number>(inputProfile.size()));
+    cmsHPROFILE output = cmsOpenProfileFromMemTHR(context,
+                                                  outputProfile.constData(),
+                                                  static_cast<cmsUInt32Number>(outputProfile.size()));
+    if (!input || !output) {
+        if (input) { cmsCloseProfile(input); }
+        if (output) { cmsCloseProfile(output); }
+        return Transform();
+    }
+
+    // the transform is shared between threads, which lcms allows with
+    // its one pixel cache on, every call works on its own copy of it, and
+    // it saves the runs of equal pixels in flat backgrounds
+    cmsUInt32Number flags = cmsFLAGS_HIGHRESPRECALC;
+    if (key.blackPoint) { flags |= cmsFLAGS_BLACKPOINTCOMPENSATION; }
+#ifdef cmsFLAGS_COPY_ALPHA
+    if (!key.gamut) { flags |= cmsFLAGS_COPY_ALPHA; }
+#endif
+
+    cmsHTRANSFORM transform = nullptr;
+    if (key.gamut) {
+        // the alarm code replaces colors out of gamut, nothing else in
+        // the engine checks gamut so it is set on the shared context
+        cmsUInt16Number alarm[cmsMAXCHANNELS] = {};
+        cmsSetAlarmCodesTHR(context, alarm);
+        cmsHPROFILE lab = cmsCreateLab4ProfileTHR(context, nullptr);
+        if (lab) {
+            transform = cmsCreateProofingTransformTHR(context,
+                                                      input, key.inputFormat,
+                                                      lab, key.outputFormat,
+                                                      output,
+                                                      key.intent, key.intent,
+                                                      flags | cmsFLAGS_GAMUTCHECK);
+            cmsCloseProfile(lab);
+        }
+    } else {
+        transform = cmsCreateTransformTHR(context,
+                                          input, key.inputFormat,
+                                          output, key.outputFormat,
+                                          key.intent, flags);
+    }
+    cmsCloseProfile(input);
+    cmsCloseProfile(output);
+    if (!transform) { return Transform(); }
+    return Transform(transform, cmsDeleteTransform);
+}
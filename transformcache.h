@@ -0,0 +1,107 @@
+/*
+#
+# Copyright (c) 2021 NettStudio AS. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>
+#
+*/
+
+#ifndef TRANSFORMCACHE_H
+#define TRANSFORMCACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QAtomicInt>
+
+#include <memory>
+
+#include <lcms2.h>
+
+class TransformCache
+{
+public:
+
+    struct Key
+    {
+        QByteArray input;
+        QByteArray output;
+        cmsUInt32Number inputFormat;
+        cmsUInt32Number outputFormat;
+        cmsUInt32Number intent;
+        bool blackPoint;
+        bool gamut = false;
+        bool operator==(const Key &other) const;
+    };
+
+    typedef std::shared_ptr<void> Transform;
+
+    TransformCache();
+
+    static TransformCache *instance();
+    static QByteArray digest(const QByteArray &profile);
+
+    Transform transform(const QByteArray &inputProfile,
+                        const QByteArray &inputDigest,
+                        const QByteArray &outputProfile,
+                        const QByteArray &outputDigest,
+                        cmsUInt32Number inputFormat,
+                        cmsUInt32Number outputFormat,
+                        cmsUInt32Number intent,
+                        bool blackPoint,
+                        bool *cached = nullptr);
+    Transform gamutCheck(const QByteArray &inputProfile,
+                         const QByteArray &inputDigest,
+                         const QByteArray &outputProfile,
+                         const QByteArray &outputDigest,
+                         cmsUInt32Number inputFormat,
+                         cmsUInt32Number intent,
+                         bool blackPoint);
+
+    int hits() const;
+    int misses() const;
+    int capacity() const;
+    void setCapacity(int entries);
+    void clear();
+
+private:
+    struct Entry
+    {
+        QMutex mutex;
+        bool built = false;
+        quint64 used = 0;
+        Transform transform;
+    };
+
+    Transform lookup(const Key &key,
+                     const QByteArray &inputProfile,
+                     const QByteArray &outputProfile,
+                     bool *cached);
+    Transform createTransform(const QByteArray &inputProfile,
+                              const QByteArray &outputProfile,
+                              const Key &key);
+    void evict();
+
+    QMutex _mutex;
+    QHash<Key, QSharedPointer<Entry> > _entries;
+    QAtomicInt _hits;
+    QAtomicInt _misses;
+    int _capacity;
+    quint64 _clock;
+};
+
+uint qHash(const TransformCache::Key &key, uint seed = 0);
+
+#endif // TRANSFORMCACHE_H